@@ -0,0 +1,136 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * arena.c - memory that is all freed at once
+ */
+
+#include <stdlib.h>
+
+#include "arena.h"
+
+/* Keep allocations aligned, so that an arena can hold structs too */
+#define ARENA_ALIGN(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+void arena_init(struct arena *a)
+{
+  a->first = NULL;
+  a->current = NULL;
+}
+
+static struct arena_block *new_block(size_t len)
+{
+struct arena_block *b;
+size_t size = ARENA_BLOCK;
+
+  while (size < len)
+    size *= 2;
+  b = malloc(sizeof(struct arena_block) + size);
+  if (b == NULL)
+    return NULL;
+  b->next = NULL;
+  b->size = size;
+  b->used = 0;
+  return b;
+}
+
+void *arena_alloc(struct arena *a, size_t len)
+{
+struct arena_block *b;
+struct arena_block *prev;
+void *p;
+
+  len = ARENA_ALIGN(len);
+
+  /*
+   * Move on to the next block that is big enough. Blocks kept from before
+   * a reset are reused; ones too small for this allocation are skipped.
+   */
+  prev = a->current;
+  b = a->current;
+  while (b && (b->used + len > b->size))
+  {
+    prev = b;
+    b = b->next;
+    if (b)
+      b->used = 0;
+  }
+
+  if (b == NULL)
+  {
+    b = new_block(len);
+    if (b == NULL)
+      return NULL;
+    if (prev)
+      prev->next = b;
+    else
+      a->first = b;
+  }
+
+  a->current = b;
+  p = b->data + b->used;
+  b->used += len;
+  return p;
+}
+
+void arena_reset(struct arena *a)
+{
+  a->current = a->first;
+  if (a->current)
+    a->current->used = 0;
+}
+
+void arena_free(struct arena *a)
+{
+struct arena_block *b;
+struct arena_block *next;
+
+  for (b = a->first; b; b = next)
+  {
+    next = b->next;
+    free(b);
+  }
+  a->first = NULL;
+  a->current = NULL;
+}
+
+int buffer_reserve(char **buffp, size_t *sizep, size_t len)
+{
+size_t size;
+char *buff;
+
+  if (len <= *sizep)
+    return 0;
+  size = *sizep ? *sizep : 1024;
+  while (size < len)
+    size *= 2;
+  buff = realloc(*buffp, size);
+  if (buff == NULL)
+    return -1;
+  *buffp = buff;
+  *sizep = size;
+  return 0;
+}
@@ -0,0 +1,63 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * arena.h - memory that is all freed at once
+ *
+ * Allocation just moves a pointer along a block. arena_reset makes all the
+ * memory available again without giving it back to malloc, so a reader
+ * that resets its arena at each page doesn't allocate once it has seen the
+ * biggest page.
+ */
+
+#define ARENA_BLOCK 65536
+
+struct arena_block {
+  struct arena_block *next;
+  size_t size;
+  size_t used;
+  char data[];
+};
+
+struct arena {
+  struct arena_block *first;
+  struct arena_block *current;
+};
+
+void arena_init(struct arena *a);
+
+void *arena_alloc(struct arena *a, size_t len);
+
+void arena_reset(struct arena *a);
+
+void arena_free(struct arena *a);
+
+/*
+ * A buffer that grows with realloc, for the few things that have to
+ * outlive a page. Makes room for len bytes; returns -1 if out of memory.
+ */
+
+int buffer_reserve(char **buffp, size_t *sizep, size_t len);
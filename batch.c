@@ -0,0 +1,671 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * batch.c - convert many books at once
+ *
+ * A batch is a list of input files, given either as a manifest (one file
+ * name per line) or as a directory. Each input is converted into its own
+ * output file in an output directory.
+ *
+ * The books are shared out between a fixed number of worker threads.
+ * Each worker has its own queue of books, with the biggest books first.
+ * A worker that runs out of books steals from the end of another worker's
+ * queue, so that a few very large books don't leave the other workers
+ * idle at the end of the run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "trace.h"
+
+struct queue {
+  pthread_mutex_t lock;
+  int *jobs;
+  int head;
+  int tail;
+};
+
+struct batch {
+  struct batch_job *jobs;
+  struct queue *queues;
+  int nthreads;
+  mode_t umask; /* For the output files, as fopen would create them */
+  batch_fn convert;
+  void *arg;
+};
+
+struct worker {
+  struct batch *batch;
+  int id;
+};
+
+static double now()
+{
+struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static char *output_name(char *input, char *outdir, char *suffix)
+{
+char *base;
+char *dot;
+char *name;
+int len;
+
+  base = strrchr(input, '/');
+  if (base)
+    base++;
+  else
+    base = input;
+
+  dot = strrchr(base, '.');
+  if (dot && (dot != base))
+    len = dot - base;
+  else
+    len = strlen(base);
+
+  name = malloc(strlen(outdir) + len + strlen(suffix) + 2);
+  if (name == NULL)
+    return NULL;
+  sprintf(name, "%s/%.*s%s", outdir, len, base, suffix);
+  return name;
+}
+
+static int add_job(struct batch_job **jobsp, int *njobs, int *size,
+  char *input, char *outdir, char *suffix)
+{
+struct batch_job *job;
+struct stat st;
+
+  if (*njobs == *size)
+  {
+    *size = *size ? 2 * *size : 64;
+    job = realloc(*jobsp, *size * sizeof(struct batch_job));
+    if (job == NULL)
+      return -1;
+    *jobsp = job;
+  }
+  job = *jobsp + *njobs;
+  memset(job, 0, sizeof(struct batch_job));
+  job->input = strdup(input);
+  job->output = output_name(input, outdir, suffix);
+  if ((job->input == NULL) || (job->output == NULL))
+    return -1;
+  if (stat(input, &st) == 0)
+    job->bytes = st.st_size;
+  (*njobs)++;
+  return 0;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+  return strcmp(*(char **) a, *(char **) b);
+}
+
+static int compare_outputs(const void *a, const void *b)
+{
+  return strcmp((*(struct batch_job **) a)->output,
+    (*(struct batch_job **) b)->output);
+}
+
+/*
+ * Only the base name of each input is kept, so inputs from different
+ * directories (or with different suffixes) can end up with the same
+ * output. Returns -1 if any do.
+ */
+
+static int check_outputs(struct batch_job *jobs, int njobs)
+{
+struct batch_job **sorted;
+int status = 0;
+int i;
+
+  sorted = malloc((njobs + 1) * sizeof(struct batch_job *));
+  if (sorted == NULL)
+  {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+  for (i=0;i<njobs;i++)
+    sorted[i] = jobs + i;
+  qsort(sorted, njobs, sizeof(struct batch_job *), compare_outputs);
+
+  for (i=1;i<njobs;i++)
+  {
+    if (strcmp(sorted[i-1]->output, sorted[i]->output) == 0)
+    {
+      fprintf(stderr, "%s and %s would both be written to %s\n",
+        sorted[i-1]->input, sorted[i]->input, sorted[i]->output);
+      status = -1;
+    }
+  }
+
+  free(sorted);
+  return status;
+}
+
+/*
+ * Build the list of books from a manifest file or a directory.
+ * Returns the number of books, or -1 on error, including when two books
+ * would have the same output file.
+ */
+
+int read_batch(char *path, char *outdir, char *suffix,
+  struct batch_job **jobsp)
+{
+struct stat st;
+struct dirent *d;
+DIR *dir;
+FILE *f;
+char **names = NULL;
+char *name;
+char line[4096];
+int nnames = 0;
+int njobs = 0;
+int size = 0;
+int len;
+int i;
+
+  *jobsp = NULL;
+
+  if (stat(path, &st) != 0)
+  {
+    perror(path);
+    return -1;
+  }
+
+  if (S_ISDIR(st.st_mode))
+  {
+    dir = opendir(path);
+    if (dir == NULL)
+    {
+      perror(path);
+      return -1;
+    }
+    while ((d = readdir(dir)) != NULL)
+    {
+      if (d->d_name[0] == '.')
+        continue;
+      name = malloc(strlen(path) + strlen(d->d_name) + 2);
+      if (name == NULL)
+        break;
+      sprintf(name, "%s/%s", path, d->d_name);
+      if ((stat(name, &st) != 0) || !S_ISREG(st.st_mode))
+      {
+        free(name);
+        continue;
+      }
+      names = realloc(names, (nnames+1)*sizeof(char *));
+      names[nnames] = name;
+      nnames++;
+    }
+    closedir(dir);
+
+    /* Directory order is arbitrary; sort so that reports are repeatable */
+    qsort(names, nnames, sizeof(char *), compare_names);
+    for (i=0;i<nnames;i++)
+    {
+      if (add_job(jobsp, &njobs, &size, names[i], outdir, suffix) < 0)
+        return -1;
+      free(names[i]);
+    }
+    free(names);
+  }
+  else
+  {
+    f = fopen(path, "r");
+    if (f == NULL)
+    {
+      perror(path);
+      return -1;
+    }
+    while (fgets(line, sizeof(line), f))
+    {
+      len = strlen(line);
+      while ((len > 0) && ((line[len-1] == '\n') || (line[len-1] == '\r')))
+        len--;
+      line[len] = '\0';
+      if ((len == 0) || (line[0] == '#'))
+        continue;
+      if (add_job(jobsp, &njobs, &size, line, outdir, suffix) < 0)
+      {
+        fclose(f);
+        return -1;
+      }
+    }
+    fclose(f);
+  }
+
+  if (check_outputs(*jobsp, njobs) < 0)
+  {
+    free_batch(*jobsp, njobs);
+    *jobsp = NULL;
+    return -1;
+  }
+
+  return njobs;
+}
+
+void free_batch(struct batch_job *jobs, int njobs)
+{
+int i;
+
+  for (i=0;i<njobs;i++)
+  {
+    free(jobs[i].input);
+    free(jobs[i].output);
+  }
+  free(jobs);
+}
+
+int batch_threads()
+{
+long n;
+
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    n = 1;
+  return n;
+}
+
+/*
+ * The output is written to a temporary file in the same directory and
+ * renamed into place once it is complete, so a book that fails doesn't
+ * leave half an output behind, and the input is never opened for
+ * writing even if the output turns out to be the same file.
+ */
+
+static void convert_job(struct batch *b, struct batch_job *job)
+{
+struct stat in_st;
+struct stat out_st;
+FILE *in;
+FILE *out;
+char *tmp;
+double start;
+uint64_t t;
+int fd;
+
+  start = now();
+  TRACE_START(t);
+
+  in = fopen(job->input, "r");
+  if (in == NULL)
+  {
+    perror(job->input);
+    job->status = -1;
+    return;
+  }
+
+  /* The names may differ (bin/x.txt and ./bin/x.txt) for the same file */
+  if ((fstat(fileno(in), &in_st) == 0) && (stat(job->output, &out_st) == 0)
+    && (in_st.st_dev == out_st.st_dev) && (in_st.st_ino == out_st.st_ino))
+  {
+    fprintf(stderr, "%s: output would overwrite input\n", job->input);
+    fclose(in);
+    job->status = -1;
+    return;
+  }
+
+  tmp = malloc(strlen(job->output) + 8);
+  if (tmp == NULL)
+  {
+    fprintf(stderr, "Out of memory\n");
+    fclose(in);
+    job->status = -1;
+    return;
+  }
+  sprintf(tmp, "%s.XXXXXX", job->output);
+  fd = mkstemp(tmp);
+  if ((fd < 0) || (fchmod(fd, 0666 & ~b->umask) != 0)
+    || ((out = fdopen(fd, "w")) == NULL))
+  {
+    perror(job->output);
+    if (fd >= 0)
+    {
+      close(fd);
+      unlink(tmp);
+    }
+    free(tmp);
+    fclose(in);
+    job->status = -1;
+    return;
+  }
+
+  job->status = b->convert(b->arg, job->input, in, out);
+
+  if (ferror(in))
+    job->status = -1;
+  fclose(in);
+  if (fclose(out) != 0)
+    job->status = -1;
+
+  if (job->status == 0)
+  {
+    if (rename(tmp, job->output) != 0)
+    {
+      perror(job->output);
+      job->status = -1;
+    }
+  }
+  if (job->status != 0)
+    unlink(tmp);
+  free(tmp);
+
+  job->seconds = now() - start;
+  TRACE_END(t, "batch", "book", "job", job - b->jobs);
+}
+
+/*
+ * Take the next book from our own queue, or steal one from the end of
+ * another worker's queue. Returns -1 when there is no work left anywhere.
+ * No new books are ever added, so once every queue is empty we are done.
+ */
+
+static int next_job(struct batch *b, int id)
+{
+struct queue *q;
+int job = -1;
+int i;
+
+  q = b->queues + id;
+  pthread_mutex_lock(&q->lock);
+  if (q->head < q->tail)
+  {
+    job = q->jobs[q->head];
+    q->head++;
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  for (i=1;(job < 0) && (i<b->nthreads);i++)
+  {
+    q = b->queues + (id + i) % b->nthreads;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail)
+    {
+      q->tail--;
+      job = q->jobs[q->tail];
+    }
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  return job;
+}
+
+static void *worker_main(void *arg)
+{
+struct worker *w = arg;
+int job;
+
+  trace_thread_name("batch worker");
+  while ((job = next_job(w->batch, w->id)) >= 0)
+    convert_job(w->batch, w->batch->jobs + job);
+
+  return NULL;
+}
+
+/* The size is copied in, so that the comparison needs no other state */
+struct sort_key {
+  long bytes;
+  int job;
+};
+
+static int compare_sizes(const void *a, const void *b)
+{
+const struct sort_key *x = a;
+const struct sort_key *y = b;
+
+  if (x->bytes > y->bytes)
+    return -1;
+  if (x->bytes < y->bytes)
+    return 1;
+  return x->job - y->job;
+}
+
+static void report_batch(struct batch_job *jobs, int njobs, double seconds)
+{
+double bytes = 0.0;
+int failed = 0;
+int i;
+
+  for (i=0;i<njobs;i++)
+  {
+    fprintf(stderr, "%-6s %8.3fs %10ld %s -> %s\n",
+      jobs[i].status ? "FAILED" : "ok",
+      jobs[i].seconds, jobs[i].bytes, jobs[i].input, jobs[i].output);
+    bytes += jobs[i].bytes;
+    if (jobs[i].status)
+      failed++;
+  }
+
+  if (seconds <= 0.0)
+    seconds = 1e-9;
+  fprintf(stderr, "%d books (%d failed), %.1f MB in %.3f s: "
+    "%.1f books/s, %.2f MB/s\n", njobs, failed, bytes/1e6, seconds,
+    njobs/seconds, bytes/1e6/seconds);
+}
+
+/*
+ * Convert every book in the batch, and report on the results.
+ * Returns the number of books that could not be converted.
+ */
+
+int run_batch(struct batch_job *jobs, int njobs, int nthreads,
+  batch_fn convert, void *arg)
+{
+struct batch b;
+struct worker *workers;
+pthread_t *threads;
+struct sort_key *order;
+double start;
+int failed = 0;
+int started;
+int i;
+
+  if (nthreads < 1)
+    nthreads = batch_threads();
+  if (nthreads > njobs)
+    nthreads = njobs;
+  if (nthreads < 1)
+    nthreads = 1;
+
+  b.jobs = jobs;
+  b.nthreads = nthreads;
+  b.umask = umask(0);
+  umask(b.umask);
+  b.convert = convert;
+  b.arg = arg;
+  b.queues = calloc(nthreads, sizeof(struct queue));
+  workers = calloc(nthreads, sizeof(struct worker));
+  threads = calloc(nthreads, sizeof(pthread_t));
+  order = calloc(njobs+1, sizeof(struct sort_key));
+  if ((b.queues == NULL) || (workers == NULL) || (threads == NULL)
+    || (order == NULL))
+  {
+    fprintf(stderr, "Out of memory\n");
+    return njobs;
+  }
+
+  for (i=0;i<nthreads;i++)
+  {
+    pthread_mutex_init(&b.queues[i].lock, NULL);
+    b.queues[i].jobs = calloc(njobs/nthreads + 1, sizeof(int));
+    if (b.queues[i].jobs == NULL)
+    {
+      fprintf(stderr, "Out of memory\n");
+      failed = njobs;
+      nthreads = i + 1;
+      goto out;
+    }
+  }
+
+  /* Deal the books out biggest first, so each queue starts with big ones */
+  for (i=0;i<njobs;i++)
+  {
+    order[i].bytes = jobs[i].bytes;
+    order[i].job = i;
+  }
+  qsort(order, njobs, sizeof(struct sort_key), compare_sizes);
+
+  for (i=0;i<njobs;i++)
+  {
+    struct queue *q = b.queues + i % nthreads;
+
+    q->jobs[q->tail] = order[i].job;
+    q->tail++;
+  }
+
+  start = now();
+
+  for (started=0;started<nthreads;started++)
+  {
+    workers[started].batch = &b;
+    workers[started].id = started;
+    if (pthread_create(threads+started, NULL, worker_main, workers+started))
+    {
+      /* Can't start any more threads; do the work in this one instead */
+      worker_main(workers+started);
+      break;
+    }
+  }
+  for (i=0;i<started;i++)
+    pthread_join(threads[i], NULL);
+
+  report_batch(jobs, njobs, now() - start);
+
+  for (i=0;i<njobs;i++)
+    if (jobs[i].status)
+      failed++;
+
+out:
+  for (i=0;i<nthreads;i++)
+  {
+    pthread_mutex_destroy(&b.queues[i].lock);
+    free(b.queues[i].jobs);
+  }
+  free(b.queues);
+  free(workers);
+  free(threads);
+  free(order);
+
+  return failed;
+}
+
+/*
+ * The --batch option of dphtml, dptxt and dpfoot.
+ * Returns the exit status for main.
+ */
+
+int batch_main(char *path, char *outdir, char *suffix, int nthreads,
+  batch_fn convert, void *arg)
+{
+struct batch_job *jobs;
+int njobs;
+int failed;
+
+  if (outdir == NULL)
+  {
+    fprintf(stderr, "--batch needs an output directory (-o)\n");
+    return 1;
+  }
+
+  njobs = read_batch(path, outdir, suffix, &jobs);
+  if (njobs < 0)
+    return 1;
+
+  failed = run_batch(jobs, njobs, nthreads, convert, arg);
+  free_batch(jobs, njobs);
+
+  return failed ? 1 : 0;
+}
+
+struct parallel {
+  parallel_fn fn;
+  void *arg;
+  int next;
+  int end;
+};
+
+static void *parallel_main(void *arg)
+{
+struct parallel *p = arg;
+int i;
+
+  while ((i = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED)) < p->end)
+    p->fn(p->arg, i);
+  return NULL;
+}
+
+static void *parallel_thread(void *arg)
+{
+  trace_thread_name("parallel");
+  return parallel_main(arg);
+}
+
+/*
+ * Call fn for each i from first up to (but not including) end, sharing
+ * them out between nthreads threads, this one included. Returns when
+ * they have all been done.
+ */
+
+void run_parallel(int first, int end, int nthreads, parallel_fn fn,
+  void *arg)
+{
+struct parallel p;
+pthread_t *threads;
+int started = 0;
+
+  p.fn = fn;
+  p.arg = arg;
+  p.next = first;
+  p.end = end;
+
+  if (nthreads > end - first)
+    nthreads = end - first;
+  threads = (nthreads > 1) ? calloc(nthreads, sizeof(pthread_t)) : NULL;
+  if (threads)
+  {
+    for (started = 0; started < nthreads - 1; started++)
+      if (pthread_create(threads + started, NULL, parallel_thread, &p))
+        break;
+  }
+  parallel_main(&p);
+  while (started > 0)
+    pthread_join(threads[--started], NULL);
+  free(threads);
+}
@@ -0,0 +1,66 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * batch.h - convert many books at once
+ */
+
+struct batch_job {
+  char *input;
+  char *output;
+  long bytes; /* Size of the input file */
+  int status; /* 0 if the book was converted successfully */
+  double seconds;
+};
+
+/*
+ * Converts one book. Each call gets its own input and output file, and
+ * may run on any worker thread. name is the input file's, to go with
+ * the warnings.
+ */
+typedef int (*batch_fn)(void *arg, char *name, FILE *infile, FILE *outfile);
+
+int read_batch(char *path, char *outdir, char *suffix,
+  struct batch_job **jobsp);
+
+int batch_threads();
+
+int run_batch(struct batch_job *jobs, int njobs, int nthreads,
+  batch_fn convert, void *arg);
+
+void free_batch(struct batch_job *jobs, int njobs);
+
+int batch_main(char *path, char *outdir, char *suffix, int nthreads,
+  batch_fn convert, void *arg);
+
+/*
+ * One piece of a job that is split between threads, such as a chunk of
+ * the pages of a book.
+ */
+typedef void (*parallel_fn)(void *arg, int i);
+
+void run_parallel(int first, int end, int nthreads, parallel_fn fn,
+  void *arg);
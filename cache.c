@@ -0,0 +1,390 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * cache.c - a cache of rendered pieces of a book, on disk or in memory
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+/* Change this whenever the format of an entry changes */
+#define CACHE_MAGIC "dpcache1"
+
+/* Makes the names of temporary files unique between threads */
+static int cache_seq;
+
+/*
+ * The key is two independent 64-bit hashes, each taking eight bytes at a
+ * time, so that hashing a page costs much less than rendering it.
+ */
+
+#define CACHE_MUL1 0x9e3779b97f4a7c15ULL
+#define CACHE_MUL2 0xc2b2ae3d27d4eb4fULL
+
+static uint64_t cache_mix(uint64_t h, uint64_t w, uint64_t mul)
+{
+  h ^= w * mul;
+  h = (h << 29) | (h >> 35);
+  return h * 0xff51afd7ed558ccdULL;
+}
+
+void cache_key_init(struct cache_key *k)
+{
+  k->h[0] = 0x243f6a8885a308d3ULL;
+  k->h[1] = 0x13198a2e03707344ULL;
+}
+
+void cache_key_add(struct cache_key *k, const void *data, size_t len)
+{
+const unsigned char *p = data;
+uint64_t w;
+
+  /* The length goes in too, so that where one piece ends is part of it */
+  k->h[0] = cache_mix(k->h[0], len, CACHE_MUL1);
+  k->h[1] = cache_mix(k->h[1], len, CACHE_MUL2);
+  while (len >= 8)
+  {
+    memcpy(&w, p, 8);
+    k->h[0] = cache_mix(k->h[0], w, CACHE_MUL1);
+    k->h[1] = cache_mix(k->h[1], w, CACHE_MUL2);
+    p += 8;
+    len -= 8;
+  }
+  if (len > 0)
+  {
+    w = 0;
+    memcpy(&w, p, len);
+    k->h[0] = cache_mix(k->h[0], w, CACHE_MUL1);
+    k->h[1] = cache_mix(k->h[1], w, CACHE_MUL2);
+  }
+}
+
+/*
+ * Entries go in subdirectories named after the first byte of the key,
+ * so that no one directory gets too big.
+ */
+
+static char *entry_name(char *dir, struct cache_key *k, int make_dirs)
+{
+char *name;
+
+  name = malloc(strlen(dir) + 64);
+  if (name == NULL)
+    return NULL;
+  sprintf(name, "%s/%02x", dir, (unsigned int) (k->h[0] >> 56));
+  if (make_dirs)
+  {
+    mkdir(dir, 0777);
+    mkdir(name, 0777);
+  }
+  sprintf(name + strlen(name), "/%014llx%016llx",
+    (unsigned long long) (k->h[0] & 0xffffffffffffffULL),
+    (unsigned long long) k->h[1]);
+  return name;
+}
+
+/*
+ * Look up an entry. Returns 0 and fills in e if it was found, -1 if not.
+ */
+
+int cache_load(char *dir, struct cache_key *k, struct cache_entry *e)
+{
+struct stat st;
+char *name;
+char *cp;
+char *end;
+FILE *f;
+uint64_t len;
+int i;
+
+  memset(e, 0, sizeof(struct cache_entry));
+  name = entry_name(dir, k, 0);
+  if (name == NULL)
+    return -1;
+  f = fopen(name, "rb");
+  free(name);
+  if (f == NULL)
+    return -1;
+
+  if ((fstat(fileno(f), &st) < 0) ||
+    (st.st_size < (off_t) (sizeof(CACHE_MAGIC) + 4)))
+  {
+    fclose(f);
+    return -1;
+  }
+  e->data = malloc(st.st_size);
+  if ((e->data == NULL) ||
+    (fread(e->data, 1, st.st_size, f) != (size_t) st.st_size))
+  {
+    fclose(f);
+    cache_entry_free(e);
+    return -1;
+  }
+  fclose(f);
+
+  /* The magic number, the number of parts, then each length and part */
+  cp = e->data;
+  end = e->data + st.st_size;
+  if (memcmp(cp, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0)
+  {
+    cache_entry_free(e);
+    return -1;
+  }
+  cp += sizeof(CACHE_MAGIC);
+  e->nparts = (unsigned char) *cp;
+  cp += 4;
+  if (e->nparts > CACHE_MAX_PARTS)
+  {
+    cache_entry_free(e);
+    return -1;
+  }
+  for (i = 0; i < e->nparts; i++)
+  {
+    if (end - cp < 8)
+      break;
+    memcpy(&len, cp, 8);
+    cp += 8;
+    if (len > (uint64_t) (end - cp))
+      break;
+    e->part[i] = cp;
+    e->len[i] = len;
+    cp += len;
+  }
+  if ((i < e->nparts) || (cp != end))
+  {
+    /* Cut short, perhaps by a full disk */
+    cache_entry_free(e);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Store an entry. Returns -1 if it couldn't be written.
+ */
+
+int cache_save(char *dir, struct cache_key *k, struct cache_entry *e)
+{
+char *name;
+char *tmp;
+char header[sizeof(CACHE_MAGIC) + 4];
+uint64_t len;
+FILE *f;
+int status = 0;
+int i;
+
+  name = entry_name(dir, k, 1);
+  if (name == NULL)
+    return -1;
+  tmp = malloc(strlen(name) + 48);
+  if (tmp == NULL)
+  {
+    free(name);
+    return -1;
+  }
+  sprintf(tmp, "%s.%ld.%d", name, (long) getpid(),
+    __atomic_fetch_add(&cache_seq, 1, __ATOMIC_RELAXED));
+
+  f = fopen(tmp, "wb");
+  if (f == NULL)
+  {
+    free(tmp);
+    free(name);
+    return -1;
+  }
+  memset(header, 0, sizeof(header));
+  memcpy(header, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header[sizeof(CACHE_MAGIC)] = e->nparts;
+  fwrite(header, 1, sizeof(header), f);
+  for (i = 0; i < e->nparts; i++)
+  {
+    len = e->len[i];
+    fwrite(&len, 1, 8, f);
+    fwrite(e->part[i], 1, e->len[i], f);
+  }
+  if (ferror(f))
+    status = -1;
+  if (fclose(f) != 0)
+    status = -1;
+
+  if ((status < 0) || (rename(tmp, name) < 0))
+  {
+    unlink(tmp);
+    status = -1;
+  }
+  free(tmp);
+  free(name);
+  return status;
+}
+
+void cache_entry_free(struct cache_entry *e)
+{
+  free(e->data);
+  e->data = NULL;
+  e->nparts = 0;
+}
+
+void cache_table_init(struct cache_table *t)
+{
+  t->slots = NULL;
+  t->size = 0;
+  t->count = 0;
+  t->generation = 1;
+}
+
+/* Open addressing, with the key (already a good hash) as the index */
+static struct cache_slot *table_slot(struct cache_slot *slots, size_t size,
+  struct cache_key *k)
+{
+size_t i;
+
+  i = k->h[0] & (size - 1);
+  while (slots[i].generation &&
+    ((slots[i].key.h[0] != k->h[0]) || (slots[i].key.h[1] != k->h[1])))
+    i = (i + 1) & (size - 1);
+  return slots + i;
+}
+
+/*
+ * Look up an entry, which stays owned by the table. Returns NULL if it
+ * isn't there.
+ */
+
+struct cache_entry *cache_table_find(struct cache_table *t,
+  struct cache_key *k)
+{
+struct cache_slot *slot;
+
+  if (t->size == 0)
+    return NULL;
+  slot = table_slot(t->slots, t->size, k);
+  if (slot->generation == 0)
+    return NULL;
+  slot->generation = t->generation;
+  return &slot->e;
+}
+
+static int table_resize(struct cache_table *t, size_t size)
+{
+struct cache_slot *slots;
+size_t i;
+
+  slots = calloc(size, sizeof(struct cache_slot));
+  if (slots == NULL)
+    return -1;
+  for (i = 0; i < t->size; i++)
+    if (t->slots[i].generation)
+      *table_slot(slots, size, &t->slots[i].key) = t->slots[i];
+  free(t->slots);
+  t->slots = slots;
+  t->size = size;
+  return 0;
+}
+
+/*
+ * Store a copy of an entry. Returns -1 if there isn't enough memory.
+ */
+
+int cache_table_add(struct cache_table *t, struct cache_key *k,
+  struct cache_entry *e)
+{
+struct cache_slot *slot;
+struct cache_entry copy;
+size_t len = 0;
+char *cp;
+int i;
+
+  if ((2*(t->count + 1) > t->size) &&
+    (table_resize(t, t->size ? 2*t->size : 1024) < 0))
+    return -1;
+
+  for (i = 0; i < e->nparts; i++)
+    len += e->len[i];
+  copy.data = malloc(len ? len : 1);
+  if (copy.data == NULL)
+    return -1;
+  cp = copy.data;
+  for (i = 0; i < e->nparts; i++)
+  {
+    memcpy(cp, e->part[i], e->len[i]);
+    copy.part[i] = cp;
+    copy.len[i] = e->len[i];
+    cp += e->len[i];
+  }
+  copy.nparts = e->nparts;
+
+  slot = table_slot(t->slots, t->size, k);
+  if (slot->generation)
+    cache_entry_free(&slot->e);
+  else
+    t->count++;
+  slot->key = *k;
+  slot->e = copy;
+  slot->generation = t->generation;
+  return 0;
+}
+
+/*
+ * Throw away the entries that haven't been used or added since the last
+ * sweep, so that the table only holds what the latest conversion needed.
+ */
+
+void cache_table_sweep(struct cache_table *t)
+{
+size_t i;
+
+  for (i = 0; i < t->size; i++)
+    if (t->slots[i].generation && (t->slots[i].generation != t->generation))
+    {
+      cache_entry_free(&t->slots[i].e);
+      t->slots[i].generation = 0;
+      t->count--;
+    }
+
+  /* Emptied slots would break the chains of probes, so rebuild */
+  if (t->size > 0)
+    table_resize(t, t->size);
+  t->generation++;
+}
+
+void cache_table_free(struct cache_table *t)
+{
+size_t i;
+
+  for (i = 0; i < t->size; i++)
+    if (t->slots[i].generation)
+      cache_entry_free(&t->slots[i].e);
+  free(t->slots);
+  cache_table_init(t);
+}
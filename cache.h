@@ -0,0 +1,87 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * cache.h - an on-disk cache of rendered pieces of a book
+ *
+ * Each entry is a file named after a 128-bit hash of everything that went
+ * into it, and holds a few parts (e.g. the state at the end of a page,
+ * its HTML and its warnings). Entries are written to a temporary name and
+ * renamed into place, so several processes can share one cache.
+ *
+ * A cache_table holds entries in memory instead, for a process that
+ * converts the same book over and over.
+ */
+
+#include <stdint.h>
+
+struct cache_key {
+  uint64_t h[2];
+};
+
+void cache_key_init(struct cache_key *k);
+
+void cache_key_add(struct cache_key *k, const void *data, size_t len);
+
+#define CACHE_MAX_PARTS 4
+
+struct cache_entry {
+  char *data; /* All the parts, one after another */
+  char *part[CACHE_MAX_PARTS];
+  size_t len[CACHE_MAX_PARTS];
+  int nparts;
+};
+
+int cache_load(char *dir, struct cache_key *k, struct cache_entry *e);
+
+int cache_save(char *dir, struct cache_key *k, struct cache_entry *e);
+
+void cache_entry_free(struct cache_entry *e);
+
+struct cache_slot {
+  struct cache_key key;
+  struct cache_entry e;
+  unsigned int generation; /* When it was last used, or 0 if empty */
+};
+
+struct cache_table {
+  struct cache_slot *slots;
+  size_t size; /* A power of two */
+  size_t count;
+  unsigned int generation;
+};
+
+void cache_table_init(struct cache_table *t);
+
+struct cache_entry *cache_table_find(struct cache_table *t,
+  struct cache_key *k);
+
+int cache_table_add(struct cache_table *t, struct cache_key *k,
+  struct cache_entry *e);
+
+void cache_table_sweep(struct cache_table *t);
+
+void cache_table_free(struct cache_table *t);
@@ -0,0 +1,154 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * comments.c - remove [** ] comments from a Distributed Proofreaders file
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "dptools.h"
+#include "markup.h"
+
+#define TAG_OTHER 0
+#define TAG_COMMENT 1
+
+void comments_context_init(struct comments_context *ctx)
+{
+  memset(ctx, 0, sizeof(struct comments_context));
+  ctx->emit = emit_to_file;
+  ctx->emit_arg = stdout;
+}
+
+static void push_tag(struct comments_context *ctx, int tag)
+{
+  if (ctx->depth < 50)
+  {
+    ctx->tag_stack[ctx->depth] = tag;
+    ctx->depth++;
+  }
+}
+
+static int pop_tag(struct comments_context *ctx)
+{
+  if (ctx->depth > 0)
+  {
+    ctx->depth--;
+    return ctx->tag_stack[ctx->depth];
+  }
+  else
+    return -1;
+}
+
+/*
+ * Process one line of input, as read by reader_line.
+ */
+
+void comments_line(struct comments_context *ctx, char *in_buff)
+{
+char *out_buff;
+int comment_on_line = 0;
+int len;
+char *in_ptr;
+char *out_ptr;
+int tag;
+
+  len = strlen(in_buff);
+  /* Strip <CR><LF> from the end of the line.
+   * Note that the file may have DOS, not UNIX, <CR><LF> convention.
+   */
+  if ((len > 0) && (in_buff[len-1] == '\n'))
+  {
+    in_buff[len-1] = '\0';
+    len--;
+  }
+  if ((len > 0) && (in_buff[len-1] == '\r'))
+  {
+    in_buff[len-1] = '\0';
+    len--;
+  }
+
+  /*
+   * The output is never longer than the input, so the line is edited
+   * in place.
+   */
+  comment_on_line = ctx->comment_mode;
+  in_ptr = in_buff;
+  out_buff = in_buff;
+  out_ptr = out_buff;
+
+  while (*in_ptr)
+  {
+    if ((*in_ptr == '[') && (markup_token(in_ptr, &len) == MK_COMMENT))
+    {
+      ctx->comment_mode = 1;
+      comment_on_line = 1;
+      in_ptr += len;
+      push_tag(ctx, TAG_COMMENT);
+    }
+    else if (*in_ptr == '[')
+    {
+      push_tag(ctx, TAG_OTHER);
+      if (ctx->comment_mode == 0)
+      {
+        *out_ptr = *in_ptr;
+        out_ptr++;
+      }
+      in_ptr++;
+    }
+    else if (*in_ptr == ']')
+    {
+      tag = pop_tag(ctx);
+      in_ptr++;
+      if (tag == TAG_COMMENT)
+        ctx->comment_mode = 0;
+      else if (ctx->comment_mode == 0)
+      {
+        *out_ptr = ']';
+        out_ptr++;
+      }
+    }
+    else if (ctx->comment_mode == 0)
+    {
+      *out_ptr = *in_ptr;
+      out_ptr++;
+      in_ptr++;
+    }
+    else
+    {
+      in_ptr++;
+    }
+  }
+  *out_ptr = 0;
+  len = strlen(out_buff);
+  while ((len > 0) && (out_buff[len-1] == ' '))
+    len--;
+  out_buff[len] = 0;
+  if ((len > 0) || (comment_on_line == 0))
+    ctx->emit(ctx->emit_arg, out_buff);
+}
@@ -0,0 +1,602 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * diag.c - warnings about the input
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "diag.h"
+#include "utf8.h"
+
+static char *diag_names[DIAG_NCODES] = {
+  "page-error",
+  "poetry-already-open",
+  "blockquote-already-open",
+  "poetry-not-open",
+  "blockquote-not-open",
+  "poetry-not-closed",
+  "blockquote-not-closed",
+  "control-character",
+  "tags-not-closed",
+  "unexpected-tag",
+  "tags-mismatch",
+  "unrecognized-sequence",
+  "greek-character",
+  "greek-state",
+  "close-quote-after-space",
+  "open-quote-before-space",
+  "malformed-format",
+  "unexpected-markup",
+  "wrap-overflow"
+};
+
+/* Longest part of a line that is kept to show where a warning was */
+#define DIAG_SNIPPET 200
+
+/* Write the buffer out once it holds this much */
+#define DIAG_FLUSH 65536
+
+struct diag *diag_new(FILE *out, int format, int max)
+{
+struct diag *d;
+
+  d = calloc(1, sizeof(struct diag));
+  if (d == NULL)
+    return NULL;
+  pthread_mutex_init(&d->lock, NULL);
+  d->out = out;
+  d->format = format;
+  d->max = max;
+  d->seen_page = -1;
+  arena_init(&d->arena);
+  return d;
+}
+
+/*
+ * Returns 1 if the same warning has already been given on this page.
+ */
+
+static int is_repeat(struct diag *d, struct diag_record *r)
+{
+uint64_t h = 0xcbf29ce484222325ULL;
+unsigned char *cp;
+uint64_t *seen;
+size_t size;
+size_t i;
+size_t j;
+
+  if (r->page != d->seen_page)
+  {
+    if (d->nseen > 0)
+      memset(d->seen, 0, d->seen_size * sizeof(uint64_t));
+    d->nseen = 0;
+    d->seen_page = r->page;
+  }
+
+  h = (h ^ r->code) * 0x100000001b3ULL;
+  for (cp = (unsigned char *) r->message; *cp; cp++)
+    h = (h ^ *cp) * 0x100000001b3ULL;
+  if (h == 0)
+    h = 1;
+
+  if (2*(d->nseen + 1) > d->seen_size)
+  {
+    size = d->seen_size ? 2*d->seen_size : 64;
+    seen = calloc(size, sizeof(uint64_t));
+    if (seen == NULL)
+      return 0;
+    for (i = 0; i < d->seen_size; i++)
+    {
+      if (d->seen[i] == 0)
+        continue;
+      for (j = d->seen[i] & (size - 1); seen[j]; j = (j + 1) & (size - 1))
+        ;
+      seen[j] = d->seen[i];
+    }
+    free(d->seen);
+    d->seen = seen;
+    d->seen_size = size;
+  }
+
+  for (i = h & (d->seen_size - 1); d->seen[i]; i = (i + 1) & (d->seen_size - 1))
+    if (d->seen[i] == h)
+      return 1;
+  d->seen[i] = h;
+  d->nseen++;
+  return 0;
+}
+
+static void put(struct diag *d, char *str, size_t len)
+{
+  if (buffer_reserve(&d->buff, &d->size, d->len + len) < 0)
+    return;
+  memcpy(d->buff + d->len, str, len);
+  d->len += len;
+}
+
+static void put_json_string(struct diag *d, char *str)
+{
+char esc[8];
+unsigned char *cp;
+unsigned char *run;
+
+  put(d, "\"", 1);
+  for (cp = run = (unsigned char *) str; *cp; cp++)
+  {
+    if ((*cp >= 0x20) && (*cp != '"') && (*cp != '\\'))
+      continue;
+    put(d, (char *) run, cp - run);
+    if ((*cp == '"') || (*cp == '\\'))
+      sprintf(esc, "\\%c", *cp);
+    else
+      sprintf(esc, "\\u%04x", *cp);
+    put(d, esc, strlen(esc));
+    run = cp + 1;
+  }
+  put(d, (char *) run, cp - run);
+  put(d, "\"", 1);
+}
+
+/*
+ * The same for the text format, which goes to a terminal: control
+ * characters and bytes that aren't UTF-8 are shown as escapes, rather
+ * than being sent as they are.
+ */
+
+static void put_text_string(struct diag *d, char *str)
+{
+char esc[8];
+char *cp;
+char *run;
+char *next;
+int c;
+
+  for (cp = run = str; *cp; cp = next)
+  {
+    next = cp;
+    c = utf8_decode(&next);
+    if ((c < 0x20) || (c == 0x7f) ||
+      ((c == UTF8_REPLACEMENT) && (next == cp + 1)))
+      sprintf(esc, "\\x%02x", (unsigned char) *cp);
+    else if ((c >= 0x80) && (c < 0xa0))
+      sprintf(esc, "\\u%04x", c);
+    else
+      continue;
+    put(d, run, cp - run);
+    put(d, esc, strlen(esc));
+    run = next;
+  }
+  put(d, run, cp - run);
+}
+
+static void format_record(struct diag *d, struct diag_record *r)
+{
+char num[64];
+
+  if (d->format == DIAG_JSON)
+  {
+    put(d, "{\"code\":", 8);
+    put_json_string(d, diag_names[r->code]);
+    if (d->name)
+    {
+      put(d, ",\"file\":", 8);
+      put_json_string(d, d->name);
+    }
+    sprintf(num, ",\"page\":%d,\"line\":%d,\"column\":%d,\"message\":",
+      r->page, r->line, r->column);
+    put(d, num, strlen(num));
+    put_json_string(d, r->message);
+    if (r->snippet)
+    {
+      put(d, ",\"snippet\":", 11);
+      put_json_string(d, r->snippet);
+    }
+    put(d, "}\n", 2);
+  }
+  else
+  {
+    if (d->name)
+    {
+      put_text_string(d, d->name);
+      put(d, ":", 1);
+    }
+    if (r->line && r->column)
+      sprintf(num, "%d:%d: ", r->line, r->column);
+    else if (r->line)
+      sprintf(num, "%d: ", r->line);
+    else
+      strcpy(num, d->name ? " " : "");
+    put(d, num, strlen(num));
+    sprintf(num, "page %d: ", r->page);
+    put(d, num, strlen(num));
+    put_text_string(d, r->message);
+    put(d, " [", 2);
+    put(d, diag_names[r->code], strlen(diag_names[r->code]));
+    put(d, "]\n", 2);
+    if (r->snippet)
+    {
+      put(d, "    ", 4);
+      put_text_string(d, r->snippet);
+      put(d, "\n", 1);
+    }
+  }
+}
+
+static void write_out(struct diag *d)
+{
+  if (d->out && (d->len > 0))
+    fwrite(d->buff, 1, d->len, d->out);
+  d->len = 0;
+}
+
+static char *copy_string(struct diag *d, char *str, size_t max)
+{
+size_t len;
+char *copy;
+
+  len = strnlen(str, max);
+  copy = arena_alloc(&d->arena, len + 1);
+  if (copy)
+  {
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+  }
+  return copy;
+}
+
+/*
+ * Give a warning, or keep it if the channel has no output. The lock must
+ * be held.
+ */
+
+static void add_record(struct diag *d, struct diag_record *r)
+{
+struct diag_record *rec;
+size_t size;
+
+  if (d->format == DIAG_DISCARD)
+    return;
+  if (is_repeat(d, r))
+  {
+    d->repeated++;
+    return;
+  }
+
+  if (d->out == NULL)
+  {
+    if (d->nrecords == d->records_size)
+    {
+      size = d->records_size ? 2*d->records_size : 16;
+      rec = realloc(d->records, size * sizeof(struct diag_record));
+      if (rec == NULL)
+        return;
+      d->records = rec;
+      d->records_size = size;
+    }
+    rec = d->records + d->nrecords;
+    *rec = *r;
+    rec->message = copy_string(d, r->message, strlen(r->message));
+    rec->snippet = r->snippet ? copy_string(d, r->snippet, DIAG_SNIPPET) : NULL;
+    if (rec->message)
+      d->nrecords++;
+    return;
+  }
+
+  if (d->max && (d->kept >= d->max))
+  {
+    d->dropped++;
+    return;
+  }
+  d->kept++;
+  format_record(d, r);
+  if (d->len >= DIAG_FLUSH)
+    write_out(d);
+}
+
+void diag_vreport(struct diag *d, int code, int page, int line, int column,
+  char *snippet, char *fmt, va_list ap)
+{
+struct diag_record r;
+char message[512];
+char cut[DIAG_SNIPPET + 1];
+
+  if ((d == NULL) || (d->format == DIAG_DISCARD))
+    return;
+
+  vsnprintf(message, sizeof(message), fmt, ap);
+  r.code = code;
+  r.page = page;
+  r.line = line;
+  r.column = column;
+  r.message = message;
+  r.snippet = NULL;
+  if (snippet)
+  {
+    strncpy(cut, snippet, DIAG_SNIPPET);
+    cut[DIAG_SNIPPET] = '\0';
+    r.snippet = cut;
+  }
+
+  pthread_mutex_lock(&d->lock);
+  add_record(d, &r);
+  pthread_mutex_unlock(&d->lock);
+}
+
+void diag_report(struct diag *d, int code, int page, int line, int column,
+  char *snippet, char *fmt, ...)
+{
+va_list ap;
+
+  va_start(ap, fmt);
+  diag_vreport(d, code, page, line, column, snippet, fmt, ap);
+  va_end(ap);
+}
+
+/*
+ * Pass on the records kept by from, as if they had been reported to to.
+ * line_offset is added to their line numbers.
+ */
+
+void diag_append(struct diag *to, struct diag *from, int line_offset)
+{
+struct diag_record r;
+size_t i;
+
+  if ((to == NULL) || (from == NULL))
+    return;
+  pthread_mutex_lock(&to->lock);
+  for (i = 0; i < from->nrecords; i++)
+  {
+    r = from->records[i];
+    if (r.line)
+      r.line += line_offset;
+    add_record(to, &r);
+  }
+  to->repeated += from->repeated;
+  pthread_mutex_unlock(&to->lock);
+}
+
+static int put_int(char **buffp, size_t *sizep, size_t *lenp, int n)
+{
+int32_t v = n;
+
+  if (buffer_reserve(buffp, sizep, *lenp + 4) < 0)
+    return -1;
+  memcpy(*buffp + *lenp, &v, 4);
+  *lenp += 4;
+  return 0;
+}
+
+static int put_string(char **buffp, size_t *sizep, size_t *lenp, char *str)
+{
+size_t len;
+
+  if (str == NULL)
+    return put_int(buffp, sizep, lenp, -1);
+  len = strlen(str);
+  if ((put_int(buffp, sizep, lenp, len) < 0) ||
+    (buffer_reserve(buffp, sizep, *lenp + len) < 0))
+    return -1;
+  memcpy(*buffp + *lenp, str, len);
+  *lenp += len;
+  return 0;
+}
+
+/*
+ * The kept records as bytes, e.g. to go in the cache, with line_offset
+ * taken off their line numbers. Returns -1 if out of memory.
+ */
+
+int diag_save(struct diag *d, char **buffp, size_t *lenp, int line_offset)
+{
+struct diag_record *r;
+size_t size = 0;
+size_t i;
+
+  *buffp = NULL;
+  *lenp = 0;
+  if ((put_int(buffp, &size, lenp, d->repeated) < 0) ||
+    (put_int(buffp, &size, lenp, d->nrecords) < 0))
+    return -1;
+  for (i = 0; i < d->nrecords; i++)
+  {
+    r = d->records + i;
+    if ((put_int(buffp, &size, lenp, r->code) < 0) ||
+      (put_int(buffp, &size, lenp, r->page) < 0) ||
+      (put_int(buffp, &size, lenp, r->line ? r->line - line_offset : 0) < 0) ||
+      (put_int(buffp, &size, lenp, r->column) < 0) ||
+      (put_string(buffp, &size, lenp, r->message) < 0) ||
+      (put_string(buffp, &size, lenp, r->snippet) < 0))
+      return -1;
+  }
+  return 0;
+}
+
+static int get_int(char **cpp, char *end, int *n)
+{
+int32_t v;
+
+  if (end - *cpp < 4)
+    return -1;
+  memcpy(&v, *cpp, 4);
+  *cpp += 4;
+  *n = v;
+  return 0;
+}
+
+/* The string is left where it is, and isn't NUL terminated */
+static int get_string(char **cpp, char *end, char **strp, int *lenp)
+{
+int len;
+
+  if (get_int(cpp, end, &len) < 0)
+    return -1;
+  *lenp = len;
+  if (len == -1)
+  {
+    *strp = NULL;
+    return 0;
+  }
+  if ((len < 0) || (len > end - *cpp))
+    return -1;
+  *strp = *cpp;
+  *cpp += len;
+  return 0;
+}
+
+static int load_records(struct diag *d, char *buff, size_t len,
+  int line_offset)
+{
+struct diag_record r;
+char *cp = buff;
+char *end = buff + len;
+char *message;
+char *snippet;
+int message_len;
+int snippet_len;
+int repeated;
+int n;
+int i;
+
+  if ((get_int(&cp, end, &repeated) < 0) || (get_int(&cp, end, &n) < 0) ||
+    (repeated < 0) || (n < 0))
+    return -1;
+  for (i = 0; i < n; i++)
+  {
+    if ((get_int(&cp, end, &r.code) < 0) || (get_int(&cp, end, &r.page) < 0)
+      || (get_int(&cp, end, &r.line) < 0)
+      || (get_int(&cp, end, &r.column) < 0)
+      || (get_string(&cp, end, &message, &message_len) < 0)
+      || (get_string(&cp, end, &snippet, &snippet_len) < 0)
+      || (message == NULL) || (r.code < 0) || (r.code >= DIAG_NCODES))
+      return -1;
+    if (d == NULL)
+      continue;
+    r.message = copy_string(d, message, message_len);
+    r.snippet = snippet ? copy_string(d, snippet, snippet_len) : NULL;
+    if (r.line)
+      r.line += line_offset;
+    if (r.message)
+      add_record(d, &r);
+  }
+  if (cp != end)
+    return -1;
+  if (d)
+    d->repeated += repeated;
+  return 0;
+}
+
+/*
+ * Report the records in a buffer made by diag_save. Returns -1, having
+ * reported nothing, if the buffer isn't well formed.
+ */
+
+int diag_load(struct diag *d, char *buff, size_t len, int line_offset)
+{
+int status;
+
+  if (load_records(NULL, buff, len, 0) < 0)
+    return -1;
+  pthread_mutex_lock(&d->lock);
+  status = load_records(d, buff, len, line_offset);
+  pthread_mutex_unlock(&d->lock);
+  return status;
+}
+
+void diag_flush(struct diag *d)
+{
+  pthread_mutex_lock(&d->lock);
+  write_out(d);
+  pthread_mutex_unlock(&d->lock);
+}
+
+/*
+ * Say how many warnings weren't given, write out what's left and free
+ * the channel.
+ */
+
+void diag_end(struct diag *d)
+{
+char line[256];
+
+  if (d == NULL)
+    return;
+
+  if (d->out && (d->repeated || d->dropped))
+  {
+    if (d->format == DIAG_JSON)
+    {
+      put(d, "{\"code\":\"summary\"", 17);
+      if (d->name)
+      {
+        put(d, ",\"file\":", 8);
+        put_json_string(d, d->name);
+      }
+    }
+    else if (d->name)
+    {
+      put_text_string(d, d->name);
+      put(d, ": ", 2);
+    }
+
+    if (d->format == DIAG_JSON)
+      sprintf(line, ",\"given\":%d,\"repeated\":%d,\"dropped\":%d}\n",
+        d->kept, d->repeated, d->dropped);
+    else if (d->dropped)
+      sprintf(line, "%d warning%s given; %d repeated on the same page and %d "
+        "over the limit of %d not shown\n", d->kept, (d->kept == 1) ? "" : "s",
+        d->repeated, d->dropped, d->max);
+    else
+      sprintf(line, "%d warning%s given; %d repeated on the same page not "
+        "shown\n", d->kept, (d->kept == 1) ? "" : "s", d->repeated);
+    put(d, line, strlen(line));
+  }
+  write_out(d);
+
+  pthread_mutex_destroy(&d->lock);
+  arena_free(&d->arena);
+  free(d->records);
+  free(d->seen);
+  free(d->buff);
+  free(d);
+}
+
+/*
+ * The format named by --diagnostics, or -1.
+ */
+
+int diag_format(char *name)
+{
+  if (strcmp(name, "text") == 0)
+    return DIAG_TEXT;
+  if (strcmp(name, "json") == 0)
+    return DIAG_JSON;
+  return -1;
+}
@@ -0,0 +1,123 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * diag.h - warnings about the input
+ *
+ * Each warning is recorded with where it was found: the page, line and
+ * column, and the text of the line. They are formatted (as text or as
+ * JSON Lines) into a buffer and written out in large pieces, rather than
+ * each going to stderr as it happens. The same warning on the same page
+ * is only given once, and there is a limit to how many one book gets.
+ *
+ * A channel with no output file keeps its records instead, so that a
+ * piece of a book rendered on its own (a chunk for -j, or a page for
+ * --cache) can hand them to the book's channel afterwards.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <pthread.h>
+
+enum diag_code {
+  DIAG_PAGE_ERROR,
+  DIAG_POETRY_OPEN,
+  DIAG_QUOTE_OPEN,
+  DIAG_POETRY_NOT_OPEN,
+  DIAG_QUOTE_NOT_OPEN,
+  DIAG_POETRY_NOT_CLOSED,
+  DIAG_QUOTE_NOT_CLOSED,
+  DIAG_CONTROL_CHAR,
+  DIAG_TAGS_NOT_CLOSED,
+  DIAG_UNEXPECTED_TAG,
+  DIAG_TAGS_MISMATCH,
+  DIAG_UNRECOGNIZED,
+  DIAG_GREEK_CHAR,
+  DIAG_GREEK_STATE,
+  DIAG_CLOSE_QUOTE,
+  DIAG_OPEN_QUOTE,
+  DIAG_FORMAT,
+  DIAG_MARKUP,
+  DIAG_WRAP,
+  DIAG_NCODES
+};
+
+#define DIAG_TEXT 0
+#define DIAG_JSON 1
+#define DIAG_DISCARD 2 /* For pages whose output is thrown away */
+
+/* Warnings kept for one book, unless --max-diagnostics says otherwise */
+#define DIAG_MAX 1000
+
+struct diag_record {
+  int code;
+  int page;
+  int line; /* From 1, or 0 if not known */
+  int column; /* In bytes from 1, or 0 if not known */
+  char *message;
+  char *snippet; /* NULL if there isn't one */
+};
+
+struct diag {
+  pthread_mutex_t lock;
+  FILE *out; /* NULL to keep the records */
+  char *name; /* Of the input, given with each warning (for --batch) */
+  int format;
+  int max; /* 0 for no limit */
+  int kept;
+  int repeated; /* Not given again, as they were on the same page */
+  int dropped; /* Not given, being over the limit */
+  struct diag_record *records;
+  size_t nrecords;
+  size_t records_size;
+  struct arena arena; /* The text of the records */
+  uint64_t *seen; /* Hashes of this page's warnings */
+  size_t seen_size;
+  size_t nseen;
+  int seen_page;
+  char *buff; /* Formatted, waiting to be written */
+  size_t len;
+  size_t size;
+};
+
+struct diag *diag_new(FILE *out, int format, int max);
+
+void diag_report(struct diag *d, int code, int page, int line, int column,
+  char *snippet, char *fmt, ...);
+
+void diag_vreport(struct diag *d, int code, int page, int line, int column,
+  char *snippet, char *fmt, va_list ap);
+
+void diag_append(struct diag *to, struct diag *from, int line_offset);
+
+int diag_save(struct diag *d, char **buffp, size_t *lenp, int line_offset);
+
+int diag_load(struct diag *d, char *buff, size_t len, int line_offset);
+
+void diag_flush(struct diag *d);
+
+void diag_end(struct diag *d);
+
+int diag_format(char *name);
@@ -0,0 +1,508 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * dpbench.c - time the tools over a fixed set of books
+ *
+ *   dpbench [-d tool directory] [-n runs] [-s megabytes] [-o results.json]
+ *
+ * The books (of about 8 MB each, or -s) are made up here, the same each
+ * time, so that builds can be compared: plain prose, Greek, footnotes, and
+ * poetry and drama. Each tool is run over each book once to warm up and
+ * then -n times (5 by default).
+ * The results (wall and CPU time, MB/s, pages/s and peak RSS, with 95%
+ * confidence intervals) are written as JSON, with a summary on stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_RUNS 100
+
+static char *tools[] = {"dphtml", "dptxt", "dpfoot", "dpcomments", "dpquotes",
+  "dpstrip", NULL};
+
+struct book {
+  char *name;
+  void (*page)(FILE *f, int page);
+  char path[64];
+  long bytes;
+  long pages;
+};
+
+struct summary {
+  double mean;
+  double ci; /* Half the width of the 95% confidence interval */
+  double min;
+};
+
+static uint32_t seed = 1;
+
+/* The same numbers every time, whatever the C library or word size */
+static int next_rand(int n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) % n;
+}
+
+static char *words[] = {"the", "of", "and", "to", "in", "that", "was", "his",
+  "he", "it", "with", "for", "as", "had", "which", "not", "by", "upon",
+  "little", "country", "against", "morning", "between", "gentleman",
+  "remarkable", "neighbourhood", "understanding", "nevertheless", "silence",
+  "letters", "river", "garden", "window", "answered", "himself", NULL};
+
+static char *greek_words[] = {"kai", "ho", "logos", "theos", "anthrôpos",
+  "psychê", "aretê", "ergon", "tôn", "tou", "polis", "dikê", "sophia",
+  "agathos", "ouk", "estin", NULL};
+
+static int nwords(char **w)
+{
+int n = 0;
+
+  while (w[n])
+    n++;
+  return n;
+}
+
+static void put_words(FILE *f, char **w, int n)
+{
+int count = nwords(w);
+int i;
+
+  for (i = 0; i < n; i++)
+    fprintf(f, "%s%s", i ? " " : "", w[next_rand(count)]);
+}
+
+/* A paragraph of lines of about 60 characters */
+static void paragraph(FILE *f, int lines, int greek)
+{
+int i;
+
+  for (i = 0; i < lines; i++)
+  {
+    put_words(f, words, 4 + next_rand(4));
+    if (next_rand(6) == 0)
+    {
+      fprintf(f, " <i>");
+      put_words(f, words, 2);
+      fprintf(f, "</i>");
+    }
+    if (greek && (next_rand(2) == 0))
+    {
+      fprintf(f, " [Greek: ");
+      put_words(f, greek_words, 2 + next_rand(5));
+      fprintf(f, "]");
+    }
+    fprintf(f, "%s\n", (i == lines - 1) ? "." : "");
+  }
+  fprintf(f, "\n");
+}
+
+static void page_break(FILE *f, int page)
+{
+  fprintf(f, "-----File: %04d.png---\\Proofer\\--------------------\n", page);
+}
+
+static void prose_page(FILE *f, int page)
+{
+int i;
+
+  page_break(f, page);
+  if (page % 20 == 1)
+    fprintf(f, "\n\n\n\nCHAPTER %d.\n\n\n", page / 20 + 1);
+  for (i = 0; i < 5; i++)
+    paragraph(f, 2 + next_rand(8), 0);
+}
+
+static void greek_page(FILE *f, int page)
+{
+int i;
+
+  page_break(f, page);
+  for (i = 0; i < 5; i++)
+    paragraph(f, 2 + next_rand(8), 1);
+}
+
+static void footnote_page(FILE *f, int page)
+{
+int notes = 1 + next_rand(4);
+int i;
+int j;
+
+  page_break(f, page);
+  for (i = 0; i < 4; i++)
+  {
+    for (j = 0; j < 3; j++)
+    {
+      put_words(f, words, 5 + next_rand(4));
+      if ((i < notes) && (j == 1))
+        fprintf(f, "[%d]", i + 1);
+      fprintf(f, "\n");
+    }
+    fprintf(f, "\n");
+  }
+  for (i = 0; i < notes; i++)
+  {
+    fprintf(f, "[Footnote %d: ", i + 1);
+    put_words(f, words, 8);
+    fprintf(f, "\n");
+    put_words(f, words, 3 + next_rand(12));
+    fprintf(f, ".]\n\n");
+  }
+}
+
+static char *speakers[] = {"HAMLET", "HORATIO", "OPHELIA", "POLONIUS",
+  "GERTRUDE", NULL};
+
+static void verse_page(FILE *f, int page)
+{
+int i;
+int j;
+
+  page_break(f, page);
+  fprintf(f, "/*\n");
+  for (i = 0; i < 3; i++)
+  {
+    for (j = 0; j < 4; j++)
+    {
+      fprintf(f, "%s", (j % 2) ? "  " : "");
+      put_words(f, words, 5 + next_rand(3));
+      fprintf(f, "%s\n", (j == 3) ? "." : ",");
+    }
+    fprintf(f, "\n");
+  }
+  fprintf(f, "*/\n\n");
+  for (i = 0; i < 6; i++)
+  {
+    fprintf(f, "%s. ", speakers[next_rand(nwords(speakers))]);
+    put_words(f, words, 6 + next_rand(6));
+    if (next_rand(3) == 0)
+    {
+      fprintf(f, " [");
+      put_words(f, words, 2);
+      fprintf(f, ".]");
+    }
+    fprintf(f, "\n\n");
+  }
+}
+
+static struct book books[] = {
+  {"prose", prose_page},
+  {"greek", greek_page},
+  {"footnotes", footnote_page},
+  {"verse", verse_page},
+  {NULL, NULL}
+};
+
+/*
+ * Write a book of about size bytes. Returns -1 if it can't be written.
+ */
+
+static int make_book(struct book *b, char *dir, long size)
+{
+FILE *f;
+
+  snprintf(b->path, sizeof(b->path), "%s/%s.txt", dir, b->name);
+  f = fopen(b->path, "w");
+  if (f == NULL)
+  {
+    perror(b->path);
+    return -1;
+  }
+  seed = 1;
+  b->pages = 0;
+  while (ftell(f) < size)
+  {
+    b->pages++;
+    b->page(f, b->pages);
+  }
+  b->bytes = ftell(f);
+  if (ferror(f) | fclose(f))
+  {
+    perror(b->path);
+    return -1;
+  }
+  return 0;
+}
+
+static double now(void)
+{
+struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Run the tool with the book as stdin, and the output thrown away.
+ * Returns -1 if it couldn't be run or failed.
+ */
+
+static int run_tool(char *path, char *book, double *wall, double *cpu,
+  long *rss)
+{
+struct rusage ru;
+double start;
+pid_t pid;
+int status;
+int fd;
+
+  start = now();
+  pid = fork();
+  if (pid < 0)
+    return -1;
+  if (pid == 0)
+  {
+    fd = open(book, O_RDONLY);
+    if (fd < 0)
+      _exit(127);
+    dup2(fd, 0);
+    close(fd);
+    fd = open("/dev/null", O_WRONLY);
+    if (fd < 0)
+      _exit(127);
+    dup2(fd, 1);
+    dup2(fd, 2);
+    close(fd);
+    execl(path, path, (char *) NULL);
+    _exit(127);
+  }
+
+  if (wait4(pid, &status, 0, &ru) < 0)
+    return -1;
+  *wall = now() - start;
+  *cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+  *rss = ru.ru_maxrss;
+  if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+    return -1;
+  return 0;
+}
+
+/* Student's t for a two-sided 95% interval, by degrees of freedom */
+static double t_table[] = {0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447,
+  2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+  2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056,
+  2.052, 2.048, 2.045, 2.042};
+
+static void summarize(double *x, int n, struct summary *s)
+{
+double sum = 0.0;
+double var = 0.0;
+int i;
+
+  s->min = x[0];
+  for (i = 0; i < n; i++)
+  {
+    sum += x[i];
+    if (x[i] < s->min)
+      s->min = x[i];
+  }
+  s->mean = sum / n;
+  s->ci = 0.0;
+  if (n < 2)
+    return;
+  for (i = 0; i < n; i++)
+    var += (x[i] - s->mean) * (x[i] - s->mean);
+  var /= n - 1;
+  s->ci = ((n - 1 < 31) ? t_table[n - 1] : 1.96) * sqrt(var / n);
+}
+
+static void print_summary(FILE *f, char *name, struct summary *s)
+{
+  fprintf(f, ",\"%s\":{\"mean\":%.6g,\"ci95\":%.6g,\"min\":%.6g}", name,
+    s->mean, s->ci, s->min);
+}
+
+/*
+ * Time one tool on one book. Returns -1 if any run failed.
+ */
+
+static int bench(FILE *out, int first, char *dir, char *tool, struct book *b,
+  int runs)
+{
+char path[1024];
+double wall[MAX_RUNS];
+double cpu[MAX_RUNS];
+double mbs[MAX_RUNS];
+double pps[MAX_RUNS];
+long rss;
+long max_rss = 0;
+struct summary s_wall;
+struct summary s_cpu;
+struct summary s_mbs;
+struct summary s_pps;
+int i;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, tool);
+
+  /* Once to warm up, for the page cache */
+  if (run_tool(path, b->path, wall, cpu, &rss) < 0)
+  {
+    fprintf(stderr, "%s failed on %s\n", path, b->path);
+    return -1;
+  }
+
+  for (i = 0; i < runs; i++)
+  {
+    if (run_tool(path, b->path, wall + i, cpu + i, &rss) < 0)
+    {
+      fprintf(stderr, "%s failed on %s\n", path, b->path);
+      return -1;
+    }
+    if (wall[i] <= 0.0)
+      wall[i] = 1e-9;
+    mbs[i] = b->bytes / wall[i] / 1e6;
+    pps[i] = b->pages / wall[i];
+    if (rss > max_rss)
+      max_rss = rss;
+  }
+
+  summarize(wall, runs, &s_wall);
+  summarize(cpu, runs, &s_cpu);
+  summarize(mbs, runs, &s_mbs);
+  summarize(pps, runs, &s_pps);
+
+  fprintf(out, "%s\n    {\"tool\":\"%s\",\"book\":\"%s\",\"bytes\":%ld,"
+    "\"pages\":%ld,\"runs\":%d", first ? "" : ",", tool, b->name, b->bytes,
+    b->pages, runs);
+  print_summary(out, "wall_s", &s_wall);
+  print_summary(out, "cpu_s", &s_cpu);
+  print_summary(out, "mb_per_s", &s_mbs);
+  print_summary(out, "pages_per_s", &s_pps);
+  fprintf(out, ",\"max_rss_kb\":%ld}", max_rss);
+
+  fprintf(stderr, "%-10s %-9s %8.2f MB/s +- %-6.2f %9.0f pages/s %8.3f s"
+    " wall %8.3f s cpu %7ld KB\n", tool, b->name, s_mbs.mean, s_mbs.ci,
+    s_pps.mean, s_wall.mean, s_cpu.mean, max_rss);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+char *dir = ".";
+char *outname = NULL;
+FILE *out = stdout;
+char tmpdir[] = "/tmp/dpbenchXXXXXX";
+long size = 8;
+int runs = 5;
+int status = 0;
+int first = 1;
+int i;
+int j;
+int c;
+
+  while ((c = getopt(argc, argv, "d:n:o:s:")) > -1)
+  {
+    switch (c)
+    {
+      case 'd':
+        dir = optarg;
+        break;
+      case 'n':
+        runs = atoi(optarg);
+        break;
+      case 'o':
+        outname = optarg;
+        break;
+      case 's':
+        size = atol(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: dpbench [-d tool directory] [-n runs] "
+          "[-s megabytes] [-o results.json]\n");
+        return 1;
+    }
+  }
+
+  if ((runs < 1) || (runs > MAX_RUNS) || (size < 1))
+  {
+    fprintf(stderr, "dpbench: -n must be 1 to %d, and -s at least 1\n",
+      MAX_RUNS);
+    return 1;
+  }
+
+  if (mkdtemp(tmpdir) == NULL)
+  {
+    perror(tmpdir);
+    return 1;
+  }
+  for (i = 0; books[i].name; i++)
+  {
+    if (make_book(books + i, tmpdir, size*1000000) < 0)
+    {
+      status = 1;
+      goto done;
+    }
+  }
+
+  if (outname)
+  {
+    out = fopen(outname, "w");
+    if (out == NULL)
+    {
+      perror(outname);
+      status = 1;
+      goto done;
+    }
+  }
+
+  fprintf(out, "{\"runs\":%d,\"results\":[", runs);
+  for (i = 0; tools[i]; i++)
+  {
+    for (j = 0; books[j].name; j++)
+    {
+      if (bench(out, first, dir, tools[i], books + j, runs) < 0)
+        status = 1;
+      else
+        first = 0;
+    }
+  }
+  fprintf(out, "\n]}\n");
+  if (ferror(out) | ((out != stdout) && fclose(out)))
+  {
+    perror(outname ? outname : "stdout");
+    status = 1;
+  }
+
+done:
+  for (i = 0; books[i].name; i++)
+    if (books[i].path[0])
+      unlink(books[i].path);
+  rmdir(tmpdir);
+  return status;
+}
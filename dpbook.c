@@ -0,0 +1,124 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * dpbook.c - make the HTML and plain text editions of a book in one go
+ *
+ *   dpbook [dphtml options] [dptxt options] -o book.html -t book.txt
+ *
+ * --trace file writes a timeline of the run; see trace.h.
+ *
+ * The book is read from stdin and scanned for markup once; see scan.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "dptools.h"
+#include "scan.h"
+#include "trace.h"
+
+static struct option long_options[] = {
+  {"trace", required_argument, NULL, 'T'},
+  {NULL, 0, NULL, 0}
+};
+
+static struct dp_context html;
+static struct txt_context txt;
+
+static FILE *open_output(char *name)
+{
+FILE *f;
+
+  f = fopen(name, "w");
+  if (f == NULL)
+    perror(name);
+  return f;
+}
+
+int main(int argc, char **argv)
+{
+char *html_name = NULL;
+char *txt_name = NULL;
+int status;
+int c;
+
+  context_init(&html);
+  txt_context_init(&txt);
+
+  while ((c = getopt_long(argc, argv, HTML_OPTIONS TXT_OPTIONS "o:t:",
+    long_options, NULL)) > -1)
+  {
+    switch (c)
+    {
+      case 'o':
+        html_name = optarg;
+        break;
+      case 't':
+        txt_name = optarg;
+        break;
+      case 'T':
+        if (trace_open(optarg) < 0)
+        {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default:
+        if ((html_option(&html, c, optarg) < 0) &&
+          (txt_option(&txt, c, optarg) < 0))
+        {
+          fprintf(stderr, "usage: dpbook [options] -o html -t txt\n");
+          return 1;
+        }
+        break;
+    }
+  }
+
+  if ((html_name == NULL) || (txt_name == NULL))
+  {
+    fprintf(stderr, "usage: dpbook [options] -o html -t txt\n");
+    return 1;
+  }
+
+  html.outfile = open_output(html_name);
+  txt.outfile = open_output(txt_name);
+  if ((html.outfile == NULL) || (txt.outfile == NULL))
+    return 1;
+
+  status = convert_both(&html, &txt, stdin);
+  trace_close();
+
+  if (ferror(html.outfile) | fclose(html.outfile) |
+    ferror(txt.outfile) | fclose(txt.outfile))
+  {
+    fprintf(stderr, "Error writing output\n");
+    return 1;
+  }
+
+  return status ? 1 : 0;
+}
@@ -0,0 +1,336 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * dpcheck.c - check the fast paths against the slow ones
+ *
+ *   dpcheck [-n rounds]
+ *
+ * transliterate_span must give the same Greek, warnings and final state
+ * as write_greek_char a character at a time, however a run is split up.
+ * copy_plain must give the same HTML as escaping a byte at a time, with
+ * each version this CPU can run and at every alignment. The inputs are
+ * made up here, the same each time. Exits with 1 if anything differed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include "dptools.h"
+#include "diag.h"
+#include "utf8.h"
+#include "plain.h"
+
+static uint32_t seed = 1;
+
+static int next_rand(int n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) % n;
+}
+
+static int checks = 0;
+static int failures = 0;
+
+static void show(char *what, char *str, size_t len)
+{
+size_t i;
+
+  fprintf(stderr, "%s: \"", what);
+  for (i=0;i<len;i++)
+    if (((unsigned char) str[i] < 0x20) || ((unsigned char) str[i] >= 0x7f))
+      fprintf(stderr, "\\x%02x", (unsigned char) str[i]);
+    else
+      fputc(str[i], stderr);
+  fprintf(stderr, "\"\n");
+}
+
+/*
+ * Greek: letters, the digraphs they make, and things that don't belong.
+ */
+
+static char *greek_pieces[] = {
+  "a", "b", "c", "d", "e", "g", "h", "i", "k", "l", "m", "n", "o", "p", "r",
+  "s", "t", "u", "x", "y", "z", "A", "C", "G", "H", "K", "N", "P", "R", "S",
+  "T", "X", " ", ",", ".", ";", ":", "'", "-", "(", ")", "1", "\xc3\xa9",
+  "\xc4\x93", "\xca\xbc", "\xe2\x82\xac", "\xf0\x9d\x94\x8a"
+};
+
+#define NPIECES (sizeof(greek_pieces)/sizeof(greek_pieces[0]))
+
+static void greek_context(struct dp_context *ctx)
+{
+  context_init(ctx);
+  ctx->diag_max = 0;
+  ctx->diag = diag_new(NULL, DIAG_TEXT, 0);
+  sink_init_memory(&ctx->out);
+}
+
+/*
+ * With no file to write to, the channel keeps every warning as a record
+ * (only repeats on the same page are counted instead), so the records
+ * themselves can be compared.
+ */
+
+static int same_string(char *a, char *b)
+{
+  if ((a == NULL) || (b == NULL))
+    return a == b;
+  return strcmp(a, b) == 0;
+}
+
+static int same_warnings(struct diag *a, struct diag *b)
+{
+struct diag_record *x;
+struct diag_record *y;
+size_t i;
+
+  if ((a->nrecords != b->nrecords) || (a->repeated != b->repeated))
+    return 0;
+  for (i=0;i<a->nrecords;i++)
+  {
+    x = a->records + i;
+    y = b->records + i;
+    if ((x->code != y->code) || (x->page != y->page) || (x->line != y->line)
+      || (x->column != y->column) || !same_string(x->message, y->message)
+      || !same_string(x->snippet, y->snippet))
+      return 0;
+  }
+  return 1;
+}
+
+static void show_warnings(char *what, struct diag *d)
+{
+size_t i;
+
+  fprintf(stderr, "%s: %d warnings, %d repeated\n", what, (int) d->nrecords,
+    d->repeated);
+  for (i=0;i<d->nrecords;i++)
+    fprintf(stderr, "    %d:%d: %s\n", d->records[i].code,
+      d->records[i].column, d->records[i].message);
+}
+
+static void greek_done(struct dp_context *ctx)
+{
+  diag_end(ctx->diag);
+  sink_free(&ctx->out);
+}
+
+static void check_greek(int round)
+{
+char text[512];
+int breaks[128];
+int nbreaks = 0;
+int len = 0;
+int n;
+int i;
+struct dp_context slow;
+struct dp_context fast;
+char *cp;
+char *space;
+int from;
+
+  n = next_rand(100);
+  for (i=0;i<n;i++)
+  {
+    cp = greek_pieces[next_rand(NPIECES)];
+    strcpy(text + len, cp);
+    len += strlen(cp);
+    /* A span always ends on a character boundary */
+    if (next_rand(8) == 0)
+      breaks[nbreaks++] = len;
+  }
+  breaks[nbreaks++] = len;
+
+  greek_context(&slow);
+  greek_context(&fast);
+
+  cp = text;
+  while (cp < text + len)
+    write_greek_char(&slow, utf8_decode(&cp));
+
+  from = 0;
+  for (i=0;i<nbreaks;i++)
+  {
+    space = sink_space(&fast.out, TRANSLIT_SPACE(breaks[i] - from));
+    fast.out.len += transliterate_span(&fast.s.greek_state, text + from,
+      breaks[i] - from, space, &fast);
+    from = breaks[i];
+  }
+
+  checks++;
+  if ((slow.out.len != fast.out.len)
+    || memcmp(slow.out.buff, fast.out.buff, slow.out.len)
+    || (slow.s.greek_state != fast.s.greek_state)
+    || !same_warnings(slow.diag, fast.diag))
+  {
+    fprintf(stderr, "transliterate_span differs in round %d (%d spans)\n",
+      round, nbreaks);
+    show("  input", text, len);
+    show("  write_greek_char", slow.out.buff, slow.out.len);
+    show("  transliterate_span", fast.out.buff, fast.out.len);
+    show_warnings("  write_greek_char", slow.diag);
+    show_warnings("  transliterate_span", fast.diag);
+    failures++;
+  }
+
+  greek_done(&slow);
+  greek_done(&fast);
+}
+
+/*
+ * Plain text: every byte that stops a run or is escaped, amongst letters.
+ */
+
+static char plain_bytes[] = "abcdefghijklmnopqrstuvwxyz ABCXYZ.,;:'!?()0123"
+  "\"&>^_<-[]}\xe2\x80\x9c\xc3\xa9\t";
+
+static int plain_byte(void)
+{
+  return (unsigned char) plain_bytes[next_rand(sizeof(plain_bytes) - 1)];
+}
+
+/* The text as write_line used to copy it, a byte at a time */
+static int slow_plain(struct sink *s, char *str)
+{
+int i;
+
+  for (i=0;;i++)
+  {
+    if (i > 0 && ((str[i] == '\0') || strchr("^_<-[]}\xe2", str[i])))
+      return i;
+    switch (str[i])
+    {
+      case '"':
+        sink_literal(s, "&quot;");
+        break;
+      case '&':
+        sink_literal(s, "&amp;");
+        break;
+      case '>':
+        sink_literal(s, "&gt;");
+        break;
+      case '<':
+        sink_literal(s, "&lt;");
+        break;
+      default:
+        sink_putc(s, str[i]);
+        break;
+    }
+  }
+}
+
+static void check_plain(struct plain_version *v, int align)
+{
+static char buff[512] __attribute__((aligned(64)));
+struct sink slow;
+struct sink fast;
+char *str = buff + align;
+int len;
+int n;
+int m;
+int i;
+
+  /* Fill past the end too, as the vector versions read whole blocks */
+  for (i=0;i<sizeof(buff);i++)
+    buff[i] = plain_byte();
+  len = next_rand(200);
+  if (next_rand(4) == 0)
+    len = 0;
+  str[0] = 'a' + next_rand(26);
+  str[len + 1] = '\0';
+
+  sink_init_memory(&slow);
+  sink_init_memory(&fast);
+  n = slow_plain(&slow, str);
+  sink_putc(&fast, str[0]);
+  m = v->copy(&fast, str);
+
+  checks++;
+  if ((n != m) || (slow.len != fast.len)
+    || memcmp(slow.buff, fast.buff, slow.len))
+  {
+    fprintf(stderr, "copy_plain (%s) differs at alignment %d: used %d "
+      "bytes, not %d\n", v->name, align, m, n);
+    show("  input", str, len + 1);
+    show("  a byte at a time", slow.buff, slow.len);
+    show("  copy_plain", fast.buff, fast.len);
+    failures++;
+  }
+
+  checks++;
+  if (plain_length(str) != n)
+  {
+    fprintf(stderr, "plain_length differs: %d bytes, not %d\n",
+      plain_length(str), n);
+    show("  input", str, len + 1);
+    failures++;
+  }
+
+  sink_free(&slow);
+  sink_free(&fast);
+}
+
+int main(int argc, char **argv)
+{
+struct plain_version versions[PLAIN_VERSIONS];
+int nversions;
+int rounds = 200;
+int c;
+int i;
+int j;
+int k;
+
+  while ((c = getopt(argc, argv, "n:")) != -1)
+  {
+    switch (c)
+    {
+      case 'n':
+        rounds = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: dpcheck [-n rounds]\n");
+        return 1;
+    }
+  }
+
+  nversions = plain_versions(versions);
+
+  for (i=0;i<rounds*10;i++)
+    check_greek(i);
+
+  for (i=0;i<nversions;i++)
+    for (j=0;j<64;j++)
+      for (k=0;k<rounds;k++)
+        check_plain(versions + i, j);
+
+  fprintf(stderr, "dpcheck: %d checks, %d failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
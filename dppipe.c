@@ -0,0 +1,141 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * dppipe.c - run the tools as a single pipeline, without a shell pipe
+ *
+ * Each -s option adds a stage, given as the tool name and its options:
+ *
+ *   dppipe -s strip -s comments -s "foot -N" -s quotes -s "html -n"
+ *
+ * The stages are strip, comments, foot, quotes, html and txt. The html or
+ * txt stage, if used, must be the last. With no -s options, the stages are
+ * strip, comments, foot, quotes and html.
+ *
+ * --trace file writes a timeline of the run, with the time each stage
+ * spends on each page; see trace.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "dptools.h"
+#include "pipe.h"
+#include "trace.h"
+
+static struct option long_options[] = {
+  {"trace", required_argument, NULL, 'T'},
+  {NULL, 0, NULL, 0}
+};
+
+static char *default_stages[] = {"strip", "comments", "foot", "quotes",
+  "html", NULL};
+
+int main(int argc, char **argv)
+{
+struct pipeline *p;
+FILE *outfile = stdout;
+struct reader r;
+char *line;
+char **stages;
+int nstages = 0;
+int status;
+int i;
+int c;
+
+  /*
+   * The stages parse their own options with getopt, so collect them all
+   * before adding any.
+   */
+  stages = malloc((argc + 1)*sizeof(char *));
+  if (stages == NULL)
+    return 1;
+
+  while ((c = getopt_long(argc, argv, "o:s:", long_options, NULL)) > -1)
+  {
+    switch (c)
+    {
+      case 'o':
+        outfile = fopen(optarg, "w");
+        if (outfile == NULL)
+        {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      case 's':
+        stages[nstages++] = optarg;
+        break;
+      case 'T':
+        if (trace_open(optarg) < 0)
+        {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default:
+        fprintf(stderr,
+          "usage: dppipe [-o outfile] [--trace file] [-s stage] ...\n");
+        return 1;
+    }
+  }
+
+  p = pipe_new(outfile);
+  if (p == NULL)
+    return 1;
+
+  if (nstages == 0)
+  {
+    free(stages);
+    stages = default_stages;
+    while (stages[nstages])
+      nstages++;
+  }
+
+  for (i = 0; i < nstages; i++)
+    if (pipe_add(p, stages[i]) < 0)
+      return 1;
+
+  pipe_begin(p);
+
+  reader_init(&r, stdin);
+
+  while ((line = reader_line(&r, NULL)) != NULL)
+    pipe_line(p, line);
+
+  status = reader_check(&r);
+  pipe_end(p);
+  pipe_free(p);
+  reader_free(&r);
+  trace_close();
+
+  if (outfile != stdout)
+    fclose(outfile);
+
+  return status ? 1 : 0;
+}
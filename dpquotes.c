@@ -25,12 +25,11 @@
  */
 
 #include <stdio.h>
-#include <wchar.h>
-#include <wctype.h>
-#include <locale.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "dptools.h"
+
 /*
  * dpquotes.c - Turn straight double quotes into directional quotes
  *
@@ -56,93 +55,25 @@
 
 int main(int argc, char **argv)
 {
-static wchar_t buff[1024];
-wchar_t *ptr;
-int len;
-int inside_quotes = 0;
-int old_style = 0;
+struct quotes_context ctx;
+struct reader r;
+char *line;
+int status;
 int c;
 
-  setlocale(LC_ALL, getenv("LANG"));
-
-  while ((c = getopt(argc, argv, "p")) > -1)
-  {
-    switch (c)
-    {
-      case 'p':
-        old_style = 1;
-        break;
-    }
-  }
-
-  while (fgetws(buff, sizeof(buff), stdin) > 0)
-  {
-    len = wcslen(buff);
-
-    /*
-     * Strip <CR><LF> from the end of the line.
-     * Note that the file may have DOS, not UNIX, <CR><LF> convention.
-     */
-
-    if (buff[len-1] == '\n')
-    {
-      buff[len-1] = '\0';
-      len--;
-    }
-    if (buff[len-1] == '\r')
-    {
-      buff[len-1] = '\0';
-      len--;
-    }
-
-    /* Strip trailing spaces */
-
-    while ((len > 0) && (buff[len-1] == ' '))
-    {
-      buff[len-1] = '\0';
-      len--;
-    }
+  quotes_context_init(&ctx);
 
-    if (len == 0)
-      inside_quotes = 0;
+  while ((c = getopt(argc, argv, QUOTES_OPTIONS)) > -1)
+    quotes_option(&ctx, c, optarg);
 
-    ptr = buff;
+  reader_init(&r, stdin);
 
-    while (*ptr)
-    {
-      if (*ptr == '"')
-      {
-        if (inside_quotes)
-        {
-          putwchar(0x201d);
-          inside_quotes = 0;
-          if ((ptr == buff) || (ptr[-1] == ' '))
-          {
-            fwprintf(stderr, L"Warning: smart quotes puts close quote after a space.\n");
-            fwprintf(stderr, L"    %ls\n", buff);
-          }
-        }
-        else
-        {
-          putwchar(0x201c);
-          inside_quotes = 1;
-          if ((ptr[1] == '\0') || (ptr[1] == ' '))
-          {
-            fwprintf(stderr, L"Warning: smart quotes puts open quote before a space.\n");
-            fwprintf(stderr, L"    %ls\n", buff);
-          }
-        } 
-      }
-      else
-      {
-        putwchar(*ptr);
-      }
+  while ((line = reader_line(&r, NULL)) != NULL)
+    quotes_line(&ctx, line);
 
-      ptr++;
-    }
-    putwchar('\n');
+  status = reader_check(&r);
+  quotes_end(&ctx);
+  reader_free(&r);
 
-    if (old_style)
-      inside_quotes = 0;
-  }
+  return status ? 1 : 0;
 }
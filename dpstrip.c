@@ -36,59 +36,34 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <wchar.h>
-#include <locale.h>
+
+#include "dptools.h"
+
+/* Like the original dpstrip, don't end a last line that had no ending */
+static void emit_last(void *arg, char *line)
+{
+  fputs(line, (FILE *) arg);
+}
 
 int main(int argc, char **argv)
 {
-wchar_t c;
-int spaces = 0;
-int stops = 0;
-int dos_mode = 1;
+struct strip_context ctx;
+struct reader r;
+char *line;
+int status;
 
-  setlocale(LC_ALL, getenv("LANG"));
+  strip_context_init(&ctx);
+  reader_init(&r, stdin);
 
-  while ((c = getwchar())>=0)
+  while ((line = reader_line(&r, NULL)) != NULL)
   {
-    switch (c)
-    {
-      case ' ':
-        spaces++;
-        break;
-      case '\r':
-        break;
-      case '\n':
-        spaces=0;
-        stops=0;
-        if (dos_mode)
-           putwchar('\r');
-        putwchar('\n');
-        break;
-      case '.':
-      case ',':
-      case '!':
-      case '?':
-      case ':':
-      case ';':
-      case ')':
-        stops = 1;
-        spaces = 0;
-        putwchar(c);
-        break;
-      case '"':
-        if (spaces)
-          putwchar(' ');
-        putwchar(c);
-        spaces = 0;
-        stops = 0;
-        break;
-      default:
-        if (spaces || stops)
-          putwchar(' ');
-        putwchar(c);
-        spaces = 0;
-        stops = 0;
-        break;
-    }
+    if (r.unterminated)
+      ctx.emit = emit_last;
+    strip_line(&ctx, line);
   }
+
+  status = reader_check(&r);
+  strip_end(&ctx);
+  reader_free(&r);
+  return status ? 1 : 0;
 }
@@ -24,32 +24,355 @@
  * SUCH DAMAGE.
  */
 
+#include <stdint.h>
+
+#include "sink.h"
+#include "arena.h"
+#include "mapfile.h"
+#include "reader.h"
+
+/*
+ * Tools that produce lines of text, rather than HTML, pass each line
+ * (without a line ending) to an emit function. This writes it to a file
+ * for the stand-alone tools, or hands it to the next stage in dppipe.
+ */
+
+typedef void (*emit_fn)(void *arg, char *line);
+
+void emit_to_file(void *arg, char *line);
+
+void emit_to_file_crlf(void *arg, char *line);
+
+#define TAG_STACK_SIZE 50
+
+/*
+ * Everything that changes while a book is being converted. This is kept
+ * separate from the options so that it can be saved and restored.
+ */
+
+struct dp_state {
+  /* output.c */
+  int greek_mode; /* Greek transliteration mode, entered by [Greek: */
+  int sup_mode; /* Superscript mode */
+  int sub_mode; /* subscript mode */
+  int footnote_mode;
+  int sidenote_mode;
+  int tag_stack[TAG_STACK_SIZE];
+  int tags_on_stack;
+  int footnote_section;
+  int footnote_counter;
+
+  /* translit.c */
+  int greek_state;
+
+  /* html.c */
+  int page;
+  int par_type;
+  int blank_lines;
+  int para_open;
+  int poetry_mode;
+  int quote_mode;
+  int footnote_div; /* This is not the same as footnote_mode above */
+  int footnote_start;
+  int sidenote_div;
+  int sidenote_start;
+  int chapter;
+  int section;
+};
+
+/*
+ * A conversion context holds the options and state for one book, so that
+ * one process can convert several books at once on separate threads.
+ */
+
+struct dp_context {
+  FILE *outfile;
+  struct sink out; /* All the HTML goes through this, then to outfile */
+  FILE *errfile; /* Warnings about the input */
+  char *input_name; /* Given with the warnings, for --batch */
+  struct diag *diag; /* Where the warnings go, made when the first is given */
+  int diag_format; /* --diagnostics */
+  int diag_max; /* Give at most this many warnings, or 0 for no limit */
+  int line; /* Line number of the input line being converted */
+  char *line_text; /* The line itself, for showing where a warning was */
+  int nthreads; /* Render the pages of a mapped book on this many threads */
+  char *cache_dir; /* Directory of pages that have been rendered before */
+  int cache_warned;
+  struct cache_table *memo; /* The same, in memory, for --watch */
+  int copy_input; /* Read the book into memory rather than mapping it */
+  int scan_only; /* Only follow the state, for the first pass of -j */
+  struct token_cursor *tokens; /* Set if the book has been scanned already */
+  int pages_rendered; /* Not found in the cache or memo */
+  struct dp_stats *stats; /* Set for --stats */
+  uint64_t trace_page; /* When the page and paragraph began, for --trace */
+  uint64_t trace_par;
+  char *checkpoint_name; /* The state at each page, for html_convert_range */
+  FILE *checkpoint; /* Open while it is being written */
+
+  /* In "yogh mode", [3] denotes LATIN SMALL LETTER YOGH, not a footnote */
+  int yogh_mode;
+  int long_s_mode;
+  int drama_brackets;
+  int use_html_entities;
+  int drama; /* -D: close stage directions at the end of a paragraph */
+  int number_pages;
+  int front_pages;
+  int preface_pages;
+  int volume_pages;
+  int page_offset;
+  int chapter_offset;
+  int number_sections;
+  /* Set if full-page illustrations don't have page numbers */
+  int unnumbered_illustrations;
+
+  struct dp_state s;
+};
+
+/* Bytes of HTML produced so far, for the probes */
+#define HTML_BYTES(ctx) ((long) ((ctx)->out.written + (ctx)->out.len))
+
+void context_init(struct dp_context *ctx);
+
 void translit_init();
 
-void write_greek_char(FILE *outfile, wchar_t c);
+void write_greek_char(struct dp_context *ctx, int c);
+
+/* Each byte of transliteration becomes at most six bytes of Greek */
+#define TRANSLIT_SPACE(len) (6*(len))
+
+size_t transliterate_span(int *statep, char *in, size_t len, char *out,
+  struct dp_context *ctx);
 
-void write_line(FILE *outfile, wchar_t *str);
+void write_line(struct dp_context *ctx, char *str);
 
-void write_poetry_line(FILE *outfile, wchar_t *str);
+void write_poetry_line(struct dp_context *ctx, char *str);
 
-void write_greek(FILE *outfile, wchar_t *str);
+void write_greek(struct dp_context *ctx, char *str);
 
-void flush_greek(FILE *outfile);
+void flush_greek(struct dp_context *ctx);
 
-void report_error(wchar_t *msg, wchar_t *line);
+void report_error(struct dp_context *ctx, char *msg, char *line);
 
-int get_pagenumber();
+void html_warning(struct dp_context *ctx, int code, char *cp, char *fmt, ...);
 
-void set_yogh_mode();
+int get_pagenumber(struct dp_context *ctx);
+
+void set_yogh_mode(struct dp_context *ctx, int val);
+
+void set_drama_brackets(struct dp_context *ctx, int val);
+
+void flush_tags(struct dp_context *ctx);
+
+void found_illustration(struct dp_context *ctx);
+
+int get_footnote_mode(struct dp_context *ctx);
+
+int get_sidenote_mode(struct dp_context *ctx);
+
+void finish_drama_bracket(struct dp_context *ctx);
+
+#define HTML_OPTIONS "nyC:DF:O:P:UV:"
+
+int html_option(struct dp_context *ctx, int c, char *arg);
+
+void html_begin(struct dp_context *ctx);
+
+void html_line(struct dp_context *ctx, char *buff);
+
+void html_end(struct dp_context *ctx);
+
+void html_trace_end(struct dp_context *ctx);
+
+int html_convert(struct dp_context *ctx, FILE *infile);
+
+int html_convert_parallel(struct dp_context *ctx, struct mapped_file *m);
+
+void html_convert_cached(struct dp_context *ctx, struct mapped_file *m);
+
+int html_convert_range(struct dp_context *ctx, FILE *infile, int first,
+  int last);
+
+int html_batch(void *arg, char *name, FILE *infile, FILE *outfile);
+
+int html_watch(struct dp_context *ctx, char *inname, char *outname);
+
+/*
+ * dptxt: plain text output
+ */
 
-void set_drama_brackets(int val);
+struct txt_context {
+  FILE *outfile;
+  FILE *errfile; /* Warnings about the input */
+  char *input_name; /* Given with the warnings, for --batch */
+  struct diag *diag;
+  int diag_format;
+  int diag_max;
+  int page;
+  int lineno;
+  char *line_text;
+  struct token_cursor *tokens; /* Set if the book has been scanned already */
+  struct dp_stats *stats; /* Set for --stats */
+  uint64_t trace_page; /* When the page began, for --trace */
+  long written; /* Bytes of output so far, for the probes */
 
-void flush_tags(FILE *outfile);
+  int expand_entities;
+  int quote_indent;
+  int poetry_indent;
+  int poetry_indent2;
+  int poetry_limit;
+
+  int poetry_mode;
+  int quote_mode;
+  int caps_mode;
+  int inbuff;
+  int last_indent;
+  char *rptr;
+  char *rbuff; /* Text waiting to be wrapped */
+  size_t rsize;
+  size_t rstart; /* Offset of the first character not yet printed */
+  char *line; /* The current line, after markup has been converted */
+  size_t line_size;
+};
+
+void txt_context_init(struct txt_context *ctx);
+
+#define TXT_OPTIONS "ep:q:r:l:"
+
+int txt_option(struct txt_context *ctx, int c, char *arg);
+
+void txt_line(struct txt_context *ctx, char *buff);
+
+void txt_end(struct txt_context *ctx);
+
+void txt_trace_end(struct txt_context *ctx);
+
+int txt_convert(struct txt_context *ctx, FILE *infile);
+
+int txt_batch(void *arg, char *name, FILE *infile, FILE *outfile);
+
+/*
+ * dpfoot: renumber footnotes and move them to the end of the chapter
+ */
+
+struct foot_context {
+  emit_fn emit;
+  void *emit_arg;
+
+  int restart_section;
+  int restart_chapter;
+  int flush_section;
+  int flush_chapter;
+  int renumber_numeric;
+  int number_pages;
+
+  size_t mem_limit; /* -m: spill footnotes to a file above this many bytes */
+  int nthreads; /* Renumber the pages of a mapped book on this many threads */
+  char *input_name; /* Given with the warnings, for --batch */
+  struct dp_stats *stats; /* Set for --stats */
+  uint64_t trace_page; /* When the page began, for --trace */
+  int page; /* Page separators so far, for the probes */
+
+  struct footnote *notes;
+  struct footnote *last_footnote;
+  struct arena arena; /* Holds the footnotes in notes */
+  size_t queued; /* Bytes of arena used by notes */
+  FILE *spill; /* The footnotes, once there are too many to keep in memory */
+  char *spill_line;
+  size_t spill_line_size;
+  int blank_lines;
+  int footnote_mode;
+  int bracket_depth;
+  int footmax; /* The highest footnote number that's been used so far */
+  int footmin; /* The highest footnote number on pages before the current one*/
+  int newpage_pending;
+  char *page_name;
+  size_t page_name_size;
+  char *tmp; /* For renumbering a line */
+  size_t tmp_size;
+  int restarts; /* How many times the numbering has gone back to zero */
+  struct foot_chunk *collect; /* If set, record the output here instead */
+};
+
+void foot_context_init(struct foot_context *ctx);
+
+/* Megabytes of footnotes to keep in memory, unless -m says otherwise */
+#define FOOT_MEMORY_LIMIT 64
+
+#define FOOT_OPTIONS "CSNcnsm:"
+
+int foot_option(struct foot_context *ctx, int c, char *arg);
+
+void foot_line(struct foot_context *ctx, char *buff);
+
+void foot_end(struct foot_context *ctx);
+
+int foot_convert(struct foot_context *ctx, FILE *infile);
+
+int foot_batch(void *arg, char *name, FILE *infile, FILE *outfile);
+
+void flush_footnotes(struct foot_context *ctx);
+
+/*
+ * dpcomments: remove [** ] comments
+ */
+
+struct comments_context {
+  emit_fn emit;
+  void *emit_arg;
+
+  int comment_mode;
+  int depth;
+  int tag_stack[50];
+};
+
+void comments_context_init(struct comments_context *ctx);
+
+void comments_line(struct comments_context *ctx, char *buff);
+
+/*
+ * dpquotes: turn straight double quotes into directional quotes
+ */
+
+struct quotes_context {
+  emit_fn emit;
+  void *emit_arg;
+
+  FILE *errfile; /* Warnings about the input */
+  struct diag *diag;
+  int diag_format;
+  int diag_max;
+  int page;
+  int line;
+
+  int old_style;
+  int inside_quotes;
+  char *out;
+  size_t out_size;
+};
+
+void quotes_context_init(struct quotes_context *ctx);
+
+#define QUOTES_OPTIONS "p"
+
+int quotes_option(struct quotes_context *ctx, int c, char *arg);
+
+void quotes_line(struct quotes_context *ctx, char *buff);
+
+void quotes_end(struct quotes_context *ctx);
+
+/*
+ * dpstrip: tidy up white space around punctuation
+ */
 
-void found_illustration();
+struct strip_context {
+  emit_fn emit;
+  void *emit_arg;
+  char *out;
+  size_t out_size;
+};
 
-int get_footnote_mode();
+void strip_context_init(struct strip_context *ctx);
 
-int get_sidenote_mode();
+void strip_line(struct strip_context *ctx, char *buff);
 
-void finish_drama_bracket();
+void strip_end(struct strip_context *ctx);
@@ -0,0 +1,63 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * entities.h - the DP markup for characters that aren't in ASCII
+ *
+ * Each entry is ENTITY(name, unicode, latin1, html). This is included
+ * by entity.c to make the table, and by mkentity to make the hash table
+ * that finds an entry by name, so it's the only place a new entity needs
+ * to be added.
+ */
+
+ENTITY("[=a]", 0x101, NULL, NULL)
+ENTITY("[=E]", 0x112, NULL, NULL)
+ENTITY("[=e]", 0x113, NULL, NULL)
+ENTITY("[e,]", 0x119, NULL, NULL)
+ENTITY("[=i]", 0x12B, NULL, NULL)
+ENTITY("[=o]", 0x14d, NULL, NULL)
+ENTITY("[OE]", 0x152, "OE", "&OElig;")
+ENTITY("[oe]", 0x153, "oe", "&oelig;")
+ENTITY("[=u]", 0x16b, NULL, NULL)
+ENTITY("[)U]", 0x16c, NULL, NULL)
+ENTITY("[)u]", 0x16d, NULL, NULL)
+ENTITY("[Gh]", 0x21c, NULL, NULL)
+ENTITY("[gh]", 0x21d, NULL, NULL)
+/* These are my additions, not DP standard */
+ENTITY("[osb]", '[', "[", "[")
+ENTITY("[csb]", ']', "]", "]")
+ENTITY("[ldquo]", 0x201c, "\"", "&ldquo;")
+ENTITY("[rdquo]", 0x201d, "\"", "&rdquo;")
+ENTITY("[lsquo]", 0x2018, "'", "&lsquo;")
+ENTITY("[rsquo]", 0x2019, "'", "&rsquo;")
+/* Greek iota subscripts */
+ENTITY("[a_i]", 0x1fb3, "\u00e2i", NULL)
+ENTITY("[\u00ea_i]", 0x1fc3, "\u00eai", NULL)
+ENTITY("[\u00f4_i]", 0x1ff3, "\u00f4i", NULL)
+/* Other Greek characters */
+ENTITY("[']", 0x374, "'", NULL)
+ENTITY("[st]", 0x3db, NULL, NULL)
+ENTITY("[ST]", 0x3da, NULL, NULL)
@@ -24,71 +24,54 @@
  * SUCH DAMAGE.
  */
 
-#include <wchar.h>
+#include <string.h>
 
 #include "entity.h"
+#include "entity_hash.h"
 
 struct entity dp_entities[] = {
-	L"[=a]", (wchar_t) 0x101, NULL, NULL,
-        L"[=E]", (wchar_t) 0x112, NULL, NULL,
-	L"[=e]", (wchar_t) 0x113, NULL, NULL,
-	L"[e,]", (wchar_t) 0x119, NULL, NULL,
-	L"[=i]", (wchar_t) 0x12B, NULL, NULL,
-	L"[=o]", (wchar_t) 0x14d, NULL, NULL,
-        L"[OE]", (wchar_t) 0x152, L"OE", L"&OElig;",
-        L"[oe]", (wchar_t) 0x153, L"oe", L"&oelig;",
-	L"[=u]", (wchar_t) 0x16b, NULL, NULL,
-        L"[)U]", (wchar_t) 0x16c, NULL, NULL,
-	L"[)u]", (wchar_t) 0x16d, NULL, NULL,
-        L"[Gh]", (wchar_t) 0x21c, NULL, NULL,
-        L"[gh]", (wchar_t) 0x21d, NULL, NULL,
-        /* These are my additions, not DP standard */
-        L"[osb]", (wchar_t) '[', L"[", L"[",
-        L"[csb]", (wchar_t) ']', L"]", L"]",
-        L"[ldquo]", (wchar_t) 0x201c, L"\"", L"&ldquo;",
-        L"[rdquo]", (wchar_t) 0x201d, L"\"", L"&rdquo;",
-        L"[lsquo]", (wchar_t) 0x2018, L"'", L"&lsquo;",
-        L"[rsquo]", (wchar_t) 0x2019, L"'", L"&rsquo;",
-        /* Greek iota subscripts */
-        L"[a_i]", (wchar_t) 0x1fb3, L"\u00e2i", NULL,
-	L"[\xea_i]", (wchar_t) 0x1fc3, L"\u00eai", NULL,
-	L"[\xf4_i]", (wchar_t) 0x1ff3, L"\u00f4i", NULL,
-        /* Other Greek characters */
-        L"[']", (wchar_t) 0x374, L"'", NULL,
-        L"[st]", (wchar_t) 0x3db, NULL, NULL,
-        L"[ST]", (wchar_t) 0x3da, NULL, NULL,
-	L"", (wchar_t) 0, NULL, NULL
+#define ENTITY(name, unicode, latin1, html) {name, unicode, latin1, html},
+#include "entities.h"
+#undef ENTITY
+	{"", 0, NULL, NULL}
 };
 
+/*
+ * Returns the entity that str starts with, or NULL. The hash table made
+ * by mkentity means there is only one entry to compare with, and a bracket
+ * that's longer than any entity is rejected without reading all of it.
+ */
+
 struct entity *find_entity(str, lptr)
-wchar_t *str;
+char *str;
 int *lptr;
 {
 struct entity *ptr;
+unsigned int h;
 int len;
-wchar_t *cp;
+int i;
 
-  cp = str;
-  len = 1;
-
-  while ((*cp != L']') && (*cp != 0))
+  h = ENTITY_SEED;
+  for (len = 0; len < ENTITY_MAX_LEN; len++)
   {
-    cp++;
-    len++;
+    if (str[len] == 0)
+      return (struct entity *) 0;
+    h = ENTITY_HASH_STEP(h, str[len]);
+    if (str[len] == ']')
+      break;
   }
+  len++;
+  if ((len < ENTITY_MIN_LEN) || (len > ENTITY_MAX_LEN))
+    return (struct entity *) 0;
 
-  if (*cp == 0)
+  i = entity_disp[ENTITY_BUCKET(h) & (ENTITY_BUCKETS - 1)];
+  i = entity_slot[ENTITY_SLOT(h, i) & (ENTITY_HASH_SIZE - 1)];
+  if (i < 0)
+    return (struct entity *) 0;
+  ptr = dp_entities + i;
+  if ((strncmp(ptr->name, str, len) != 0) || (ptr->name[len] != 0))
     return (struct entity *) 0;
 
-  ptr = dp_entities;
-  while (ptr->unicode)
-  {
-    if (wcsncmp(ptr->name, str, len) == 0)
-    {
-      *lptr = len;
-      return ptr;
-    }
-    ptr++;
-  }
-  return (struct entity *) 0;
+  *lptr = len;
+  return ptr;
 }
@@ -26,10 +26,23 @@
 
 
 struct entity {
-  wchar_t *name;
-  wchar_t unicode;
-  wchar_t *latin1;
-  wchar_t *html;
+  char *name;
+  int unicode;
+  char *latin1;
+  char *html;
 };
 
 struct entity *find_entity();
+
+/*
+ * The hash that find_entity uses to look up a name. mkentity chooses a
+ * seed for which no two names have the same hash, puts the names in
+ * buckets by hash and then, for each bucket, a displacement that moves
+ * its names into slots that no other name uses.
+ */
+
+#define ENTITY_HASH_STEP(h, c) (((h) ^ (unsigned char) (c)) * 16777619u)
+
+#define ENTITY_BUCKET(h) ((h) ^ ((h) >> 15))
+
+#define ENTITY_SLOT(h, d) ((((h) ^ (d)) * 2654435761u) >> 16)
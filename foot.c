@@ -0,0 +1,1006 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * foot.c - renumber footnotes and move them to the end of the chapter
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "dptools.h"
+#include "footnote.h"
+#include "batch.h"
+#include "probes.h"
+#include "stats.h"
+#include "trace.h"
+
+
+/*
+ * Footnotes waiting to be moved are kept in an arena, which is reset each
+ * time they are flushed. If more than mem_limit bytes are waiting, they
+ * are all written out to a temporary file, followed by every later one up
+ * to the next flush, so a book with a huge number of footnotes doesn't
+ * need a huge amount of memory.
+ */
+
+struct footnote {
+  struct footnote *next_footnote;
+  char *line;
+};
+
+/*
+ * With -j, a mapped book is cut into chunks of whole pages and each chunk
+ * is converted on its own thread. A chunk's output is recorded as a list
+ * of events (a type byte, then a null-terminated string), which are then
+ * played back in order.
+ */
+
+#define FOOT_TEXT 1
+#define FOOT_NOTE 2
+#define FOOT_FLUSH 3
+#define FOOT_WARNING 4
+#define FOOT_WARNING_LINE 5
+#define FOOT_PAGE 6
+
+struct foot_chunk {
+  size_t first; /* Line numbers */
+  size_t last;
+  int discard; /* Don't record anything: the first pass */
+  int page; /* Page separators before the first line */
+  int page_end; /* and after the last, with the numbering there */
+  int footmax_end;
+  int failed; /* Out of memory */
+  char *events;
+  size_t len;
+  size_t size;
+
+  /* Found by the first pass */
+  int restarts;
+  int footmax;
+  int footnote_mode;
+  int bracket_depth;
+
+  int footmin; /* The numbering carried in from the chunks before */
+  struct dp_stats stats; /* Counted in the second pass */
+};
+
+static int foot_record(struct foot_chunk *c, int type, char *str)
+{
+size_t len;
+
+  if (c->discard)
+    return 0;
+  len = strlen(str);
+  if (buffer_reserve(&c->events, &c->size, c->len + len + 2) < 0)
+    return -1;
+  c->events[c->len] = type;
+  memcpy(c->events + c->len + 1, str, len + 1);
+  c->len += len + 2;
+  return 0;
+}
+
+/* The page and numbering go with the event, for the probes when it is
+ * replayed */
+static void record_page(struct foot_context *ctx, int type)
+{
+char buff[32];
+
+  sprintf(buff, "%d %d", ctx->page, ctx->footmax);
+  foot_record(ctx->collect, type, buff);
+}
+
+static void foot_record_text(void *arg, char *line)
+{
+  foot_record(arg, FOOT_TEXT, line);
+}
+
+static void foot_warning(struct foot_context *ctx, char *msg, char *line)
+{
+  if (ctx->collect)
+  {
+    foot_record(ctx->collect, FOOT_WARNING, msg);
+    if (line)
+      foot_record(ctx->collect, FOOT_WARNING_LINE, line);
+    return;
+  }
+  if (ctx->input_name)
+    fprintf(stderr, "%s: ", ctx->input_name);
+  fprintf(stderr, "%s\n", msg);
+  if (line)
+    fprintf(stderr, "  %s\n", line);
+}
+
+/* Pass a line on, counting it unless it is only being recorded */
+static void foot_emit(struct foot_context *ctx, char *line)
+{
+  if (ctx->collect == NULL)
+    STATS_COUNT(ctx->stats, STAT_BYTES_OUT, strlen(line) + 1);
+  ctx->emit(ctx->emit_arg, line);
+}
+
+void foot_context_init(struct foot_context *ctx)
+{
+  memset(ctx, 0, sizeof(struct foot_context));
+  ctx->emit = emit_to_file;
+  ctx->emit_arg = stdout;
+  ctx->mem_limit = (size_t) FOOT_MEMORY_LIMIT*1024*1024;
+  arena_init(&ctx->arena);
+}
+
+/*
+ * Read the spilled footnotes back, one line at a time.
+ */
+
+static void flush_spill(struct foot_context *ctx)
+{
+ssize_t len;
+
+  fflush(ctx->spill);
+  if (ferror(ctx->spill))
+    fprintf(stderr, "Error writing footnotes to temporary file\n");
+  rewind(ctx->spill);
+  while ((len = getline(&ctx->spill_line, &ctx->spill_line_size,
+    ctx->spill)) > 0)
+  {
+    if (ctx->spill_line[len-1] == '\n')
+      ctx->spill_line[len-1] = '\0';
+    foot_emit(ctx, ctx->spill_line);
+  }
+  fclose(ctx->spill);
+  ctx->spill = NULL;
+}
+
+void flush_footnotes(struct foot_context *ctx)
+{
+struct footnote *ptr;
+uint64_t start;
+
+  if (ctx->collect)
+  {
+    record_page(ctx, FOOT_FLUSH);
+    return;
+  }
+
+  PROBE3(flush_footnotes, ctx->page, ctx->footmax, ctx->queued);
+  TRACE_START(start);
+  if (ctx->spill)
+    flush_spill(ctx);
+
+  ptr  = ctx->notes;
+  while (ptr)
+  {
+    foot_emit(ctx, ptr->line);
+    ptr = ptr->next_footnote;
+  }
+  ctx->notes = (struct footnote *) 0;
+  ctx->last_footnote = (struct footnote *) 0;
+  TRACE_END(start, "foot", "flush footnotes", "bytes", ctx->queued);
+  ctx->queued = 0;
+  arena_reset(&ctx->arena);
+}
+
+/*
+ * Move the queue out to a temporary file. The file is already unlinked,
+ * so it goes away by itself however the program exits.
+ */
+
+static int start_spill(struct foot_context *ctx)
+{
+struct footnote *ptr;
+
+  ctx->spill = tmpfile();
+  if (ctx->spill == NULL)
+    return -1;
+  for (ptr = ctx->notes; ptr; ptr = ptr->next_footnote)
+    fprintf(ctx->spill, "%s\n", ptr->line);
+  ctx->notes = (struct footnote *) 0;
+  ctx->last_footnote = (struct footnote *) 0;
+  ctx->queued = 0;
+  arena_reset(&ctx->arena);
+  return 0;
+}
+
+static int add_footnote(ctx, buff)
+struct foot_context *ctx;
+char *buff;
+{
+struct footnote *new;
+size_t len;
+
+  if (ctx->collect)
+    return foot_record(ctx->collect, FOOT_NOTE, buff);
+
+  len = strlen(buff);
+  if ((ctx->spill == NULL) && ctx->mem_limit &&
+    (ctx->queued + len > ctx->mem_limit))
+  {
+    /* If there's no temporary file, carry on in memory */
+    if (start_spill(ctx) < 0)
+      ctx->mem_limit = 0;
+  }
+
+  if (ctx->spill)
+  {
+    fprintf(ctx->spill, "%s\n", buff);
+    return 0;
+  }
+
+  new = (struct footnote *) arena_alloc(&ctx->arena,
+    sizeof(struct footnote) + len + 1);
+  if (new == (struct footnote *) 0)
+    return -1;
+  new->line = (char *) (new + 1);
+  memcpy(new->line, buff, len + 1);
+  new->next_footnote = (struct footnote *) 0;
+  if (ctx->last_footnote)
+    ctx->last_footnote->next_footnote = new;
+  else
+    ctx->notes = new;
+  ctx->last_footnote = new;
+  ctx->queued += sizeof(struct footnote) + len + 1;
+  return 0;
+}
+
+static int count_brackets(line)
+char *line;
+{
+char *cp;
+int depth;
+
+  cp = line;
+  depth = 0;
+  while (*cp)
+  {
+    if (*cp == '[')
+      depth++;
+    else if (*cp == ']')
+      depth--;
+    cp++;
+  }
+  return depth;
+}
+
+/*
+ * Room for a renumbered copy of line. A reference such as [A] can become
+ * up to 12 bytes long, so four times the length is always enough.
+ */
+
+static char *renumber_buffer(struct foot_context *ctx, char *line)
+{
+  if (buffer_reserve(&ctx->tmp, &ctx->tmp_size, 4*strlen(line)+32) < 0)
+    return NULL;
+  return ctx->tmp;
+}
+
+/*
+ * Returns the line with its footnote references renumbered, which is
+ * either line itself or a copy in ctx->tmp.
+ */
+
+static char *renumber(struct foot_context *ctx, char *line, int *footmin, int *footmax)
+{
+#define MAX_DIGITS 12
+char digits[MAX_DIGITS];
+char *tmp;
+char *cp1;
+char *cp2;
+char *cp3;
+int footnum;
+int touched = 0;
+int num;
+int len;
+
+  tmp = renumber_buffer(ctx, line);
+  if (tmp == NULL)
+    return line;
+
+  cp1 = line;
+  cp2 = tmp;
+  while (*cp1)
+  {
+    if (*cp1 != '[')
+    {
+      *cp2 = *cp1;
+      cp1++;
+      cp2++;
+    }
+    else if ((cp1[1] >= 'A') && (cp1[1] <= 'Z') && (cp1[2] == ']'))
+    {
+      touched = 1;
+      STATS_COUNT(ctx->stats, STAT_FOOTNOTE_REFS, 1);
+
+      *cp2 = *cp1; /* Copy the [ */
+      cp1++;
+      cp2++;
+     
+      footnum = *footmin + (*cp1 - 'A') + 1;
+      if (footnum > *footmax)
+        *footmax = footnum;
+
+      snprintf(digits, MAX_DIGITS, "%d", footnum);
+      cp3 = digits;
+      while (*cp3)
+      {
+        *cp2 = *cp3;
+        cp2++;
+        cp3++;
+      }      
+      cp1++;
+      *cp2 = *cp1; /* Copy the ] */
+      cp1++;
+      cp2++;
+    }
+    else if (ctx->renumber_numeric && is_footnote(cp1, &num, &len))
+    {
+      touched = 1;
+      STATS_COUNT(ctx->stats, STAT_FOOTNOTE_REFS, 1);
+
+      *cp2 = *cp1; /* Copy the [ */
+      cp1++;
+      cp2++;
+      footnum =  *footmin + num;
+      if (footnum > *footmax)
+        *footmax = footnum;
+      snprintf(digits, sizeof(digits), "%d", footnum);
+      cp3 = digits;
+      while (*cp3)
+      {
+        *cp2 = *cp3;
+        cp2++;
+        cp3++;
+      }      
+      cp1 += len-2;
+      *cp2 = *cp1; /* Copy the ] */
+      cp1++;
+      cp2++;
+    }
+    else
+    {
+      *cp2 = *cp1;
+      cp1++;
+      cp2++;
+    }
+  }
+  *cp2 = '\0';
+
+  if (touched)
+    return tmp;
+  return line;
+}
+
+static char *renumber_footnote(struct foot_context *ctx, char *line, int *footmin)
+{
+char val[10];
+char *end_of_num;
+int digits;
+char *tmp;
+char *cp1;
+char *cp2;
+int footnum;
+
+  tmp = renumber_buffer(ctx, line);
+  if (tmp == NULL)
+    return line;
+
+  if (strncmp(line, "[Footnote:", 10) == 0)
+  {
+    /*An un-numbered footnote. No need to do anything. */
+  }
+  else if (strncmp(line, "[Footnote ", 10) == 0)
+  {
+    cp1 = line + 10;
+    while (*cp1 == ' ')
+      cp1++;
+    if ((*cp1 >= 'A') && (*cp1 <= 'Z') && (cp1[1] == ':'))
+    {
+      footnum = *footmin + (*cp1 - 'A') + 1;
+      snprintf(tmp, 32, "[Footnote %d:", footnum);
+      cp2 = tmp + strlen(tmp);
+      cp1 += 2;
+      while (*cp1)
+      {
+        *cp2 = *cp1;
+        cp1++;
+        cp2++;
+      }
+      *cp2 = '\0'; 
+      return tmp;
+    }
+    else if (ctx->renumber_numeric && isdigit((unsigned char) *cp1))
+    {
+      digits = 0;
+      while (isdigit((unsigned char) *cp1) && (digits < 10))
+      {
+        val[digits] = *cp1;
+        digits++;
+        cp1++;
+      }
+      if (digits == 10)
+      {
+        foot_warning(ctx, "Too many digits in footnote number.", NULL);
+        digits = 9;
+      }
+      val[digits] = '\0';
+      footnum = *footmin + strtol(val, &end_of_num, 10);  
+      snprintf(tmp, 32, "[Footnote %d:", footnum);
+      cp2 = tmp + strlen(tmp);
+      if (*cp1)
+        cp1++;
+      while (*cp1)
+      {
+        *cp2 = *cp1;
+        cp1++;
+        cp2++;
+      }
+      *cp2 = '\0'; 
+      return tmp;
+    }
+  }
+  return line;
+}
+
+
+/*
+ * Handle one of the FOOT_OPTIONS. Returns -1 if c is not one of them.
+ */
+
+int foot_option(struct foot_context *ctx, int c, char *arg)
+{
+  switch (c)
+  {
+    case 'S':
+      ctx->restart_section = 1;
+      break;
+    case 'C':
+      ctx->restart_chapter = 1;
+      break;
+    case 'N':
+      ctx->renumber_numeric = 1;
+      break;
+    case 's':
+      ctx->flush_section = 1;
+      break;
+    case 'c':
+      ctx->flush_chapter = 1;
+      break;
+    case 'n':
+      ctx->number_pages = 1;
+      break;
+    case 'm':
+      ctx->mem_limit = (size_t) atol(arg)*1024*1024;
+      break;
+    default:
+      return -1;
+  }
+  return 0;
+}
+
+/*
+ * Process one line of input, as read by reader_line.
+ */
+
+void foot_line(struct foot_context *ctx, char *buff)
+{
+int i;
+int len;
+uint64_t t0 = 0;
+
+  if (ctx->flush_section)
+    ctx->flush_chapter = 1; /* The end of a chapter is also the end of a section */
+
+  if (ctx->restart_section)
+    ctx->restart_chapter = 1;
+
+  len = strlen(buff);
+  STATS_COUNT(ctx->stats, STAT_LINES, 1);
+
+  /* 
+   * Strip <CR><LF> from the end of the line.
+   * Note that the file may have DOS, not UNIX, <CR><LF> convention.
+   */
+
+  if ((len > 0) && (buff[len-1] == '\n'))
+  {
+    buff[len-1] = '\0';
+    len--;
+  }
+  if ((len > 0) && (buff[len-1] == '\r'))
+  {
+    buff[len-1] = '\0';
+    len--;
+  }
+ 
+  /* Strip trailing spaces */
+
+  while ((len > 0) && (buff[len-1] == ' '))
+  {
+    buff[len-1] = '\0';
+    len--;
+  }
+
+  if (len == 0)
+    ctx->blank_lines++;
+  else if (strncmp(buff, "-----", 5) == 0) /* A page break */
+  {
+    STATS_COUNT(ctx->stats, STAT_PAGES, 1);
+    TRACE_END(ctx->trace_page, "foot", "page", NULL, 0);
+    TRACE_START(ctx->trace_page);
+    ctx->page++;
+    if (ctx->collect)
+      record_page(ctx, FOOT_PAGE);
+    else
+      PROBE3(foot_page, ctx->page, ctx->footmax, ctx->queued);
+    if (ctx->number_pages)
+    {
+      if (buffer_reserve(&ctx->page_name, &ctx->page_name_size, len+1) == 0)
+      {
+        strcpy(ctx->page_name, buff);
+        ctx->newpage_pending = 1;
+      }
+    }
+
+    ctx->blank_lines = 0;
+    if (ctx->footnote_mode && (ctx->bracket_depth > 0))
+    {
+      foot_warning(ctx, "Warning: footnote markup not closed by end of page",
+        buff);
+    }
+    ctx->footnote_mode = 0;
+    ctx->bracket_depth = 0;
+    ctx->footmin = ctx->footmax;
+  }
+  else
+  {
+     if (ctx->blank_lines > 0)
+     {
+       if (ctx->footnote_mode == 0)
+       {
+         if (ctx->blank_lines == 4) /* 4 blank lines -> chapter heading */
+         {
+           if (ctx->flush_chapter)
+             flush_footnotes(ctx);
+           if (ctx->restart_chapter)
+           {
+             ctx->footmin = 0;
+             ctx->footmax = 0;
+             ctx->restarts++;
+           }
+         }
+         else if (ctx->blank_lines == 2) /* 2 blank lines -> section heading or furher part of chapter heading */
+         {
+         /* Don't need to work out whether this is a section header or part
+          * of a chapter header, because if it's part of a chapter header
+          * the footnotes will have already been flushed, and flushing them
+          * again is harmless.
+          */
+           if (ctx->flush_section)
+             flush_footnotes(ctx);
+           if (ctx->restart_section)
+           {
+             ctx->footmin = 0;
+             ctx->footmax = 0;
+             ctx->restarts++;
+           }
+         }
+       }
+       else /* in footnote mode */
+       {
+         if (ctx->bracket_depth == 0)
+           ctx->footnote_mode = 0; 
+       }
+       if (strncmp(buff, "[Footnote", 9) == 0)
+       {
+         ctx->footnote_mode = 1;
+       }
+       else if (strncmp(buff, "*[Footnote", 10) == 0)
+       {
+         ctx->footnote_mode = 1;
+       }
+       if (ctx->footnote_mode)
+       {
+         STATS_COUNT(ctx->stats, STAT_FOOTNOTES, 1);
+         add_footnote(ctx, "");
+       }
+       else
+       {
+         if (ctx->number_pages && ctx->newpage_pending)
+         {
+           foot_emit(ctx, ctx->page_name);
+           ctx->newpage_pending = 0;
+         }
+         for (i=0;i<ctx->blank_lines;i++)
+           foot_emit(ctx, "");
+       }
+       ctx->blank_lines = 0;
+     }
+     if (ctx->footnote_mode)
+     {
+       STATS_START(ctx->stats, t0);
+       buff = renumber_footnote(ctx, buff, &ctx->footmin);
+       STATS_STOP(ctx->stats, STAT_T_RENUMBER, t0);
+       add_footnote(ctx, buff);
+       ctx->bracket_depth += count_brackets(buff);
+     }
+     else
+     {
+       if (ctx->number_pages && ctx->newpage_pending)
+       {
+         foot_emit(ctx, ctx->page_name);
+         ctx->newpage_pending = 0;
+       }
+       STATS_START(ctx->stats, t0);
+       buff = renumber(ctx, buff, &ctx->footmin, &ctx->footmax);
+       STATS_STOP(ctx->stats, STAT_T_RENUMBER, t0);
+       foot_emit(ctx, buff);
+     }
+  }
+}
+
+void foot_end(struct foot_context *ctx)
+{
+  TRACE_END(ctx->trace_page, "foot", "page", NULL, 0);
+  ctx->trace_page = 0;
+  flush_footnotes(ctx);
+  arena_free(&ctx->arena);
+  free(ctx->spill_line);
+  free(ctx->tmp);
+  free(ctx->page_name);
+  ctx->spill_line = NULL;
+  ctx->spill_line_size = 0;
+  ctx->tmp = NULL;
+  ctx->tmp_size = 0;
+  ctx->page_name = NULL;
+  ctx->page_name_size = 0;
+}
+
+static void copy_options(struct foot_context *ctx, struct foot_context *opts)
+{
+  ctx->restart_section = opts->restart_section;
+  ctx->restart_chapter = opts->restart_chapter;
+  ctx->flush_section = opts->flush_section;
+  ctx->flush_chapter = opts->flush_chapter;
+  ctx->renumber_numeric = opts->renumber_numeric;
+  ctx->number_pages = opts->number_pages;
+  ctx->mem_limit = opts->mem_limit;
+}
+
+/*
+ * The footnote numbering only depends on earlier pages through footmin
+ * and footmax, and the state of one page doesn't otherwise carry over
+ * the page break. So the first pass converts each chunk as if its
+ * numbering started at zero, and finds how far on it moves the numbering
+ * (or where it leaves it, if it restarts at a chapter or section). Adding
+ * these up chunk by chunk gives each chunk its starting number, and the
+ * second pass converts the chunks again, for real.
+ */
+
+#define CHUNK_MIN_LINES 1024
+#define CHUNK_MAX_LINES 65536
+
+struct foot_par {
+  struct foot_context *opts;
+  struct mapped_file *map;
+  struct foot_chunk *chunks;
+  int pass;
+};
+
+static void convert_chunk(void *arg, int i)
+{
+struct foot_par *par = arg;
+struct foot_context ctx;
+struct foot_chunk *c = par->chunks + i;
+uint64_t start;
+char *buff = NULL;
+size_t size = 0;
+char *line;
+size_t n;
+
+  TRACE_START(start);
+  foot_context_init(&ctx);
+  copy_options(&ctx, par->opts);
+  ctx.emit = foot_record_text;
+  ctx.emit_arg = c;
+  ctx.collect = c;
+  ctx.page = c->page;
+  if (par->opts->stats && (par->pass == 2))
+    ctx.stats = &c->stats;
+
+  if (par->pass == 1)
+  {
+    c->discard = 1;
+  }
+  else
+  {
+    /* Pick up where the chunk before left off */
+    c->discard = 0;
+    c->len = 0;
+    ctx.footmin = c->footmin;
+    ctx.footmax = c->footmin;
+    if (i > 0)
+    {
+      ctx.footnote_mode = c[-1].footnote_mode;
+      ctx.bracket_depth = c[-1].bracket_depth;
+    }
+  }
+
+  /* The mapping is read-only, so each line is copied for foot_line */
+  for (n = c->first; n < c->last; n++)
+  {
+    if ((line = mapped_line(par->map, n, &buff, &size, NULL)) == NULL)
+    {
+      c->failed = 1;
+      break;
+    }
+    foot_line(&ctx, line);
+  }
+  free(buff);
+  c->page_end = ctx.page;
+  c->footmax_end = ctx.footmax;
+  TRACE_END(ctx.trace_page, "foot", "page", NULL, 0);
+
+  if (par->pass == 1)
+  {
+    c->restarts = ctx.restarts;
+    c->footmax = ctx.footmax;
+    c->footnote_mode = ctx.footnote_mode;
+    c->bracket_depth = ctx.bracket_depth;
+  }
+
+  free(ctx.tmp);
+  free(ctx.page_name);
+  TRACE_END(start, "foot", (par->pass == 1) ? "count chunk" : "renumber chunk",
+    "chunk", i);
+}
+
+static void replay_chunk(struct foot_context *ctx, struct foot_chunk *c)
+{
+char *cp;
+char *end;
+
+  cp = c->events;
+  end = c->events + c->len;
+  while (cp < end)
+  {
+    switch (*cp)
+    {
+      case FOOT_TEXT:
+        foot_emit(ctx, cp + 1);
+        break;
+      case FOOT_NOTE:
+        add_footnote(ctx, cp + 1);
+        break;
+      case FOOT_PAGE:
+        sscanf(cp + 1, "%d %d", &ctx->page, &ctx->footmax);
+        PROBE3(foot_page, ctx->page, ctx->footmax, ctx->queued);
+        break;
+      case FOOT_FLUSH:
+        sscanf(cp + 1, "%d %d", &ctx->page, &ctx->footmax);
+        flush_footnotes(ctx);
+        break;
+      case FOOT_WARNING:
+        if (ctx->input_name)
+          fprintf(stderr, "%s: ", ctx->input_name);
+        fprintf(stderr, "%s\n", cp + 1);
+        break;
+      case FOOT_WARNING_LINE:
+        fprintf(stderr, "  %s\n", cp + 1);
+        break;
+    }
+    cp += strlen(cp + 1) + 2;
+  }
+  ctx->page = c->page_end;
+  ctx->footmax = c->footmax_end;
+}
+
+/*
+ * Split the book into chunks that each start at a page break (apart from
+ * the first). Returns the number of chunks, or -1 if out of memory.
+ */
+
+static int find_chunks(struct mapped_file *m, int nthreads,
+  struct foot_chunk **chunksp)
+{
+struct foot_chunk *chunks;
+size_t target;
+size_t start;
+size_t n;
+int nchunks;
+int page = 0;
+int brk;
+
+  target = m->nlines / (4 * nthreads);
+  if (target < CHUNK_MIN_LINES)
+    target = CHUNK_MIN_LINES;
+  if (target > CHUNK_MAX_LINES)
+    target = CHUNK_MAX_LINES;
+
+  chunks = calloc(m->nlines / target + 2, sizeof(struct foot_chunk));
+  if (chunks == NULL)
+    return -1;
+
+  nchunks = 0;
+  start = 0;
+  for (n = 0; n < m->nlines; n++)
+  {
+    brk = (m->lines[n+1] - m->lines[n] >= 5) &&
+      (strncmp(m->data + m->lines[n], "-----", 5) == 0);
+    if (brk && (n > 0) && (n - start >= target))
+    {
+      chunks[nchunks].first = start;
+      chunks[nchunks].last = n;
+      nchunks++;
+      start = n;
+      chunks[nchunks].page = page;
+    }
+    /* Counted as foot_line counts them, for the probes */
+    if (brk)
+      page++;
+  }
+  chunks[nchunks].first = start;
+  chunks[nchunks].last = m->nlines;
+  nchunks++;
+
+  *chunksp = chunks;
+  return nchunks;
+}
+
+static int foot_convert_parallel(struct foot_context *ctx,
+  struct mapped_file *m)
+{
+struct foot_par par;
+struct foot_chunk *chunks;
+int nchunks;
+int footmin;
+int i;
+int j;
+int k;
+
+  nchunks = find_chunks(m, ctx->nthreads, &chunks);
+  if (nchunks < 0)
+    return -1;
+
+  par.opts = ctx;
+  par.map = m;
+  par.chunks = chunks;
+
+  par.pass = 1;
+  run_parallel(0, nchunks, ctx->nthreads, convert_chunk, &par);
+  for (i = 0; i < nchunks; i++)
+  {
+    if (chunks[i].failed)
+    {
+      free(chunks);
+      return -1;
+    }
+  }
+
+  /* An exclusive prefix sum of how far each chunk moves the numbering */
+  footmin = 0;
+  for (i = 0; i < nchunks; i++)
+  {
+    chunks[i].footmin = footmin;
+    if (chunks[i].restarts)
+      footmin = chunks[i].footmax;
+    else
+      footmin += chunks[i].footmax;
+  }
+
+  /* Do the second pass a few chunks at a time, so as not to hold the
+   * whole of the output in memory */
+  par.pass = 2;
+  for (i = 0; i < nchunks; i = j)
+  {
+    j = i + ctx->nthreads;
+    if (j > nchunks)
+      j = nchunks;
+    run_parallel(i, j, ctx->nthreads, convert_chunk, &par);
+    for (k = i; k < j; k++)
+    {
+      if (chunks[k].failed)
+        fprintf(stderr, "Out of memory\n");
+      replay_chunk(ctx, chunks + k);
+      if (ctx->stats)
+        stats_add(ctx->stats, &chunks[k].stats);
+      free(chunks[k].events);
+      chunks[k].events = NULL;
+    }
+  }
+
+  free(chunks);
+  return 0;
+}
+
+/*
+ * Convert a whole book. Returns -1 if it couldn't all be read.
+ */
+
+int foot_convert(struct foot_context *ctx, FILE *infile)
+{
+struct reader r;
+char *line;
+size_t len;
+int status;
+
+  reader_init(&r, infile);
+  if (r.mapped)
+    STATS_COUNT(ctx->stats, STAT_BYTES_IN, r.map.size);
+
+  if ((ctx->nthreads > 1) && r.mapped &&
+    (foot_convert_parallel(ctx, &r.map) == 0))
+  {
+    foot_end(ctx);
+    reader_free(&r);
+    return 0;
+  }
+
+  while ((line = reader_line(&r, &len)) != NULL)
+  {
+    STATS_COUNT(ctx->stats, STAT_BYTES_IN, r.mapped ? 0 : len);
+    foot_line(ctx, line);
+  }
+
+  status = reader_check(&r);
+  foot_end(ctx);
+  reader_free(&r);
+  return status;
+}
+
+/*
+ * Convert one book of a batch. arg is a context holding the options.
+ */
+
+int foot_batch(void *arg, char *name, FILE *infile, FILE *outfile)
+{
+struct foot_context *ctx;
+struct foot_context *opts = arg;
+int status;
+
+  ctx = malloc(sizeof(struct foot_context));
+  if (ctx == NULL)
+    return -1;
+  foot_context_init(ctx);
+  ctx->emit_arg = outfile;
+  ctx->input_name = name;
+  copy_options(ctx, opts);
+  if (opts->stats)
+    ctx->stats = calloc(1, sizeof(struct dp_stats));
+
+  status = foot_convert(ctx, infile);
+
+  if (ctx->stats)
+  {
+    stats_add(opts->stats, ctx->stats);
+    free(ctx->stats);
+  }
+
+  if (ferror(outfile))
+    status = -1;
+  free(ctx);
+  return status;
+}
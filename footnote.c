@@ -24,14 +24,14 @@
  * SUCH DAMAGE.
  */
 
-#include <wchar.h>
-#include <wctype.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include "footnote.h"
 
-int is_footnote(wchar_t *str, int *val, int *lenp)
+int is_footnote(char *str, int *val, int *lenp)
 {
 int len = 0;
-wchar_t buff[20];
+char buff[20];
 
   len++;
   str++;
@@ -46,7 +46,7 @@ wchar_t buff[20];
   {
     if (*str == '\0')
       return 0;
-    if (iswdigit(*str) == 0)
+    if (isdigit((unsigned char) *str) == 0)
       return 0;
     if (len > 20)
       return 0; 
@@ -55,7 +55,7 @@ wchar_t buff[20];
     str++;
   }
   buff[len-1] = '\0';
-  *val = wcstol(buff, NULL, 10);
+  *val = strtol(buff, NULL, 10);
   len++; /* The closing square bracket is included in the length */
   *lenp = len;
   return 1;
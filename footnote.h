@@ -24,5 +24,5 @@
  * SUCH DAMAGE.
  */
 
-int is_footnote(wchar_t *str, int *val, int *lenp);
+int is_footnote(char *str, int *val, int *lenp);
 
@@ -0,0 +1,1636 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * html.c - convert one Distributed Proofreaders book to HTML
+ *
+ * This is the paragraph and page level part of dphtml; the text within a
+ * line is handled by output.c. All the state lives in a struct dp_context,
+ * so several books can be converted at once.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "dptools.h"
+#include "utf8.h"
+#include "batch.h"
+#include "cache.h"
+#include "diag.h"
+#include "probes.h"
+#include "stats.h"
+#include "trace.h"
+
+#define PAR_TYPE_NONE 0
+#define PAR_TYPE_NORMAL 1
+#define PAR_TYPE_CHAPTER 2
+#define PAR_TYPE_CHAPTER_A 3
+#define PAR_TYPE_SECTION 4
+#define PAR_TYPE_RULE 5
+
+static void check_close_footnote(struct dp_context *ctx);
+
+void context_init(struct dp_context *ctx)
+{
+  memset(ctx, 0, sizeof(struct dp_context));
+  ctx->outfile = stdout;
+  ctx->errfile = stderr;
+  ctx->diag_max = DIAG_MAX;
+  ctx->drama_brackets = 1;
+  ctx->number_sections = 1;
+  translit_init();
+}
+
+static void style_sheet(struct dp_context *ctx)
+{
+struct sink *out = &ctx->out;
+
+  sink_literal(out, "<style>\n");
+#if 0
+  sink_literal(out, "/*<![CDATA[  XML blockout */\n");
+  sink_literal(out, "<!--\n");
+#endif
+
+  sink_literal(out, "  p {\n");
+  sink_literal(out, "    margin-top: .75em;\n");
+  sink_literal(out, "    text-align: justify;\n");
+  sink_literal(out, "    margin-bottom: .75em;\n");
+  sink_literal(out, "    }\n\n");
+
+  sink_literal(out, "  h1,h2,h3,h4,h5,h6 {\n");
+  sink_literal(out, "    text-align: center;\n");
+  sink_literal(out, "    clear: both;\n");
+  sink_literal(out, "    }\n\n");
+
+  sink_literal(out, "  body {\n");
+  sink_literal(out, "    margin-left: 15%;\n");
+  sink_literal(out, "    margin-right: 15%;\n");
+  sink_literal(out, "    }\n\n");
+
+  sink_literal(out, "  h2 {margin-top: 2em;}\n\n");
+
+  sink_literal(out, "  .h2a {\n");
+  sink_literal(out, "    text-align: center;\n");
+  sink_literal(out, "    font-weight: bold;\n");
+  sink_literal(out, "    margin-bottom: 1.5em;\n");
+  sink_literal(out, "    }\n\n");
+
+  sink_literal(out, "  .rmn { left: 92%; position: absolute; text-align: right;}\n\n");
+
+  sink_literal(out, "  .pagenum { left: 92%; position: absolute; text-align: right; font-weight: normal; font-size: small; color: #808080;}\n\n");
+
+  sink_literal(out, "  .fnref {vertical-align: 0.25em; font-size: 0.8em; text-decoration: none;}\n\n");
+
+  sink_literal(out, "  .footnote {margin-left: 2em; margin-right: 2em; font-size: small;}\n\n");
+
+  sink_literal(out, "  .sidenote {float: right; border: solid 1px; padding-right: 0.5em; padding-left: 0.5em; margin-left: 0.5em; width: 25%}\n\n");
+
+  sink_literal(out, "  .nowrap {margin-left: 2em;}\n\n");
+
+  sink_literal(out, "  .figure {margin-top: 2em; text-align: center;}\n\n");
+
+  sink_literal(out, "  .caption {text-align: center}\n\n");
+
+  sink_literal(out, "  .indented {margin-left: 2em}\n\n");
+  sink_literal(out, "  .indented2 {margin-left: 6em}\n\n");
+  sink_literal(out, "  .indented3 {margin-left: 8em}\n\n");
+  sink_literal(out, "  .indented4 {margin-left: 10em}\n\n");
+  sink_literal(out, "  .indented5 {margin-left: 12em}\n\n");
+  sink_literal(out, "  .indented6 {margin-left: 14em}\n\n");
+  sink_literal(out, "  .indented7 {margin-left: 16em}\n\n");
+
+  sink_literal(out, "  .smcap {font-variant: small-caps;}\n\n");
+
+  sink_literal(out, "  .allsmcap {font-size: smaller;}\n\n");
+
+  sink_literal(out, "  .fraktur {font-style: italic;}\n\n");
+
+  sink_literal(out, "  .gesperrt {font-variant: small-caps;}\n\n");
+
+  sink_literal(out, "  .underline {text-decoration: underline;}\n\n");
+
+  /* size1 and size2 are special project-specific markup (for John Dee) */
+  sink_literal(out, "  .size1 {font-weight: bold;}\n\n");
+
+  sink_literal(out, "  .size2 {font-weight: bold; font-size: large;}\n\n");
+
+  sink_literal(out, "  .comment {color: red}\n\n");
+
+  sink_literal(out, "  .handwriting {font-style: italic}\n\n");
+
+#if 0
+  sink_literal(out, "// -->\n");
+  sink_literal(out, "/* XML end  ]]>*/\n");
+#endif
+  sink_literal(out, "</style>\n");
+}
+
+int get_pagenumber(struct dp_context *ctx)
+{
+  return ctx->s.page;
+}
+
+static struct diag *html_diag(struct dp_context *ctx)
+{
+  if (ctx->diag == NULL)
+  {
+    ctx->diag = diag_new(ctx->errfile, ctx->diag_format, ctx->diag_max);
+    if (ctx->diag)
+      ctx->diag->name = ctx->input_name;
+  }
+  return ctx->diag;
+}
+
+void report_error(struct dp_context *ctx, char *msg, char *str)
+{
+  diag_report(html_diag(ctx), DIAG_PAGE_ERROR, ctx->s.page, ctx->line, 0,
+    str, "%s", msg);
+}
+
+/*
+ * Give a warning about the current line. cp, if not NULL, points to where
+ * in the line the problem was found.
+ */
+
+void html_warning(struct dp_context *ctx, int code, char *cp, char *fmt, ...)
+{
+va_list ap;
+int column = 0;
+
+  if (cp && ctx->line_text && (cp >= ctx->line_text) &&
+    (cp <= ctx->line_text + strlen(ctx->line_text)))
+    column = cp - ctx->line_text + 1;
+  va_start(ap, fmt);
+  diag_vreport(html_diag(ctx), code, ctx->s.page, ctx->line, column,
+    cp ? ctx->line_text : NULL, fmt, ap);
+  va_end(ap);
+}
+
+
+void found_illustration(struct dp_context *ctx)
+{
+  STATS_COUNT(ctx->stats, STAT_ILLUSTRATIONS, 1);
+  if (ctx->unnumbered_illustrations)
+    ctx->s.page -= 2;
+}
+
+static void pagenumber_span(struct sink *out, char *id, int n)
+{
+  sink_literal(out, "<span id=\"");
+  sink_puts(out, id);
+  sink_int(out, n);
+  sink_literal(out, "\" data-epub-type=\"pagebreak\" role=\"doc-pagebreak\" title=\"");
+  sink_int(out, n);
+  sink_literal(out, "\" class=\"pagenum\">[Pg&nbsp;");
+  sink_int(out, n);
+  sink_literal(out, "]</span>\n");
+}
+
+static void output_pagenumber(struct dp_context *ctx)
+{
+struct sink *out = &ctx->out;
+int page = ctx->s.page;
+int front_pages = ctx->front_pages;
+int preface_pages = ctx->preface_pages;
+int volume_pages = ctx->volume_pages;
+int page_offset = ctx->page_offset;
+
+  if (ctx->number_pages)
+  {
+    if ((volume_pages == 0) || (page <= volume_pages))
+    {
+      if (page <= front_pages)
+      {
+      }
+      else if (page <= front_pages+preface_pages)
+        pagenumber_span(out, "preface", page-front_pages);
+      else
+        pagenumber_span(out, "page",
+          page-preface_pages-front_pages+page_offset);
+    }
+    else
+    {
+      if (page-volume_pages <= front_pages)
+      {
+      }
+      else if (page-volume_pages <= front_pages+preface_pages)
+        pagenumber_span(out, "preface_2_", page-volume_pages-front_pages);
+      else
+        pagenumber_span(out, "page_2_",
+          page-volume_pages-preface_pages-front_pages);
+    }
+  }
+  else
+  {
+    sink_literal(out, "<!-- Page ");
+    sink_int(out, ctx->s.page);
+    sink_literal(out, " -->\n");
+  }
+}
+
+/*
+ * For --trace: the end of the page or paragraph being converted, if it
+ * was started.
+ */
+
+static void trace_page_end(struct dp_context *ctx)
+{
+  TRACE_END(ctx->trace_page, "html", "page", "page", ctx->s.page);
+  ctx->trace_page = 0;
+}
+
+static void trace_par_end(struct dp_context *ctx)
+{
+  if (ctx->trace_par)
+    trace_async("html", "paragraph", ctx->trace_par, "page", ctx->s.page);
+  ctx->trace_par = 0;
+}
+
+/*
+ * End the spans on the thread that started them, for a caller that
+ * calls html_end on another.
+ */
+
+void html_trace_end(struct dp_context *ctx)
+{
+  trace_par_end(ctx);
+  trace_page_end(ctx);
+}
+
+static void finish_paragraph(struct dp_context *ctx)
+{
+  PROBE3(paragraph_end, ctx->s.page, ctx->line, HTML_BYTES(ctx));
+  trace_par_end(ctx);
+  switch (ctx->s.par_type)
+  {
+    case PAR_TYPE_NORMAL:
+      sink_literal(&ctx->out, "</p>\n");
+      break;
+    case PAR_TYPE_SECTION:
+      sink_literal(&ctx->out, "</h3>\n");
+      break;
+    case PAR_TYPE_CHAPTER_A:
+      sink_literal(&ctx->out, "</p>\n");
+      break;
+    case PAR_TYPE_CHAPTER:
+      sink_literal(&ctx->out, "</h2>\n");
+      break;
+    case PAR_TYPE_RULE:
+      break;
+    default:
+      break;
+  }
+}
+
+static void output_header(struct dp_context *ctx)
+{
+  sink_literal(&ctx->out, "<!DOCTYPE html>\n");
+
+  sink_literal(&ctx->out, "<html lang=\"en\">\n");
+  sink_literal(&ctx->out, "<head>\n");
+  sink_literal(&ctx->out, "<title>Title goes here</title>\n");
+  sink_literal(&ctx->out, "<meta http-equiv=\"Content-Type\" content=\"text/html; charset=UTF-8\">");
+  style_sheet(ctx);
+  sink_literal(&ctx->out, "</head>\n");
+  sink_literal(&ctx->out, "<body>\n");
+}
+
+static void start_paragraph(struct dp_context *ctx, char *buff)
+{
+  PROBE3(paragraph_start, ctx->s.page, ctx->line, HTML_BYTES(ctx));
+  TRACE_START(ctx->trace_par);
+  switch (ctx->s.blank_lines)
+  {
+    case 0:
+      break;
+    case 1:
+      if ((ctx->s.par_type == PAR_TYPE_CHAPTER)||(ctx->s.par_type == PAR_TYPE_CHAPTER_A))
+      {
+        sink_literal(&ctx->out, "<p class=\"h2a\">\n");
+        ctx->s.par_type = PAR_TYPE_CHAPTER_A;
+      }
+      else
+      {
+        if (strncmp(buff, "[Illustration", 13) == 0)
+        {
+          sink_literal(&ctx->out, "<p class=\"figure\">\n");
+          ctx->s.par_type = PAR_TYPE_NORMAL;
+        }
+        else if (strcmp(buff, "<tb>") == 0)
+        {
+          sink_literal(&ctx->out, "<hr>");
+          ctx->s.par_type = PAR_TYPE_RULE;
+        }
+        else if (ctx->s.poetry_mode)
+        {
+          sink_literal(&ctx->out, "<p class=\"nowrap\">\n");
+          ctx->s.par_type = PAR_TYPE_NORMAL;
+        }
+        else
+        {
+          /*
+           * If this is the first paragraph of a footnote or sidenote,
+           * delay the <p> tag so that we can wrap the whole footnote
+           * in a <div>.
+           */
+          if (ctx->s.footnote_start)
+          {
+            ctx->s.footnote_start = 0;
+          }
+          else if (ctx->s.sidenote_start)
+          {
+            ctx->s.sidenote_start = 0;
+          }
+          else
+          { 
+            sink_literal(&ctx->out, "<p>\n");
+          }
+          ctx->s.par_type = PAR_TYPE_NORMAL;
+        }
+      }
+      break;
+    case 2:
+      /* Two blank lines after a normal paragraph denotes a section heading.
+       * Two blank lines after a chapter title indicates the end of the
+       * chapter title.
+       */
+      if ((ctx->s.par_type == PAR_TYPE_CHAPTER)||(ctx->s.par_type == PAR_TYPE_CHAPTER_A))
+      {
+        if ((strncmp(buff, "/*", 2) == 0) || ctx->s.poetry_mode)
+          sink_literal(&ctx->out, "<p class=\"nowrap\">\n");
+        else
+          sink_literal(&ctx->out, "<p>\n");
+        ctx->s.par_type = PAR_TYPE_NORMAL;
+      }
+      else
+      {
+        ctx->s.section++;
+	if (ctx->number_sections)
+	{
+	  sink_literal(&ctx->out, "<h3 id=\"section");
+	  sink_int(&ctx->out, ctx->s.chapter);
+	  sink_putc(&ctx->out, '_');
+	  sink_int(&ctx->out, ctx->s.section);
+	  sink_literal(&ctx->out, "\">\n");
+	}
+	else
+          sink_literal(&ctx->out, "<h3>\n");
+        ctx->s.par_type = PAR_TYPE_SECTION;
+      }
+      break;
+    case 4:
+      ctx->s.chapter++;
+      sink_literal(&ctx->out, "<h2 id=\"chapter");
+      sink_int(&ctx->out, ctx->s.chapter-ctx->chapter_offset);
+      sink_literal(&ctx->out, "\">\n");
+      ctx->s.section = 1; 
+      /* Start section numbering at 2, because the ambiguous syntax means
+       *  that the first section in a chapter will often be missed, and
+       * will have to be added manually.
+       */
+      ctx->s.par_type = PAR_TYPE_CHAPTER;
+      break;
+    default:
+      sink_literal(&ctx->out, "<b>Unexpected number of blank lines (");
+      sink_int(&ctx->out, ctx->s.blank_lines);
+      sink_literal(&ctx->out, ")!</b>\n");
+      sink_literal(&ctx->out, "<p>\n");
+      ctx->s.par_type = PAR_TYPE_NORMAL;
+      break;
+  }
+}
+
+static void end_document(struct dp_context *ctx)
+{
+  switch (ctx->s.par_type)
+  {
+    case PAR_TYPE_NORMAL:
+      sink_literal(&ctx->out, "</p>\n");
+      break;
+    case PAR_TYPE_CHAPTER:
+      sink_literal(&ctx->out, "</h2>\n");
+      break;
+    case PAR_TYPE_CHAPTER_A:
+      sink_literal(&ctx->out, "</h2>\n");
+      break;
+    case PAR_TYPE_SECTION:
+      sink_literal(&ctx->out, "</h3>\n");
+      break;
+  }
+  if (ctx->s.quote_mode == 2)
+    sink_literal(&ctx->out, "</blockquote>\n");
+
+  check_close_footnote(ctx);
+
+  sink_literal(&ctx->out, "</body>\n");
+  sink_literal(&ctx->out, "</html>\n");
+}
+
+static void open_poetry(struct dp_context *ctx)
+{
+  switch (ctx->s.poetry_mode)
+  {
+    case 0:
+      ctx->s.poetry_mode = 1;
+      break;
+    case 1:
+      html_warning(ctx, DIAG_POETRY_OPEN, NULL,
+        "Poetry markers already open");
+      break;
+    case 2:
+      ctx->s.poetry_mode = 1;
+      break;
+  }
+}
+
+static void open_quotation(struct dp_context *ctx)
+{
+  switch (ctx->s.quote_mode)
+  {
+    case 0:
+      ctx->s.quote_mode = 1;
+      sink_literal(&ctx->out, "<blockquote>\n");
+      break;
+    case 1:
+      html_warning(ctx, DIAG_QUOTE_OPEN, NULL,
+        "Blockquote markers already open");
+      break;
+    case 2:
+      ctx->s.quote_mode = 1;
+      break;
+  }
+}
+
+static void close_poetry(struct dp_context *ctx)
+{
+  switch (ctx->s.poetry_mode)
+  {
+    case 0:
+      html_warning(ctx, DIAG_POETRY_NOT_OPEN, NULL, "Poetry markers not open");
+      break;
+    case 1:
+      ctx->s.poetry_mode = 0;
+      break;
+    case 2:
+      html_warning(ctx, DIAG_POETRY_NOT_OPEN, NULL, "Poetry markers not open");
+      break;
+  }
+}
+
+static void close_quotation(struct dp_context *ctx)
+{
+  switch (ctx->s.quote_mode)
+  {
+    case 0:
+      html_warning(ctx, DIAG_QUOTE_NOT_OPEN, NULL,
+        "Blockquote markers not open");
+      break;
+    case 1:
+      ctx->s.quote_mode = 2;
+   /*   wprintf("</blockquote>\n"); */
+      break;
+    case 2:
+      html_warning(ctx, DIAG_QUOTE_NOT_OPEN, NULL,
+        "Blockquote markers not open");
+      break;
+  }
+}
+
+static void check_open_footnote(struct dp_context *ctx, char *buff)
+{
+  if ((strncmp(buff, "[Footnote:", 10) == 0)
+    || (strncmp(buff, "*[Footnote:", 11) == 0)
+    || (strncmp(buff, "[Footnote ", 10) == 0)
+    || (strncmp(buff, "*[Footnote ", 11) == 0))
+  {
+    /* sink_literal(&ctx->out, "<div role=\"doc-footnote\" data-epub-type=\"footnote\" class=\"footnote\">\n"); */
+    ctx->s.footnote_div = 1;
+    ctx->s.footnote_start = 1;
+  }
+
+  if ((strncmp(buff, "[Sidenote:", 10) == 0)
+    || (strncmp(buff, "*[Sidenote:", 11) == 0))
+  {
+    /* sink_literal(&ctx->out, "<div class=\"sidenote\">\n"); */
+    ctx->s.sidenote_div = 1;
+    ctx->s.sidenote_start = 1;
+  }
+}
+
+static void check_close_footnote(struct dp_context *ctx)
+{
+  if (ctx->s.footnote_div && (get_footnote_mode(ctx) == 0))
+  {
+    sink_literal(&ctx->out, "</div>\n");
+    ctx->s.footnote_div = 0;
+  }
+
+  if (ctx->s.sidenote_div && (get_sidenote_mode(ctx) == 0))
+  {
+    sink_literal(&ctx->out, "</div>\n");
+    ctx->s.sidenote_div = 0;
+  }
+}
+
+/*
+ * Handle one of the HTML_OPTIONS. Returns -1 if c is not one of them.
+ */
+
+int html_option(struct dp_context *ctx, int c, char *arg)
+{
+  switch (c)
+  {
+    case 'n':
+      ctx->number_pages = 1;
+      break;
+    case 'y':
+      set_yogh_mode(ctx, 1);
+      break;
+    case 'C':
+      ctx->chapter_offset = atoi(arg);
+      break;
+    case 'D':
+      ctx->drama = 1;
+      set_drama_brackets(ctx, ctx->drama);
+      break;
+    case 'F':
+      ctx->front_pages = atoi(arg);
+      break;
+    case 'O':
+      ctx->page_offset = atoi(arg);
+      break;
+    case 'P':
+      ctx->preface_pages = atoi(arg);
+      break;
+    case 'U':
+       ctx->unnumbered_illustrations = 1;
+       break;
+    case 'V':
+       ctx->volume_pages = atoi(arg);
+       break;
+    default:
+      return -1;
+  }
+  return 0;
+}
+
+void html_begin(struct dp_context *ctx)
+{
+  sink_init_file(&ctx->out, ctx->outfile);
+  output_header(ctx);
+}
+
+/*
+ * Process one line of input, as read by reader_line.
+ */
+
+void html_line(struct dp_context *ctx, char *buff)
+{
+int len;
+char *cp;
+char *start;
+int c;
+
+  len = strlen(buff);
+  STATS_COUNT(ctx->stats, STAT_LINES, 1);
+
+  /* 
+   * Strip <CR><LF> from the end of the line.
+   * Note that the file may have DOS, not UNIX, <CR><LF> convention.
+   */
+
+  if ((len > 0) && (buff[len-1] == '\n'))
+  {
+    buff[len-1] = '\0';
+    len--;
+  }
+  if ((len > 0) && (buff[len-1] == '\r'))
+  {
+    buff[len-1] = '\0';
+    len--;
+  }
+
+  /* Strip trailing spaces */
+
+  while ((len > 0) && (buff[len-1] == ' '))
+  {
+    buff[len-1] = '\0';
+    len--;
+  }
+
+  /* Characters from 0x80 to 0x9f are almost certainly due to
+   * incorrect translation between character sets.
+   */
+
+  ctx->line++;
+  ctx->line_text = buff;
+  for (cp = buff; *cp && !ctx->scan_only; )
+  {
+    start = cp;
+    c = utf8_decode(&cp);
+    if ((c >= 0x80) && (c < 0xa0))
+      html_warning(ctx, DIAG_CONTROL_CHAR, start,
+        "Unexpected control character: 0x%x", c);
+  }
+
+  /*
+   * A blank line denotes a paragraph break
+   * 2 blank lines denote a section break
+   * 4 blank lines denote a chapter break
+   */
+
+  if (len == 0)
+  {
+    ctx->s.blank_lines++;
+  }
+  else if (strncmp(buff, "-----", 5) == 0)
+  {
+    STATS_COUNT(ctx->stats, STAT_PAGES, 1);
+    trace_page_end(ctx);
+    TRACE_START(ctx->trace_page);
+    ctx->s.page++;
+    PROBE3(html_page, ctx->s.page, ctx->line, HTML_BYTES(ctx));
+    ctx->s.blank_lines = 0;  /* ignore any blank lines at end of previous page */
+    if (ctx->s.poetry_mode == 1)
+    {
+      html_warning(ctx, DIAG_POETRY_NOT_CLOSED, NULL,
+        "Poetry markers not closed at end of page");
+      ctx->s.poetry_mode = 0;
+    }
+    if (ctx->s.quote_mode == 1)
+    {
+      html_warning(ctx, DIAG_QUOTE_NOT_CLOSED, NULL,
+        "Block quotation markers not closed at end of page");
+      sink_literal(&ctx->out, "</blockquote>\n");
+      ctx->s.quote_mode = 0;
+    }
+    output_pagenumber(ctx);
+  }
+  else if (strcmp(buff, "[Blank Page]") == 0)
+  {
+  }
+  else
+  {
+    /* Finish off the previous paragraph */
+
+    if (ctx->s.blank_lines > 0)
+    {
+      if (ctx->s.para_open)
+      {
+        if (ctx->drama)
+          finish_drama_bracket(ctx);
+        finish_paragraph(ctx);
+        ctx->s.para_open = 0;
+      }
+      if (ctx->s.quote_mode == 2)
+      {
+        sink_literal(&ctx->out, "</blockquote>\n");
+        ctx->s.quote_mode = 0;
+      }
+      check_close_footnote(ctx);
+    }
+
+    if (strcmp(buff, "/*") == 0)
+    {
+      open_poetry(ctx);
+    }
+    else if (strcmp(buff, "/#") == 0)
+    {
+      open_quotation(ctx);
+    }
+    else if (strcmp(buff, "*/") == 0)
+    {
+      close_poetry(ctx);
+    }
+    else if (strcmp(buff, "#/") == 0)
+    {
+      close_quotation(ctx);
+    }
+    else
+    {
+      if (ctx->s.blank_lines > 0)
+      {
+        check_open_footnote(ctx, buff);
+        start_paragraph(ctx, buff);
+        ctx->s.blank_lines = 0;
+        ctx->s.para_open = 1;
+      }
+
+      if (ctx->s.poetry_mode)
+        write_poetry_line(ctx, buff);
+      else
+        write_line(ctx, buff);
+      sink_literal(&ctx->out, "\n");
+    }
+  }
+  /*
+   * Page-break markers are not part of the transcribed text
+   * NB: Paragraphs can continue across a page-break
+   */
+
+  if (strncmp(buff, "-----", 5) == 0)
+  {
+    flush_tags(ctx);
+  }
+}
+
+/*
+ * End of document.
+ * Close any tags that are still open.
+ */
+
+void html_end(struct dp_context *ctx)
+{
+  html_trace_end(ctx);
+  end_document(ctx);
+  diag_end(ctx->diag);
+  ctx->diag = NULL;
+  sink_flush(&ctx->out);
+  STATS_COUNT(ctx->stats, STAT_BYTES_OUT, ctx->out.written);
+  sink_free(&ctx->out);
+}
+
+/*
+ * With -j, a mapped book is cut into chunks of whole pages, which are
+ * rendered on several threads. Not much state carries over a page break,
+ * so each chunk is rendered from a prediction of the state it starts in.
+ * The real state at the end of the chunk before is checked against the
+ * prediction afterwards, and a chunk that was mispredicted is rendered
+ * again, in its turn.
+ *
+ * The predictions come from a first pass that follows the state through
+ * every chunk from a guess (part way through an ordinary paragraph),
+ * without making any HTML or warnings. In that pass the page, chapter,
+ * section and footnote counters start at COUNTER_BASE, so a counter that
+ * the chunk reset can be told apart from one it only moved on, and a quick
+ * serial pass adds them up to number each chunk. Only the second pass
+ * renders, so each chunk is rendered once unless it was mispredicted.
+ */
+
+#define CHUNK_MIN_LINES 64
+#define CHUNK_MAX_LINES 16384
+#define COUNTER_BASE (1 << 24)
+#define NCOUNTERS 5
+
+struct html_chunk {
+  size_t first; /* Line numbers */
+  size_t last;
+  struct dp_state entry; /* The state the chunk is rendered from */
+  struct dp_state exit;
+  struct sink out;
+  struct diag *diag; /* The warnings, kept back */
+  struct dp_stats stats; /* Counted in the second pass */
+  int failed;
+};
+
+struct html_par {
+  struct dp_context *opts;
+  struct mapped_file *map;
+  struct html_chunk *chunks;
+  int pass;
+};
+
+static void get_counters(struct dp_state *s, int **c)
+{
+  c[0] = &s->page;
+  c[1] = &s->chapter;
+  c[2] = &s->section;
+  c[3] = &s->footnote_section;
+  c[4] = &s->footnote_counter;
+}
+
+/* Only the part of the tag stack that is in use matters */
+static void clean_state(struct dp_state *s)
+{
+  if ((s->tags_on_stack >= 0) && (s->tags_on_stack < TAG_STACK_SIZE))
+    memset(s->tag_stack + s->tags_on_stack, 0,
+      (TAG_STACK_SIZE - s->tags_on_stack) * sizeof(int));
+}
+
+static int state_equal(struct dp_state *a, struct dp_state *b)
+{
+struct dp_state x = *a;
+struct dp_state y = *b;
+
+  clean_state(&x);
+  clean_state(&y);
+  return memcmp(&x, &y, sizeof(struct dp_state)) == 0;
+}
+
+/*
+ * The state at the end of a chunk, as predicted from the state it starts
+ * in and what the first pass found.
+ */
+
+static void predict_state(struct dp_state *next, struct dp_state *entry,
+  struct dp_state *found)
+{
+int *from[NCOUNTERS];
+int *to[NCOUNTERS];
+int i;
+
+  *next = *found;
+  get_counters(entry, from);
+  get_counters(next, to);
+  for (i = 0; i < NCOUNTERS; i++)
+  {
+    if (*to[i] >= COUNTER_BASE/2)
+      *to[i] = *from[i] + *to[i] - COUNTER_BASE;
+  }
+}
+
+/*
+ * Convert lines first to last of a mapped book. The mapping is read-only,
+ * so each line is copied into *buffp for html_line to change. Returns -1
+ * if there isn't the memory for a line.
+ */
+
+static int html_lines(struct dp_context *ctx, struct mapped_file *m,
+  size_t first, size_t last, char **buffp, size_t *sizep)
+{
+char *line;
+size_t n;
+
+  for (n = first; n < last; n++)
+  {
+    if ((line = mapped_line(m, n, buffp, sizep, NULL)) == NULL)
+      return -1;
+    html_line(ctx, line);
+  }
+  return 0;
+}
+
+static int discard(void *arg, char *buff, size_t len)
+{
+  return 0;
+}
+
+static void render_chunk(void *arg, int i)
+{
+struct html_par *par = arg;
+struct html_chunk *c = par->chunks + i;
+struct dp_context ctx;
+uint64_t start;
+char *buff = NULL;
+size_t size = 0;
+
+  TRACE_START(start);
+  ctx = *par->opts;
+  ctx.s = c->entry;
+  ctx.line = c->first;
+  ctx.trace_page = 0;
+  ctx.trace_par = 0;
+  ctx.stats = (ctx.stats && (par->pass == 2)) ? &c->stats : NULL;
+  ctx.scan_only = (par->pass == 1);
+  if (ctx.scan_only)
+    sink_init(&ctx.out, discard, NULL);
+  else
+    sink_init_memory(&ctx.out);
+  /* Keep the warnings until the chunk is known to be right */
+  ctx.diag = diag_new(NULL, (par->pass == 1) ? DIAG_DISCARD : ctx.diag_format,
+    0);
+  if (ctx.diag == NULL)
+  {
+    c->failed = 1;
+    return;
+  }
+
+  c->failed = html_lines(&ctx, par->map, c->first, c->last, &buff, &size) < 0;
+  free(buff);
+  trace_page_end(&ctx);
+
+  c->exit = ctx.s;
+  c->failed |= ctx.out.error;
+  if (par->pass == 1)
+  {
+    sink_free(&ctx.out);
+    diag_end(ctx.diag);
+  }
+  else
+  {
+    c->out = ctx.out;
+    c->diag = ctx.diag;
+  }
+  TRACE_END(start, "html", (par->pass == 1) ? "predict chunk" : "render chunk",
+    "chunk", i);
+}
+
+/*
+ * Split the book into chunks that each start at a "-----File" line (apart
+ * from the first). Returns the number of chunks, or -1 if out of memory.
+ */
+
+static int find_chunks(struct mapped_file *m, int nthreads,
+  struct html_chunk **chunksp)
+{
+struct html_chunk *chunks;
+size_t target;
+size_t start;
+size_t p;
+int nchunks;
+
+  target = m->nlines / (16 * nthreads);
+  if (target < CHUNK_MIN_LINES)
+    target = CHUNK_MIN_LINES;
+  if (target > CHUNK_MAX_LINES)
+    target = CHUNK_MAX_LINES;
+
+  chunks = calloc(m->npages + 1, sizeof(struct html_chunk));
+  if (chunks == NULL)
+    return -1;
+
+  nchunks = 0;
+  start = 0;
+  for (p = 0; p < m->npages; p++)
+  {
+    if (m->pages[p] - start >= target)
+    {
+      chunks[nchunks].first = start;
+      chunks[nchunks].last = m->pages[p];
+      nchunks++;
+      start = m->pages[p];
+    }
+  }
+  chunks[nchunks].first = start;
+  chunks[nchunks].last = m->nlines;
+  nchunks++;
+
+  *chunksp = chunks;
+  return nchunks;
+}
+
+/*
+ * Convert the lines of a mapped book, as a series of html_line calls
+ * would. Returns -1, having done nothing, if out of memory.
+ */
+
+int html_convert_parallel(struct dp_context *ctx, struct mapped_file *m)
+{
+struct html_par par;
+struct html_chunk *chunks;
+struct html_chunk *c;
+struct dp_state guess;
+int *counters[NCOUNTERS];
+int nchunks;
+char *buff = NULL;
+size_t size = 0;
+int i;
+int j;
+int k;
+
+  nchunks = find_chunks(m, ctx->nthreads, &chunks);
+  if (nchunks < 0)
+    return -1;
+
+  par.opts = ctx;
+  par.map = m;
+  par.chunks = chunks;
+
+  memset(&guess, 0, sizeof(struct dp_state));
+  guess.par_type = PAR_TYPE_NORMAL;
+  guess.para_open = 1;
+  get_counters(&guess, counters);
+  for (i = 0; i < NCOUNTERS; i++)
+    *counters[i] = COUNTER_BASE;
+
+  /* The first chunk starts from the real state, so its exit is exact */
+  chunks[0].entry = ctx->s;
+  for (i = 1; i < nchunks; i++)
+    chunks[i].entry = guess;
+  par.pass = 1;
+  run_parallel(0, nchunks, ctx->nthreads, render_chunk, &par);
+
+  for (i = 1; i < nchunks; i++)
+    predict_state(&chunks[i].entry, &chunks[i-1].entry, &chunks[i-1].exit);
+  chunks[0].entry = ctx->s;
+
+  /* Render a few chunks per thread at a time, and keep the ones that
+   * were predicted correctly */
+  par.pass = 2;
+  for (i = 0; i < nchunks; i = j)
+  {
+    j = i + 4 * ctx->nthreads;
+    if (j > nchunks)
+      j = nchunks;
+    run_parallel(i, j, ctx->nthreads, render_chunk, &par);
+    for (k = i; k < j; k++)
+    {
+      c = chunks + k;
+      if (!c->failed && state_equal(&ctx->s, &c->entry))
+      {
+        trace_page_end(ctx);
+        sink_write(&ctx->out, c->out.buff, c->out.len);
+        diag_append(html_diag(ctx), c->diag, 0);
+        if (ctx->stats)
+          stats_add(ctx->stats, &c->stats);
+        ctx->s = c->exit;
+        ctx->line = c->last;
+      }
+      else if (html_lines(ctx, m, c->first, c->last, &buff, &size) < 0)
+      {
+        fprintf(stderr, "Out of memory\n");
+      }
+      sink_free(&c->out);
+      diag_end(c->diag);
+      c->diag = NULL;
+    }
+  }
+
+  free(buff);
+  free(chunks);
+  return 0;
+}
+
+/*
+ * With --cache, the HTML and warnings for each page are saved, keyed by
+ * the page's text, the state it starts in and the options. When the book
+ * is converted again, only the pages that have changed (or now start in
+ * a different state) are rendered; the rest are copied from the cache.
+ */
+
+static void options_key(struct dp_context *ctx, struct cache_key *k)
+{
+struct stat st;
+int opts[15];
+
+  opts[0] = ctx->yogh_mode;
+  opts[1] = ctx->long_s_mode;
+  opts[2] = ctx->drama_brackets;
+  opts[3] = ctx->use_html_entities;
+  opts[4] = ctx->drama;
+  opts[5] = ctx->number_pages;
+  opts[6] = ctx->front_pages;
+  opts[7] = ctx->preface_pages;
+  opts[8] = ctx->volume_pages;
+  opts[9] = ctx->page_offset;
+  opts[10] = ctx->chapter_offset;
+  opts[11] = ctx->number_sections;
+  opts[12] = ctx->unnumbered_illustrations;
+  opts[13] = sizeof(struct dp_state);
+  opts[14] = 2; /* The warnings are kept as diag_save leaves them */
+  cache_key_add(k, opts, sizeof(opts));
+
+  /* A different build of the program may render a page differently */
+  if (stat("/proc/self/exe", &st) == 0)
+  {
+    cache_key_add(k, &st.st_size, sizeof(st.st_size));
+    cache_key_add(k, &st.st_mtime, sizeof(st.st_mtime));
+  }
+}
+
+/*
+ * With --checkpoint, a full conversion also writes a file holding the
+ * state at each "-----File" line and where that line is in the input.
+ * html_convert_range can then start at any page without rendering the
+ * pages before it. The header identifies the input and the options, so
+ * that an out of date checkpoint file isn't used. An edit can leave the
+ * size and times as they were, so each record also has a hash of the
+ * text since the one before, and those are checked before seeking; that
+ * only reads the pages, which is much quicker than rendering them.
+ */
+
+#define CHECKPOINT_MAGIC "dpckpt3"
+#define CHECKPOINT_BLOCK 65536
+
+struct checkpoint_header {
+  char magic[8];
+  struct cache_key key;
+  uint32_t record_size;
+  uint64_t start; /* Where the book started in the input */
+};
+
+struct checkpoint_record {
+  uint64_t offset;
+  uint64_t line; /* Line number of the "-----File" line, less one */
+  struct cache_key text; /* The input from the record before up to here */
+  struct dp_state state;
+};
+
+static int checkpoint_key(struct dp_context *ctx, FILE *infile,
+  struct cache_key *k)
+{
+struct stat st;
+
+  if ((fstat(fileno(infile), &st) < 0) || !S_ISREG(st.st_mode))
+    return -1;
+  cache_key_init(k);
+  options_key(ctx, k);
+  cache_key_add(k, &st.st_dev, sizeof(st.st_dev));
+  cache_key_add(k, &st.st_ino, sizeof(st.st_ino));
+  cache_key_add(k, &st.st_size, sizeof(st.st_size));
+  cache_key_add(k, &st.st_mtim.tv_sec, sizeof(st.st_mtim.tv_sec));
+  cache_key_add(k, &st.st_mtim.tv_nsec, sizeof(st.st_mtim.tv_nsec));
+  return 0;
+}
+
+/* Hashed a block at a time, as checkpoint_find reads it */
+static void checkpoint_text(struct cache_key *k, char *text, size_t len)
+{
+size_t n;
+
+  cache_key_init(k);
+  for (; len > 0; text += n, len -= n)
+  {
+    n = (len < CHECKPOINT_BLOCK) ? len : CHECKPOINT_BLOCK;
+    cache_key_add(k, text, n);
+  }
+}
+
+static void checkpoint_open(struct dp_context *ctx, FILE *infile,
+  struct mapped_file *m)
+{
+struct checkpoint_header h;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  h.record_size = sizeof(struct checkpoint_record);
+  h.start = m->data - m->base;
+  if (checkpoint_key(ctx, infile, &h.key) < 0)
+  {
+    fprintf(stderr, "Can't checkpoint input that isn't a file\n");
+    return;
+  }
+  ctx->checkpoint = fopen(ctx->checkpoint_name, "wb");
+  if (ctx->checkpoint == NULL)
+  {
+    perror(ctx->checkpoint_name);
+    return;
+  }
+  fwrite(&h, sizeof(h), 1, ctx->checkpoint);
+}
+
+/* The record for page separator p, which is where the lines have got to */
+static void checkpoint_page(struct dp_context *ctx, struct mapped_file *m,
+  size_t p)
+{
+struct checkpoint_record rec;
+size_t from;
+size_t to;
+
+  from = (p > 0) ? m->lines[m->pages[p-1]] : 0;
+  to = m->lines[m->pages[p]];
+  memset(&rec, 0, sizeof(rec));
+  rec.offset = (m->data - m->base) + to;
+  rec.line = ctx->line;
+  checkpoint_text(&rec.text, m->data + from, to - from);
+  rec.state = ctx->s;
+  clean_state(&rec.state);
+  fwrite(&rec, sizeof(rec), 1, ctx->checkpoint);
+}
+
+static void checkpoint_close(struct dp_context *ctx)
+{
+  if (ferror(ctx->checkpoint) | fclose(ctx->checkpoint))
+    fprintf(stderr, "Error writing %s\n", ctx->checkpoint_name);
+  ctx->checkpoint = NULL;
+}
+
+/*
+ * Check that the text before a record is as it was when the record was
+ * written. The input is left wherever the reading got to.
+ */
+
+static int checkpoint_check(FILE *infile, uint64_t from,
+  struct checkpoint_record *rec, char *buff)
+{
+struct cache_key k;
+uint64_t len;
+size_t n;
+
+  if ((rec->offset < from) || (fseeko(infile, from, SEEK_SET) != 0))
+    return -1;
+  cache_key_init(&k);
+  for (len = rec->offset - from; len > 0; len -= n)
+  {
+    n = (len < CHECKPOINT_BLOCK) ? len : CHECKPOINT_BLOCK;
+    if (fread(buff, 1, n, infile) != n)
+      return -1;
+    cache_key_add(&k, buff, n);
+  }
+  return (memcmp(&k, &rec->text, sizeof(k)) == 0) ? 0 : -1;
+}
+
+/*
+ * Find where page (counting "-----File" lines from 1) starts, and the
+ * state there, and seek the input to it. Returns -1 if the checkpoint
+ * file can't be used, with the input where it was.
+ */
+
+static int checkpoint_find(struct dp_context *ctx, FILE *infile, int page,
+  struct checkpoint_record *rec)
+{
+struct checkpoint_header h;
+struct cache_key k;
+uint64_t from;
+off_t pos;
+char *buff;
+FILE *f;
+int status = -1;
+int i;
+
+  if ((checkpoint_key(ctx, infile, &k) < 0) ||
+    ((pos = ftello(infile)) < 0))
+    return -1;
+  f = fopen(ctx->checkpoint_name, "rb");
+  if (f == NULL)
+  {
+    perror(ctx->checkpoint_name);
+    return -1;
+  }
+  buff = malloc(CHECKPOINT_BLOCK);
+  if (buff == NULL)
+  {
+    fprintf(stderr, "Out of memory\n");
+    fclose(f);
+    return -1;
+  }
+
+  if ((fread(&h, sizeof(h), 1, f) != 1) ||
+    (memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) ||
+    (h.record_size != sizeof(struct checkpoint_record)) ||
+    (memcmp(&h.key, &k, sizeof(k)) != 0))
+  {
+    fprintf(stderr, "%s is out of date\n", ctx->checkpoint_name);
+  }
+  else
+  {
+    /* Each page before this one has to be as it was */
+    from = h.start;
+    for (i = 0; i < page; i++)
+    {
+      if (fread(rec, sizeof(*rec), 1, f) != 1)
+        break;
+      if (checkpoint_check(infile, from, rec, buff) < 0)
+      {
+        fprintf(stderr, "%s is out of date\n", ctx->checkpoint_name);
+        break;
+      }
+      from = rec->offset;
+    }
+    if ((i == page) && (fseeko(infile, rec->offset, SEEK_SET) == 0))
+      status = 0;
+  }
+
+  if (status < 0)
+    fseeko(infile, pos, SEEK_SET);
+  free(buff);
+  fclose(f);
+  return status;
+}
+
+/*
+ * Render lines first to last and save the result. buffp and sizep are
+ * for html_lines. Returns -1 if out of memory, having saved nothing.
+ */
+
+static int render_page(struct dp_context *ctx, struct mapped_file *m,
+  size_t first, size_t last, struct cache_key *k, char **buffp,
+  size_t *sizep)
+{
+struct cache_entry e;
+struct sink out;
+struct diag *diag;
+char *errors = NULL;
+size_t errors_len = 0;
+int status;
+
+  out = ctx->out;
+  diag = html_diag(ctx);
+  sink_init_memory(&ctx->out);
+  ctx->diag = diag_new(NULL, ctx->diag_format, 0);
+  if (ctx->diag == NULL)
+  {
+    /* Just render it, without saving it */
+    ctx->out = out;
+    ctx->diag = diag;
+    return html_lines(ctx, m, first, last, buffp, sizep);
+  }
+
+  status = html_lines(ctx, m, first, last, buffp, sizep);
+
+  /* Line numbers are saved relative to the start of the page */
+  if ((status == 0) && !ctx->out.error &&
+    (diag_save(ctx->diag, &errors, &errors_len, first) == 0))
+  {
+    e.nparts = 3;
+    e.part[0] = (char *) &ctx->s;
+    e.len[0] = sizeof(struct dp_state);
+    e.part[1] = ctx->out.buff;
+    e.len[1] = ctx->out.len;
+    e.part[2] = errors;
+    e.len[2] = errors_len;
+    if (ctx->memo)
+      cache_table_add(ctx->memo, k, &e);
+    if (ctx->cache_dir && (cache_save(ctx->cache_dir, k, &e) < 0) &&
+      !ctx->cache_warned)
+    {
+      fprintf(stderr, "Can't write to cache %s\n", ctx->cache_dir);
+      ctx->cache_warned = 1;
+    }
+  }
+  free(errors);
+
+  sink_write(&out, ctx->out.buff, ctx->out.len);
+  sink_free(&ctx->out);
+  ctx->out = out;
+  diag_append(diag, ctx->diag, 0);
+  diag_end(ctx->diag);
+  ctx->diag = diag;
+  return status;
+}
+
+/*
+ * Carry on from a page (lines first to last) that was rendered before.
+ * Returns -1 if the entry isn't one of ours.
+ */
+
+static int replay_page(struct dp_context *ctx, struct cache_entry *e,
+  size_t first, size_t last)
+{
+  if ((e->nparts != 3) || (e->len[0] != sizeof(struct dp_state)) ||
+    (diag_load(html_diag(ctx), e->part[2], e->len[2], first) < 0))
+    return -1;
+  trace_page_end(ctx);
+  memcpy(&ctx->s, e->part[0], sizeof(struct dp_state));
+  sink_write(&ctx->out, e->part[1], e->len[1]);
+  ctx->line = last;
+  return 0;
+}
+
+/*
+ * Convert the lines of a mapped book a page at a time, as a series of
+ * html_line calls would. Pages are looked for in memory (for --watch),
+ * then on disk (for --cache).
+ */
+
+void html_convert_cached(struct dp_context *ctx, struct mapped_file *m)
+{
+struct cache_key base;
+struct cache_key k;
+struct cache_entry e;
+struct cache_entry *found;
+struct dp_state entry;
+uint64_t start;
+char *buff = NULL;
+size_t size = 0;
+size_t first;
+size_t last;
+size_t p;
+
+  cache_key_init(&base);
+  options_key(ctx, &base);
+
+  first = 0;
+  for (p = 0; p <= m->npages; p++)
+  {
+    last = (p < m->npages) ? m->pages[p] : m->nlines;
+    if (last == first)
+      continue;
+
+    if ((p > 0) && ctx->checkpoint)
+      checkpoint_page(ctx, m, p - 1);
+
+    /* The page's text is hashed where it is in the mapping */
+    TRACE_START(start);
+    k = base;
+    entry = ctx->s;
+    clean_state(&entry);
+    cache_key_add(&k, &entry, sizeof(struct dp_state));
+    cache_key_add(&k, m->data + m->lines[first],
+      m->lines[last] - m->lines[first]);
+
+    if (ctx->memo && (found = cache_table_find(ctx->memo, &k)) &&
+      (replay_page(ctx, found, first, last) == 0))
+    {
+      TRACE_END(start, "html", "cached page", "page", ctx->s.page);
+      first = last;
+      continue;
+    }
+
+    if (ctx->cache_dir && (cache_load(ctx->cache_dir, &k, &e) == 0))
+    {
+      if (replay_page(ctx, &e, first, last) == 0)
+      {
+        if (ctx->memo)
+          cache_table_add(ctx->memo, &k, &e);
+        cache_entry_free(&e);
+        TRACE_END(start, "html", "cached page", "page", ctx->s.page);
+        first = last;
+        continue;
+      }
+      cache_entry_free(&e);
+    }
+
+    if (render_page(ctx, m, first, last, &k, &buff, &size) < 0)
+    {
+      fprintf(stderr, "Out of memory\n");
+      break;
+    }
+    ctx->pages_rendered++;
+    first = last;
+  }
+  free(buff);
+}
+
+/* Mapped, for the offsets, but otherwise the same as reading lines */
+static void convert_checkpointed(struct dp_context *ctx,
+  struct mapped_file *m)
+{
+char *buff = NULL;
+size_t size = 0;
+size_t n;
+size_t p = 0;
+
+  for (n = 0; n < m->nlines; n++)
+  {
+    if ((p < m->npages) && (m->pages[p] == n))
+    {
+      checkpoint_page(ctx, m, p);
+      p++;
+    }
+    if (html_lines(ctx, m, n, n + 1, &buff, &size) < 0)
+    {
+      fprintf(stderr, "Out of memory\n");
+      break;
+    }
+  }
+  free(buff);
+}
+
+/*
+ * Convert a whole book. Returns -1 if it couldn't all be read.
+ */
+
+int html_convert(struct dp_context *ctx, FILE *infile)
+{
+struct reader r;
+char *line;
+size_t len;
+int status;
+
+  if (ctx->copy_input)
+    reader_copy(&r, infile);
+  else
+    reader_init(&r, infile);
+  html_begin(ctx);
+
+  if (ctx->checkpoint_name && r.mapped)
+    checkpoint_open(ctx, infile, &r.map);
+  else if (ctx->checkpoint_name)
+    fprintf(stderr, "Can't checkpoint input that isn't a file\n");
+
+  if (r.mapped)
+    STATS_COUNT(ctx->stats, STAT_BYTES_IN, r.map.size);
+
+  if ((ctx->cache_dir || ctx->memo) && r.mapped)
+  {
+    html_convert_cached(ctx, &r.map);
+  }
+  else if (ctx->checkpoint)
+  {
+    convert_checkpointed(ctx, &r.map);
+  }
+  else if (!((ctx->nthreads > 1) && r.mapped &&
+    (html_convert_parallel(ctx, &r.map) == 0)))
+  {
+    while ((line = reader_line(&r, &len)) != NULL)
+    {
+      STATS_COUNT(ctx->stats, STAT_BYTES_IN, r.mapped ? 0 : len);
+      html_line(ctx, line);
+    }
+  }
+
+  status = reader_check(&r);
+  if (ctx->checkpoint)
+    checkpoint_close(ctx);
+  html_end(ctx);
+  reader_free(&r);
+  return status;
+}
+
+/*
+ * Convert only pages first to last (where page 0 is anything before the
+ * first "-----File" line), giving exactly what a full conversion gives
+ * for those pages. The pages before them are converted with the output
+ * thrown away, unless a checkpoint file says where to start. Returns -1
+ * if the book couldn't be read as far as the last page.
+ */
+
+int html_convert_range(struct dp_context *ctx, FILE *infile, int first,
+  int last)
+{
+struct checkpoint_record rec;
+struct reader r;
+struct sink out;
+char *line;
+size_t len;
+int page = 0;
+int skipping = 1;
+int status;
+
+  if (ctx->checkpoint_name && (first > 0) &&
+    (checkpoint_find(ctx, infile, first, &rec) == 0))
+  {
+    ctx->s = rec.state;
+    ctx->line = rec.line;
+    page = first - 1;
+  }
+
+  sink_init_file(&out, ctx->outfile);
+  sink_init(&ctx->out, discard, NULL);
+  ctx->diag = diag_new(NULL, DIAG_DISCARD, 0);
+
+  reader_init(&r, infile);
+  while ((line = reader_line(&r, &len)) != NULL)
+  {
+    /* A mapped line has lost its '\n' */
+    STATS_COUNT(ctx->stats, STAT_BYTES_IN, r.mapped ? len + 1 : len);
+    if (strncmp(line, "-----File", 9) == 0)
+      page++;
+    if (page > last)
+      break;
+    if ((page >= first) && skipping)
+    {
+      /* From here on, the output is wanted */
+      sink_flush(&ctx->out);
+      sink_free(&ctx->out);
+      ctx->out = out;
+      diag_end(ctx->diag);
+      ctx->diag = NULL;
+      skipping = 0;
+    }
+    html_line(ctx, line);
+  }
+  status = reader_check(&r);
+  reader_free(&r);
+
+  if (skipping)
+  {
+    /* The range was past the end of the book */
+    sink_free(&ctx->out);
+    ctx->out = out;
+  }
+  sink_flush(&ctx->out);
+  STATS_COUNT(ctx->stats, STAT_BYTES_OUT, ctx->out.written);
+  sink_free(&ctx->out);
+  diag_end(ctx->diag);
+  ctx->diag = NULL;
+  return status;
+}
+
+/*
+ * Convert one book of a batch. arg is a context holding the options; it
+ * is copied so that every book starts from a clean state.
+ */
+
+int html_batch(void *arg, char *name, FILE *infile, FILE *outfile)
+{
+struct dp_context ctx;
+struct dp_stats stats;
+int status;
+
+  ctx = *(struct dp_context *) arg;
+  memset(&ctx.s, 0, sizeof(struct dp_state));
+  ctx.outfile = outfile;
+  ctx.input_name = name;
+  ctx.nthreads = 0; /* The books are already shared out between threads */
+  ctx.checkpoint_name = NULL;
+  if (ctx.stats)
+  {
+    memset(&stats, 0, sizeof(stats));
+    ctx.stats = &stats;
+  }
+
+  status = html_convert(&ctx, infile);
+
+  if (ctx.stats)
+    stats_add(((struct dp_context *) arg)->stats, &stats);
+
+  return (status || ctx.out.error || ferror(outfile)) ? -1 : 0;
+}
@@ -0,0 +1,295 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mapfile.c - read a whole book through mmap
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "arena.h"
+#include "mapfile.h"
+
+static int grow(size_t **arrayp, size_t *sizep, size_t len)
+{
+size_t size;
+size_t *p;
+
+  if (len <= *sizep)
+    return 0;
+  size = *sizep ? *sizep : 1024;
+  while (size < len)
+    size *= 2;
+  p = realloc(*arrayp, size*sizeof(size_t));
+  if (p == NULL)
+    return -1;
+  *arrayp = p;
+  *sizep = size;
+  return 0;
+}
+
+static int add_line(struct mapped_file *m, size_t off)
+{
+  if (grow(&m->lines, &m->lines_size, m->nlines + 2) < 0)
+    return -1;
+  if ((m->size - off >= 9) && (memcmp(m->data + off, "-----File", 9) == 0))
+  {
+    if (grow(&m->pages, &m->pages_size, m->npages + 1) < 0)
+      return -1;
+    m->pages[m->npages++] = m->nlines;
+  }
+  m->lines[m->nlines++] = off;
+  return 0;
+}
+
+/*
+ * Find every line ending. With SSE2, sixteen bytes are compared at a time
+ * and each bit of the mask is a '\n'.
+ */
+
+static int index_lines(struct mapped_file *m)
+{
+char *data = m->data;
+size_t size = m->size;
+size_t i = 0;
+#ifdef __SSE2__
+__m128i nl;
+unsigned int mask;
+int bit;
+#endif
+
+  if ((size > 0) && (add_line(m, 0) < 0))
+    return -1;
+
+#ifdef __SSE2__
+  nl = _mm_set1_epi8('\n');
+  for (; i + 16 <= size; i += 16)
+  {
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+      _mm_loadu_si128((const __m128i *) (data + i)), nl));
+    while (mask)
+    {
+      bit = __builtin_ctz(mask);
+      mask &= mask - 1;
+      if ((i + bit + 1 < size) && (add_line(m, i + bit + 1) < 0))
+        return -1;
+    }
+  }
+#endif
+
+  for (; i < size; i++)
+  {
+    if ((data[i] == '\n') && (i + 1 < size) && (add_line(m, i + 1) < 0))
+      return -1;
+  }
+
+  /* So that line n always ends where line n+1 starts */
+  if (grow(&m->lines, &m->lines_size, m->nlines + 1) < 0)
+    return -1;
+  m->lines[m->nlines] = size;
+
+  /* The last line has nowhere to put a null, so copy it */
+  if ((size > 0) && (data[size-1] != '\n'))
+  {
+    i = m->lines[m->nlines-1];
+    m->tail = malloc(size - i + 1);
+    if (m->tail == NULL)
+      return -1;
+    memcpy(m->tail, data + i, size - i);
+    m->tail[size - i] = '\0';
+  }
+  return 0;
+}
+
+/*
+ * Map infile from its current position to the end. Returns -1 if it
+ * can't be mapped (e.g. it's a pipe), in which case the caller should read
+ * it in the usual way.
+ */
+
+int map_file(struct mapped_file *m, FILE *infile)
+{
+#ifdef _WIN32
+  memset(m, 0, sizeof(struct mapped_file));
+  return -1;
+#else
+struct stat st;
+off_t offset;
+void *p;
+
+  memset(m, 0, sizeof(struct mapped_file));
+
+  if ((fstat(fileno(infile), &st) < 0) || !S_ISREG(st.st_mode) ||
+    (st.st_size == 0))
+    return -1;
+  offset = ftello(infile);
+  if ((offset < 0) || (offset >= st.st_size))
+    return -1;
+
+  /*
+   * Read-only, so that the pages stay shared with the page cache; each
+   * line is copied out as it is used.
+   */
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(infile), 0);
+  if (p == MAP_FAILED)
+    return -1;
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+  m->base = p;
+  m->map_size = st.st_size;
+  m->data = m->base + offset;
+  m->size = st.st_size - offset;
+
+  if (index_lines(m) < 0)
+  {
+    unmap_file(m);
+    return -1;
+  }
+  return 0;
+#endif
+}
+
+/*
+ * Read infile from its current position to the end into memory, and index
+ * it as map_file does. Offsets from base are then from where the read
+ * started. Returns -1 with errno set if it can't be read, or with errno 0
+ * if there was nothing to read.
+ */
+
+int copy_file(struct mapped_file *m, FILE *infile)
+{
+struct stat st;
+size_t size = 0;
+size_t want = 65536;
+size_t len = 0;
+size_t n;
+int failed = 0;
+
+  memset(m, 0, sizeof(struct mapped_file));
+
+  if ((fstat(fileno(infile), &st) == 0) && S_ISREG(st.st_mode) &&
+    (st.st_size > 0))
+    want = st.st_size + 1;
+
+  /* Until a read comes up empty, as it may have grown since the fstat */
+  do
+  {
+    if ((len == size) && (buffer_reserve(&m->base, &size, len + want) < 0))
+    {
+      failed = ENOMEM;
+      break;
+    }
+    n = fread(m->base + len, 1, size - len, infile);
+    len += n;
+  } while (n > 0);
+
+  if (ferror(infile))
+    failed = errno ? errno : EIO;
+  if (failed || (len == 0))
+  {
+    free(m->base);
+    m->base = NULL;
+    errno = failed;
+    return -1;
+  }
+
+  m->copied = 1;
+  m->data = m->base;
+  m->size = len;
+  if (index_lines(m) < 0)
+  {
+    unmap_file(m);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Returns where line n is in the mapping, and its length without the
+ * '\n' (but with any '\r'), or NULL if there is no such line. The line
+ * isn't terminated, and mustn't be changed.
+ */
+
+char *mapped_span(struct mapped_file *m, size_t n, size_t *lenp)
+{
+size_t len;
+
+  if (n >= m->nlines)
+    return NULL;
+
+  len = m->lines[n+1] - m->lines[n];
+  if ((n + 1 < m->nlines) || !m->tail)
+    len--;
+  *lenp = len;
+  return m->data + m->lines[n];
+}
+
+/*
+ * Copy line n, without its '\n', into *buffp (which is grown as needed)
+ * and terminate it. Returns the copy, or NULL if there is no such line
+ * or there isn't the memory for it.
+ */
+
+char *mapped_line(struct mapped_file *m, size_t n, char **buffp,
+  size_t *sizep, size_t *lenp)
+{
+char *start;
+size_t len;
+
+  if (((start = mapped_span(m, n, &len)) == NULL) ||
+    (buffer_reserve(buffp, sizep, len + 1) < 0))
+    return NULL;
+  memcpy(*buffp, start, len);
+  (*buffp)[len] = '\0';
+  if (lenp)
+    *lenp = len;
+  return *buffp;
+}
+
+void unmap_file(struct mapped_file *m)
+{
+  if (m->copied)
+    free(m->base);
+#ifndef _WIN32
+  else if (m->base)
+    munmap(m->base, m->map_size);
+#endif
+  free(m->lines);
+  free(m->pages);
+  free(m->tail);
+  memset(m, 0, sizeof(struct mapped_file));
+}
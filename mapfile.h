@@ -0,0 +1,64 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mapfile.h - read a whole book through mmap
+ *
+ * map_file maps the input and indexes it in one pass: where every line
+ * starts, and which lines are "-----File" page separators. A page can
+ * then be found without reading the pages before it. The mapping is
+ * read-only, so a line that is to be changed (as html_line does) has to
+ * be copied out first.
+ *
+ * copy_file reads the book into memory instead, for a file that may be
+ * truncated while it is in use: a mapping would give SIGBUS.
+ */
+
+struct mapped_file {
+  char *base; /* What mmap returned */
+  size_t map_size;
+  char *data; /* The unread part of the file */
+  size_t size;
+  size_t *lines; /* Offset of the start of each line, then of the end */
+  size_t nlines;
+  size_t lines_size;
+  size_t *pages; /* Line number of each page separator */
+  size_t npages;
+  size_t pages_size;
+  char *tail; /* Copy of a last line that has no line ending */
+  int copied; /* base is a malloc'd copy rather than a mapping */
+};
+
+int map_file(struct mapped_file *m, FILE *infile);
+
+int copy_file(struct mapped_file *m, FILE *infile);
+
+char *mapped_span(struct mapped_file *m, size_t n, size_t *lenp);
+
+char *mapped_line(struct mapped_file *m, size_t n, char **buffp,
+  size_t *sizep, size_t *lenp);
+
+void unmap_file(struct mapped_file *m);
@@ -0,0 +1,63 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * markup.c - recognize DP inline markup
+ */
+
+#include "markup.h"
+#include "markup_dfa.h"
+
+/*
+ * Returns the longest token that str starts with, and stores its length
+ * in *lenp, or returns MK_NONE. The automaton is made by mklexer from
+ * tokens.h, and stops at the first byte that can't continue any token.
+ */
+
+int markup_token(char *str, int *lenp)
+{
+unsigned char *cp;
+int state;
+int token;
+
+  cp = (unsigned char *) str;
+  state = 1;
+  token = MK_NONE;
+  while (1)
+  {
+    /* '\0' always leads to the dead state, 0 */
+    state = markup_next[state][markup_class[*cp]];
+    if (state == 0)
+      break;
+    cp++;
+    if (markup_accept[state] != MK_NONE)
+    {
+      token = markup_accept[state];
+      *lenp = cp - (unsigned char *) str;
+    }
+  }
+  return token;
+}
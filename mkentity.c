@@ -0,0 +1,220 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mkentity.c - make the hash table for find_entity
+ *
+ * Run at build time: reads the names in entities.h and writes
+ * entity_hash.h, a perfect hash from each name to its place in
+ * dp_entities. A lookup hashes the name once, reads its bucket's
+ * displacement and then the one slot it can be in, however many entities
+ * there are.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "entity.h"
+
+static char *names[] = {
+#define ENTITY(name, unicode, latin1, html) name,
+#include "entities.h"
+#undef ENTITY
+};
+
+#define NNAMES ((int) (sizeof(names)/sizeof(names[0])))
+
+#define MAX_SIZE 65536
+#define MAX_SEED 1000
+#define MAX_DISP 65536
+
+static unsigned int hashes[NNAMES];
+static int bucket_of[NNAMES];
+static int order[NNAMES];
+static int bucket_count[MAX_SIZE];
+static unsigned short disp[MAX_SIZE];
+static short slot[MAX_SIZE];
+
+static unsigned int hash(char *name, unsigned int seed)
+{
+unsigned int h;
+
+  h = seed;
+  while (*name)
+  {
+    h = ENTITY_HASH_STEP(h, *name);
+    name++;
+  }
+  return h;
+}
+
+/* Fullest buckets first, while there's most room for them */
+static int by_bucket_size(const void *a, const void *b)
+{
+int i = *(const int *) a;
+int j = *(const int *) b;
+
+  if (bucket_count[bucket_of[i]] != bucket_count[bucket_of[j]])
+    return bucket_count[bucket_of[j]] - bucket_count[bucket_of[i]];
+  return bucket_of[i] - bucket_of[j];
+}
+
+/*
+ * Find a displacement for each bucket. Returns -1 if some bucket
+ * doesn't have one.
+ */
+
+static int place(unsigned int seed, int nbuckets, int size)
+{
+int i;
+int j;
+int k;
+int start;
+int end;
+unsigned int d;
+
+  for (i = 0; i < NNAMES; i++)
+  {
+    hashes[i] = hash(names[i], seed);
+    for (j = 0; j < i; j++)
+      if (hashes[j] == hashes[i])
+        return -1;
+  }
+
+  memset(bucket_count, 0, sizeof(bucket_count));
+  for (i = 0; i < NNAMES; i++)
+  {
+    bucket_of[i] = ENTITY_BUCKET(hashes[i]) & (nbuckets - 1);
+    bucket_count[bucket_of[i]]++;
+    order[i] = i;
+  }
+  qsort(order, NNAMES, sizeof(int), by_bucket_size);
+
+  for (i = 0; i < size; i++)
+    slot[i] = -1;
+  for (i = 0; i < nbuckets; i++)
+    disp[i] = 0;
+
+  for (start = 0; start < NNAMES; start = end)
+  {
+    end = start + bucket_count[bucket_of[order[start]]];
+    for (d = 0; d < MAX_DISP; d++)
+    {
+      for (j = start; j < end; j++)
+      {
+        k = ENTITY_SLOT(hashes[order[j]], d) & (size - 1);
+        if (slot[k] >= 0)
+          break;
+        slot[k] = order[j];
+      }
+      if (j == end)
+        break;
+      /* Take back the ones that did fit */
+      while (--j >= start)
+        slot[ENTITY_SLOT(hashes[order[j]], d) & (size - 1)] = -1;
+    }
+    if (d == MAX_DISP)
+      return -1;
+    disp[bucket_of[order[start]]] = d;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+int size;
+int nbuckets;
+unsigned int seed;
+int min_len;
+int max_len;
+int len;
+int i;
+int j;
+
+  for (i = 0; i < NNAMES; i++)
+  {
+    for (j = 0; j < i; j++)
+    {
+      if (strcmp(names[i], names[j]) == 0)
+      {
+        fprintf(stderr, "mkentity: %s is in entities.h twice\n", names[i]);
+        return 1;
+      }
+    }
+  }
+
+  /* About four names for every five slots, and two names to a bucket */
+  size = 16;
+  while (4*size < 5*NNAMES)
+    size *= 2;
+
+  for (; size <= MAX_SIZE; size *= 2)
+  {
+    nbuckets = size/2;
+    for (seed = 1; seed < MAX_SEED; seed++)
+    {
+      if (place(seed, nbuckets, size) == 0)
+        break;
+    }
+    if (seed < MAX_SEED)
+      break;
+  }
+  if (size > MAX_SIZE)
+  {
+    fprintf(stderr, "mkentity: couldn't find a perfect hash\n");
+    return 1;
+  }
+
+  min_len = max_len = strlen(names[0]);
+  for (i = 1; i < NNAMES; i++)
+  {
+    len = strlen(names[i]);
+    if (len < min_len)
+      min_len = len;
+    if (len > max_len)
+      max_len = len;
+  }
+
+  printf("/* Generated by mkentity from entities.h - do not edit */\n\n");
+  printf("#define ENTITY_SEED %uu\n", seed);
+  printf("#define ENTITY_BUCKETS %d\n", nbuckets);
+  printf("#define ENTITY_HASH_SIZE %d\n", size);
+  printf("#define ENTITY_MIN_LEN %d\n", min_len);
+  printf("#define ENTITY_MAX_LEN %d\n\n", max_len);
+
+  printf("static const unsigned short entity_disp[ENTITY_BUCKETS] = {");
+  for (i = 0; i < nbuckets; i++)
+    printf("%s%d,", (i % 12) ? " " : "\n  ", disp[i]);
+  printf("\n};\n\n");
+
+  printf("static const short entity_slot[ENTITY_HASH_SIZE] = {");
+  for (i = 0; i < size; i++)
+    printf("%s%d,", (i % 16) ? " " : "\n  ", slot[i]);
+  printf("\n};\n");
+
+  return 0;
+}
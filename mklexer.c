@@ -0,0 +1,289 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mklexer.c - make the automaton that markup_token runs
+ *
+ * Run at build time: reads the patterns in tokens.h and the entity names
+ * in entities.h and writes markup_dfa.h. The patterns become an NFA, and
+ * the usual subset construction turns that into a DFA. Bytes that every
+ * pattern treats alike share a column of the table, which keeps it small.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "markup.h"
+
+struct pattern {
+  int token;
+  char *pattern;
+};
+
+static struct pattern patterns[] = {
+#define MARKUP(token, pattern) {token, pattern},
+#include "tokens.h"
+#undef MARKUP
+#define ENTITY(name, unicode, latin1, html) {MK_ENTITY, name},
+#include "entities.h"
+#undef ENTITY
+};
+
+#define NPATTERNS ((int) (sizeof(patterns)/sizeof(patterns[0])))
+
+#define MAX_NFA 2048
+#define MAX_DFA 2048
+#define SET_WORDS (MAX_NFA/32)
+
+/* An NFA edge: from one state to another on any byte in the set */
+struct edge {
+  int from;
+  int to;
+  unsigned int bytes[8];
+};
+
+static struct edge edges[MAX_NFA*2];
+static int nedges;
+static int nfa_accept[MAX_NFA];
+static int nnfa = 1;
+
+struct dfa_state {
+  unsigned int set[SET_WORDS];
+  int accept;
+};
+
+static struct dfa_state dfa[MAX_DFA];
+static int ndfa;
+
+static int byte_class[256];
+static int class_byte[256]; /* A byte that's in each class */
+static int nclasses;
+
+static unsigned short *next_state;
+
+static void fail(char *msg)
+{
+  fprintf(stderr, "mklexer: %s\n", msg);
+  exit(1);
+}
+
+static int new_state()
+{
+  if (nnfa == MAX_NFA)
+    fail("too many NFA states");
+  return nnfa++;
+}
+
+static struct edge *add_edge(int from, int to)
+{
+  if (nedges == MAX_NFA*2)
+    fail("too many NFA edges");
+  edges[nedges].from = from;
+  edges[nedges].to = to;
+  memset(edges[nedges].bytes, 0, sizeof(edges[nedges].bytes));
+  return edges + nedges++;
+}
+
+static void add_range(struct edge *e, int first, int last)
+{
+int c;
+
+  for (c = first; c <= last; c++)
+    e->bytes[c/32] |= 1u << (c%32);
+}
+
+static int has_byte(struct edge *e, int c)
+{
+  return (e->bytes[c/32] >> (c%32)) & 1;
+}
+
+static void add_pattern(struct pattern *p)
+{
+unsigned char *cp;
+int state;
+int next;
+struct edge *e;
+
+  state = 0;
+  for (cp = (unsigned char *) p->pattern; *cp; cp++)
+  {
+    next = new_state();
+    if ((cp[0] == '%') && (cp[1] == 'd'))
+    {
+      add_range(add_edge(state, next), '0', '9');
+      add_range(add_edge(next, next), '0', '9');
+      cp++;
+    }
+    else if ((cp[0] == '%') && (cp[1] == 'A'))
+    {
+      add_range(add_edge(state, next), 'A', 'Z');
+      cp++;
+    }
+    else
+    {
+      if ((cp[0] == '%') && (cp[1] == '%'))
+        cp++;
+      e = add_edge(state, next);
+      add_range(e, *cp, *cp);
+    }
+    state = next;
+  }
+  /* Tokens are numbered in order, so the lowest is the earliest */
+  if ((nfa_accept[state] == MK_NONE) || (p->token < nfa_accept[state]))
+    nfa_accept[state] = p->token;
+}
+
+/*
+ * Put bytes in the same class if every edge either takes both of them
+ * or neither. '\0' is in no pattern, so it ends up in a class with no
+ * transitions.
+ */
+
+static void make_classes()
+{
+int c;
+int d;
+int i;
+
+  for (c = 0; c < 256; c++)
+  {
+    for (d = 0; d < c; d++)
+    {
+      for (i = 0; i < nedges; i++)
+        if (has_byte(edges + i, c) != has_byte(edges + i, d))
+          break;
+      if (i == nedges)
+        break;
+    }
+    if (d < c)
+      byte_class[c] = byte_class[d];
+    else
+    {
+      class_byte[nclasses] = c;
+      byte_class[c] = nclasses++;
+    }
+  }
+}
+
+static int find_dfa_state(unsigned int *set)
+{
+int i;
+int empty = 1;
+
+  for (i = 0; i < SET_WORDS; i++)
+    if (set[i])
+      empty = 0;
+  if (empty)
+    return 0;
+
+  for (i = 1; i < ndfa; i++)
+    if (memcmp(dfa[i].set, set, sizeof(dfa[i].set)) == 0)
+      return i;
+
+  if (ndfa == MAX_DFA)
+    fail("too many DFA states");
+  memcpy(dfa[ndfa].set, set, sizeof(dfa[ndfa].set));
+  dfa[ndfa].accept = MK_NONE;
+  for (i = 0; i < nnfa; i++)
+  {
+    if (((set[i/32] >> (i%32)) & 1) && (nfa_accept[i] != MK_NONE) &&
+      ((dfa[ndfa].accept == MK_NONE) || (nfa_accept[i] < dfa[ndfa].accept)))
+      dfa[ndfa].accept = nfa_accept[i];
+  }
+  return ndfa++;
+}
+
+static void make_dfa()
+{
+unsigned int set[SET_WORDS];
+int state;
+int class;
+int i;
+
+  next_state = calloc(MAX_DFA*nclasses, sizeof(unsigned short));
+  if (next_state == NULL)
+    fail("out of memory");
+
+  /* State 0 is the dead state, state 1 is the start */
+  ndfa = 1;
+  memset(set, 0, sizeof(set));
+  set[0] = 1;
+  find_dfa_state(set);
+
+  for (state = 1; state < ndfa; state++)
+  {
+    for (class = 0; class < nclasses; class++)
+    {
+      memset(set, 0, sizeof(set));
+      for (i = 0; i < nedges; i++)
+      {
+        if (((dfa[state].set[edges[i].from/32] >> (edges[i].from%32)) & 1)
+          && has_byte(edges + i, class_byte[class]))
+          set[edges[i].to/32] |= 1u << (edges[i].to%32);
+      }
+      next_state[state*nclasses + class] = find_dfa_state(set);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+int i;
+int j;
+
+  for (i = 0; i < NPATTERNS; i++)
+    add_pattern(patterns + i);
+  make_classes();
+  make_dfa();
+
+  printf("/* Generated by mklexer from tokens.h and entities.h - do not edit */\n\n");
+  printf("#define MARKUP_STATES %d\n", ndfa);
+  printf("#define MARKUP_CLASSES %d\n\n", nclasses);
+
+  printf("static const unsigned char markup_class[256] = {");
+  for (i = 0; i < 256; i++)
+    printf("%s%d,", (i % 16) ? " " : "\n  ", byte_class[i]);
+  printf("\n};\n\n");
+
+  printf("static const unsigned char markup_accept[MARKUP_STATES] = {");
+  for (i = 0; i < ndfa; i++)
+    printf("%s%d,", (i % 16) ? " " : "\n  ", dfa[i].accept);
+  printf("\n};\n\n");
+
+  printf("static const unsigned short markup_next[MARKUP_STATES][MARKUP_CLASSES] = {\n");
+  for (i = 0; i < ndfa; i++)
+  {
+    printf("  {");
+    for (j = 0; j < nclasses; j++)
+      printf("%s%d", j ? ", " : "", next_state[i*nclasses + j]);
+    printf("},\n");
+  }
+  printf("};\n");
+
+  free(next_state);
+  return 0;
+}
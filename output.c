@@ -5,52 +5,39 @@
  */
 
 #include <stdio.h>
-#include <wchar.h>
-#include <wctype.h>
-#include <locale.h>
+#include <string.h>
 #include <stdlib.h>
 
 #include "dptools.h"
 #include "entity.h"
-
-/* In "yogh mode", [3] denotes LATIN SMALL LETTER YOGH, not a footnote */
-static int yogh_mode = 0; 
-
-static int long_s_mode = 0;
-
-static int drama_brackets = 1;
-
-static int greek_mode = 0; /* Greek transliteration mode, entered by [Greek: */
-
-static int sup_mode = 0; /* Superscript mode */
-
-static int sub_mode = 0; /* subscript mode */
-
-static int footnote_mode = 0;
-
-static int sidenote_mode = 0;
-
-static int use_html_entities = 0;
-
-void set_yogh_mode(int val)
+#include "footnote.h"
+#include "diag.h"
+#include "markup.h"
+#include "scan.h"
+#include "stats.h"
+#include "plain.h"
+#include "probes.h"
+#include "utf8.h"
+
+void set_yogh_mode(struct dp_context *ctx, int val)
 {
-  fwprintf(stderr, L"set_yogh_mode\n");
-  yogh_mode = 1;
+  fprintf(ctx->errfile, "set_yogh_mode\n");
+  ctx->yogh_mode = 1;
 }
 
-void set_drama_brackets(int val)
+void set_drama_brackets(struct dp_context *ctx, int val)
 {
-  drama_brackets = val;
+  ctx->drama_brackets = val;
 }
 
-int get_footnote_mode()
+int get_footnote_mode(struct dp_context *ctx)
 {
-  return footnote_mode;
+  return ctx->s.footnote_mode;
 }
 
-int get_sidenote_mode()
+int get_sidenote_mode(struct dp_context *ctx)
 {
-  return sidenote_mode;
+  return ctx->s.sidenote_mode;
 }
 
 #define TAG_ITALIC 1
@@ -73,754 +60,776 @@ int get_sidenote_mode()
 #define TAG_SUBSCRIPT 18
 #define TAG_SUPERSCRIPT1 19
 
-#define TAG_STACK_SIZE 50
-
-wchar_t *tag_names[] = {
-  L"null",
-  L"italic",
-  L"bold",
-  L"small caps",
-  L"greek",
-  L"comment",
-  L"sidenote",
-  L"footnote",
-  L"symbol",
-  L"unknown",
-  L"illustration",
-  L"size",
-  L"superscript",
-  L"underline",
-  L"handwriting",
-  L"allsmallcaps",
-  L"gesperrt",
-  L"fraktur",
-  L"subscript",
-  L"superscript1",
-  L"illustration"
+static char *tag_names[] = {
+  "null",
+  "italic",
+  "bold",
+  "small caps",
+  "greek",
+  "comment",
+  "sidenote",
+  "footnote",
+  "symbol",
+  "unknown",
+  "illustration",
+  "size",
+  "superscript",
+  "underline",
+  "handwriting",
+  "allsmallcaps",
+  "gesperrt",
+  "fraktur",
+  "subscript",
+  "superscript1",
+  "illustration"
 };
 
-int tag_stack[TAG_STACK_SIZE];
-int tags_on_stack = 0;
-
-int push_tag(int tag)
+static int push_tag(struct dp_context *ctx, int tag)
 {
- /* fwprintf(stderr, L"push %s\n", tag_names[tag]);  */
-  if (tags_on_stack >= TAG_STACK_SIZE)
+ /* fprintf(stderr, "push %s\n", tag_names[tag]);  */
+  if (ctx->s.tags_on_stack >= TAG_STACK_SIZE)
     return -1;
 
-  tag_stack[tags_on_stack] = tag;
-  tags_on_stack++;
+  ctx->s.tag_stack[ctx->s.tags_on_stack] = tag;
+  ctx->s.tags_on_stack++;
 
   return 0;
 }
 
 
-int pop_tag()
+static int pop_tag(struct dp_context *ctx)
 {
-  /* fwprintf(stderr, L"pop\n");  */
-  if (tags_on_stack == 0)
+  /* fprintf(stderr, "pop\n");  */
+  if (ctx->s.tags_on_stack == 0)
     return 0;
 
-  tags_on_stack--;
-  return tag_stack[tags_on_stack];
+  ctx->s.tags_on_stack--;
+  return ctx->s.tag_stack[ctx->s.tags_on_stack];
 }
 
-int top_tag()
+static int top_tag(struct dp_context *ctx)
 {
-  if (tags_on_stack == 0)
+  if (ctx->s.tags_on_stack == 0)
     return 0;
 
-  return tag_stack[tags_on_stack-1];
+  return ctx->s.tag_stack[ctx->s.tags_on_stack-1];
 }
 
-void flush_tags(FILE *outfile)
+void flush_tags(struct dp_context *ctx)
 {
+uint64_t t0 = 0;
+
+  STATS_START(ctx->stats, t0);
   /* In drama formatting, it's OK to have one square bracket that isn't
    * closed by the end of the page.
    */
-  if (drama_brackets && (top_tag() == TAG_UNKNOWN))
-    pop_tag();
+  if (ctx->drama_brackets && (top_tag(ctx) == TAG_UNKNOWN))
+    pop_tag(ctx);
 
-  if (tags_on_stack > 0)
-    fwprintf(stderr, L"Tags not closed at end of page %d.\n", get_pagenumber());
+  if (ctx->s.tags_on_stack > 0)
+    html_warning(ctx, DIAG_TAGS_NOT_CLOSED, NULL,
+      "Tags not closed at end of page");
 
-  while (tags_on_stack > 0)
+  while (ctx->s.tags_on_stack > 0)
   {
-    tags_on_stack--;
-    switch (tag_stack[tags_on_stack])
+    ctx->s.tags_on_stack--;
+    switch (ctx->s.tag_stack[ctx->s.tags_on_stack])
     {
       case TAG_ITALIC:
-        fwprintf(outfile, L"</i>");
+        sink_literal(&ctx->out, "</i>");
         break;
       case TAG_BOLD:
-        fwprintf(outfile, L"</b>");
+        sink_literal(&ctx->out, "</b>");
         break;
       case TAG_SC:
-        fwprintf(outfile, L"</span>");
+        sink_literal(&ctx->out, "</span>");
         break;
       case TAG_GREEK:
-        greek_mode = 0;
+        ctx->s.greek_mode = 0;
+        PROBE3(greek_end, ctx->s.page, ctx->line, HTML_BYTES(ctx));
         break;
       case TAG_COMMENT:
-	fwprintf(outfile, L"</span>");
+	sink_literal(&ctx->out, "</span>");
         break;
       case TAG_SIDENOTE:
-        fwprintf(outfile, L"</span>");
+        sink_literal(&ctx->out, "</span>");
         break;
       case TAG_SUPERSCRIPT:
       case TAG_SUPERSCRIPT1:
-        fwprintf(outfile, L"</sup>");
+        sink_literal(&ctx->out, "</sup>");
         break;
       case TAG_UNDERLINE:
-        fwprintf(outfile, L"</span>");
+        sink_literal(&ctx->out, "</span>");
         break;
       case TAG_HANDWRITING:
-        fwprintf(outfile, L"</span>");
+        sink_literal(&ctx->out, "</span>");
         break;
       case TAG_GESPERRT:
-        fwprintf(outfile, L"</span>");
+        sink_literal(&ctx->out, "</span>");
         break;
       case TAG_FRAKTUR:
-        fwprintf(outfile, L"</span>");
+        sink_literal(&ctx->out, "</span>");
         break;
       case TAG_SUBSCRIPT:
-        fwprintf(outfile, L"</sub>");
+        sink_literal(&ctx->out, "</sub>");
         break;
       case TAG_ILLUSTRATION:
         break;
       default:
-        fwprintf(stderr, L"Unexpected tag on stack: %ls\n",
-          tag_names[tag_stack[tags_on_stack]]);
+        html_warning(ctx, DIAG_UNEXPECTED_TAG, NULL,
+          "Unexpected tag on stack: %s",
+          tag_names[ctx->s.tag_stack[ctx->s.tags_on_stack]]);
         break;
      }
   }
+  STATS_STOP(ctx->stats, STAT_T_FLUSH_TAGS, t0);
 }
 
-int is_footnote(wchar_t *str, int *val, int *lenp)
-{
-int len = 0;
-wchar_t buff[20];
+/*
+ * The HTML entity for a curly quote, or NULL if cp doesn't start with one.
+ * U+2018, U+2019, U+201C and U+201D are E2 80 98, 99, 9C and 9D in UTF-8.
+ */
 
-  len++;
-  str++;
+static char *curly_quote(char *cp)
+{
+  if ((unsigned char) cp[1] != 0x80)
+    return NULL;
+  switch ((unsigned char) cp[2])
+  {
+    case 0x98:
+      return "&lsquo;";
+    case 0x99:
+      return "&rsquo;";
+    case 0x9c:
+      return "&ldquo;";
+    case 0x9d:
+      return "&rdquo;";
+    default:
+      return NULL;
+  }
+}
 
-  if (*str == ']')
-    return 0;
+/*
+ * The number of bytes, starting with cp[0], that write_line can pass
+ * straight to the Greek transliteration: up to the next markup, dash,
+ * curly quote or character that HTML needs escaped.
+ */
 
-  if (*str == '\0')
-    return 0;
+static int greek_run(char *cp)
+{
+int n = 1;
 
-  while (*str != ']')
+  while (1)
   {
-    if (*str == '\0')
-      return 0;
-    if (iswdigit(*str) == 0)
-      return 0;
-    if (len > 20)
-      return 0; 
-    buff[len-1] = *str;
-    len++;
-    str++;
+    switch ((unsigned char) cp[n])
+    {
+      case '\0':
+      case '"':
+      case '&':
+      case '>':
+      case '^':
+      case '_':
+      case '<':
+      case '-':
+      case '[':
+      case ']':
+      case '}':
+      case 0xe2:
+        return n;
+      default:
+        n++;
+        break;
+    }
   }
-  buff[len-1] = '\0';
-  *val = wcstol(buff, NULL, 10);
-  len++; /* The closing square bracket is included in the length */
-  *lenp = len;
-  return 1;
 }
 
-static int footnote_section = 0;
-static int footnote_counter = 0;
-
-void write_line(FILE *outfile, wchar_t *str)
+void write_line(struct dp_context *ctx, char *str)
 {
-  wchar_t *cp;
+  char *cp;
   int footnote_num;
   int len;
+  int token;
   struct entity *e;
+  char *quote;
+  char *space;
+  uint64_t t0 = 0;
+  uint64_t t1 = 0;
 
+  STATS_START(ctx->stats, t0);
   cp = str;
 
-  while (*cp != L'\0')
+  while (*cp != '\0')
   {
-    switch (*cp)
+    switch ((unsigned char) *cp)
     {
       /*
        * These three characters are special in HTML, and must be escaped.
        */
       case '"':
-        fwprintf(outfile, L"&quot;");
+        sink_literal(&ctx->out, "&quot;");
         cp++;
         break;
       case '&':
-        fwprintf(outfile, L"&amp;");
+        sink_literal(&ctx->out, "&amp;");
         cp++;
         break;
       case '>':
-        fwprintf(outfile, L"&gt;");
-        cp++;
-        break;
-      /*
-       * Other characters are valid in HTML, but can be escaped if we
-       * want the file to be ISO LATIN 1 only.
-       */
-      case 0x2018:
-        if (use_html_entities)
-	  fwprintf(outfile, L"&lsquo;");
-	else
-          fputwc(*cp, outfile);
-        cp++;
-        break;
-      case 0x2019:
-	if (use_html_entities)
-          fwprintf(outfile, L"&rsquo;");
-	else
-          fputwc(*cp, outfile);
-        cp++;
-        break;
-      case 0x201c:
-	if (use_html_entities)
-          fwprintf(outfile, L"&ldquo;");
-	else
-          fputwc(*cp, outfile);
-        cp++;
-        break;
-      case 0x201d:
-	if (use_html_entities)
-          fwprintf(outfile, L"&rdquo;");
-	else
-	  fputwc(*cp, outfile);
+        sink_literal(&ctx->out, "&gt;");
         cp++;
         break;
       case '^':
-        sup_mode = 1;
-        fwprintf(outfile, L"<sup>");
+        ctx->s.sup_mode = 1;
+        sink_literal(&ctx->out, "<sup>");
         if (cp[1] == '{')
         {
           cp += 2;
-          push_tag(TAG_SUPERSCRIPT);
+          push_tag(ctx, TAG_SUPERSCRIPT);
         }
         else
         {
           cp++;
-          push_tag(TAG_SUPERSCRIPT1);
+          push_tag(ctx, TAG_SUPERSCRIPT1);
         }
         break;
       case '_':
         if (cp[1] == '{')
         {
           cp += 2;
-          push_tag(TAG_SUBSCRIPT);
-          sub_mode = 1;
-          fwprintf(outfile, L"<sub>");
+          push_tag(ctx, TAG_SUBSCRIPT);
+          ctx->s.sub_mode = 1;
+          sink_literal(&ctx->out, "<sub>");
         }
-        else if (greek_mode)
+        else if (ctx->s.greek_mode)
         {
-          write_greek_char(outfile, *cp);
+          write_greek_char(ctx, *cp);
           cp++;
         }
         else
         {
-          fputwc(*cp, outfile);
+          sink_putc(&ctx->out, *cp);
           cp++;
         }
         break;
       case '<':
-        if (wcsncmp(cp, L"<i>", 3) == 0)
-        {
-          fwprintf(outfile, L"<i>");
-          cp += 3;
-          push_tag(TAG_ITALIC);
-        }
-        else if (wcsncmp(cp, L"<b>", 3) == 0)
-        {
-          fwprintf(outfile, L"<b>");
-          cp += 3;
-          push_tag(TAG_BOLD);
-        }
-        else if (wcsncmp(cp, L"<g>", 3) == 0)
-        {
-          fwprintf(outfile, L"<span class=\"gesperrt\">");
-          cp += 3;
-          push_tag(TAG_GESPERRT);
-        }
-        else if (wcsncmp(cp, L"<f>", 3) == 0)
+        token = cursor_token(ctx->tokens, cp, &len);
+        STATS_COUNT(ctx->stats, STAT_MARKUP, token != MK_NONE);
+        switch (token)
         {
-          fwprintf(outfile, L"<span class=\"fraktur\">");
-          cp += 3;
-          push_tag(TAG_FRAKTUR);
-        }
-        else if (wcsncmp(cp, L"<sc>", 4) == 0)
-        {
-          fwprintf(outfile, L"<span class=\"smcap\">");
-          cp += 4;
-          push_tag(TAG_SC);
-        }
-        else if (wcsncmp(cp, L"<tb>", 4) == 0)
-        {
-          cp += 4; /* <tb> is handled in gutf.c, not here. */
-        }
-        else if (wcsncmp(cp, L"<asc>", 5) == 0)
-        {
-          fwprintf(outfile, L"<span class=\"allsmcap\">");
-          cp += 5;
-          push_tag(TAG_ASC);
-        }
-        else if (wcsncmp(cp, L"<size 1>", 8) == 0)
-        {
-          fwprintf(outfile, L"<span class=\"size1\">");
-          cp += 8;
-          push_tag(TAG_SIZE);
-        }
-        else if (wcsncmp(cp, L"<size 2>", 8) == 0)
-        {
-          fwprintf(outfile, L"<span class=\"size2\">");
-          cp += 8;
-          push_tag(TAG_SIZE);
-        }
-        else if (wcsncmp(cp, L"<u>", 3) == 0)
-        {
-          fwprintf(outfile, L"<span class=\"underline\">");
-          cp += 3;
-          push_tag(TAG_UNDERLINE);
-        }
-        else if (wcsncmp(cp, L"</i>", 4) == 0)
-        {
-          cp += 4;
-          if (top_tag() != TAG_ITALIC)
-            fwprintf(stderr, L"Tags don't match\n");
-          else
-          {
-            fwprintf(outfile, L"</i>");
-            pop_tag();
-          }
-        }
-        else if (wcsncmp(cp, L"</b>", 4) == 0)
-        {
-          cp += 4;
-          if (top_tag() != TAG_BOLD)
-            fwprintf(stdout, L"Tags don't match\n");
-          else
-          {
-            fwprintf(outfile, L"</b>");
-            pop_tag();
-          }
-        }
-        else if (wcsncmp(cp, L"</sc>", 5) == 0)
-        {
-          cp += 5;
-          if (top_tag() != TAG_SC)
-            fwprintf(stdout, L"Tags don't match\n");
-          else
-          {
-            fwprintf(outfile, L"</span>");
-            pop_tag();
-          }
-        }
-        else if (wcsncmp(cp, L"</f>", 4) == 0)
-        {
-          cp += 4;
-          if (top_tag() != TAG_FRAKTUR)
-            fwprintf(stdout, L"Tags don't match\n");
-          else
-          {
-            fwprintf(outfile, L"</span>");
-            pop_tag();
-          }
-        }
-        else if (wcsncmp(cp, L"</g>", 4) == 0)
-        {
-          cp += 4;
-          if (top_tag() != TAG_GESPERRT)
-            fwprintf(stdout, L"Tags don't match\n");
-          else
-          {
-            fwprintf(outfile, L"</span>");
-            pop_tag();
-          }
-        }
-        else if (wcsncmp(cp, L"</asc>", 6) == 0)
-        {
-          cp += 6;
-          if (top_tag() != TAG_ASC)
-            fwprintf(stdout, L"Tags don't match\n");
-          else
-          {
-            fwprintf(outfile, L"</span>");
-            pop_tag();
-          }
-        }
-        else if (wcsncmp(cp, L"</size>", 7) == 0) /* <size> is a special for John Dee */
-        {
-          cp += 7;
-          if (top_tag() != TAG_SIZE)
-            fwprintf(stdout, L"Tags don't match\n");
-          else
-          {
-            fwprintf(outfile, L"</span>");
-            pop_tag();
-          }
-        }
-        else if (wcsncmp(cp, L"</u>", 4) == 0)
-        {
-          cp += 4;
-          if (top_tag() != TAG_UNDERLINE)
-            fwprintf(stderr, L"Tags don't match\n");
-          else
-          {
-            fwprintf(outfile, L"</span>");
-            pop_tag();
-          }
-        }
-        else
-        {
-          fwprintf(outfile, L"&lt;");
-          cp++;
+          case MK_ITALIC:
+            sink_literal(&ctx->out, "<i>");
+            push_tag(ctx, TAG_ITALIC);
+            break;
+          case MK_BOLD:
+            sink_literal(&ctx->out, "<b>");
+            push_tag(ctx, TAG_BOLD);
+            break;
+          case MK_GESPERRT:
+            sink_literal(&ctx->out, "<span class=\"gesperrt\">");
+            push_tag(ctx, TAG_GESPERRT);
+            break;
+          case MK_FRAKTUR:
+            sink_literal(&ctx->out, "<span class=\"fraktur\">");
+            push_tag(ctx, TAG_FRAKTUR);
+            break;
+          case MK_SC:
+            sink_literal(&ctx->out, "<span class=\"smcap\">");
+            push_tag(ctx, TAG_SC);
+            break;
+          case MK_TB:
+            /* <tb> is handled in gutf.c, not here. */
+            break;
+          case MK_ASC:
+            sink_literal(&ctx->out, "<span class=\"allsmcap\">");
+            push_tag(ctx, TAG_ASC);
+            break;
+          case MK_SIZE1:
+            sink_literal(&ctx->out, "<span class=\"size1\">");
+            push_tag(ctx, TAG_SIZE);
+            break;
+          case MK_SIZE2:
+            sink_literal(&ctx->out, "<span class=\"size2\">");
+            push_tag(ctx, TAG_SIZE);
+            break;
+          case MK_UNDERLINE:
+            sink_literal(&ctx->out, "<span class=\"underline\">");
+            push_tag(ctx, TAG_UNDERLINE);
+            break;
+          case MK_END_ITALIC:
+            if (top_tag(ctx) != TAG_ITALIC)
+              html_warning(ctx, DIAG_TAGS_MISMATCH, cp, "Tags don't match");
+            else
+            {
+              sink_literal(&ctx->out, "</i>");
+              pop_tag(ctx);
+            }
+            break;
+          case MK_END_BOLD:
+            if (top_tag(ctx) != TAG_BOLD)
+              html_warning(ctx, DIAG_TAGS_MISMATCH, cp, "Tags don't match");
+            else
+            {
+              sink_literal(&ctx->out, "</b>");
+              pop_tag(ctx);
+            }
+            break;
+          case MK_END_SC:
+            if (top_tag(ctx) != TAG_SC)
+              html_warning(ctx, DIAG_TAGS_MISMATCH, cp, "Tags don't match");
+            else
+            {
+              sink_literal(&ctx->out, "</span>");
+              pop_tag(ctx);
+            }
+            break;
+          case MK_END_FRAKTUR:
+            if (top_tag(ctx) != TAG_FRAKTUR)
+              html_warning(ctx, DIAG_TAGS_MISMATCH, cp, "Tags don't match");
+            else
+            {
+              sink_literal(&ctx->out, "</span>");
+              pop_tag(ctx);
+            }
+            break;
+          case MK_END_GESPERRT:
+            if (top_tag(ctx) != TAG_GESPERRT)
+              html_warning(ctx, DIAG_TAGS_MISMATCH, cp, "Tags don't match");
+            else
+            {
+              sink_literal(&ctx->out, "</span>");
+              pop_tag(ctx);
+            }
+            break;
+          case MK_END_ASC:
+            if (top_tag(ctx) != TAG_ASC)
+              html_warning(ctx, DIAG_TAGS_MISMATCH, cp, "Tags don't match");
+            else
+            {
+              sink_literal(&ctx->out, "</span>");
+              pop_tag(ctx);
+            }
+            break;
+          case MK_END_SIZE: /* <size> is a special for John Dee */
+            if (top_tag(ctx) != TAG_SIZE)
+              html_warning(ctx, DIAG_TAGS_MISMATCH, cp, "Tags don't match");
+            else
+            {
+              sink_literal(&ctx->out, "</span>");
+              pop_tag(ctx);
+            }
+            break;
+          case MK_END_UNDERLINE:
+            if (top_tag(ctx) != TAG_UNDERLINE)
+              html_warning(ctx, DIAG_TAGS_MISMATCH, cp, "Tags don't match");
+            else
+            {
+              sink_literal(&ctx->out, "</span>");
+              pop_tag(ctx);
+            }
+            break;
+          default:
+            sink_literal(&ctx->out, "&lt;");
+            len = 1;
+            break;
         }
+        cp += len;
         break;
       case '-':
-        if (wcsncmp(cp, L"----", 4) == 0)
+        if (strncmp(cp, "----", 4) == 0)
         {
-          fwprintf(outfile, L"&mdash;&mdash;"); /* really, a single long dash */
+          sink_literal(&ctx->out, "&mdash;&mdash;"); /* really, a single long dash */
           cp += 4;
         }
-        else if (wcsncmp(cp, L"--", 2) == 0)
+        else if (strncmp(cp, "--", 2) == 0)
         {
-          fwprintf(outfile, L"&mdash;");
+          sink_literal(&ctx->out, "&mdash;");
           cp += 2;
         }
         else
         {
-          fwprintf(outfile, L"-");
+          sink_literal(&ctx->out, "-");
           cp++;
         }
         break;
       case '[':
-        if ((wcsncmp(cp, L"[f]", 3) == 0) && long_s_mode) /* non-standard addition: long s */
-        {
-           fwprintf(outfile, L"s");
-           cp += 3;
-        }
-        else if (yogh_mode && (wcsncmp(cp, L"[3]", 3) == 0))
-        {
-          fwprintf(outfile, L"&#x021d;");
-          cp += 3;
-        }
-        else if (is_footnote(cp, &footnote_num, &len))
-        {
-          if (footnote_num == 1)
-            footnote_section++;
-            footnote_counter = 0;
-          /* Each time the footnote numbering restarts from 1, increment
-           * footnote_section, so that each footnote gets a unique label.
-           */
-          fwprintf(outfile, L"<a id=\"ref_%d_%d\" role=\"doc-noteref\" data-epub-type=\"noteref\" href=\"#footnote_%d_%d\" class=\"fnref\">[%d]</a>", footnote_section, footnote_num, footnote_section, footnote_num, footnote_num);
-          cp += len;
-        }
-        else if ((cp[1] != '\0') && (cp[2] == ']')
-                 && (cp[1] >= 'A') && (cp[1] <= 'Z'))
-        {
-          fwprintf(outfile, L"<span class=\"fnref\">[%lc]</span>", cp[1]);
-          cp += 3;
-        }
-        else if (wcsncmp(cp, L"[']", 3) == 0)
-        {
-          flush_greek(outfile);
-          fputwc(0x374, outfile);
-          cp += 3;
-        }
-        else if (wcsncmp(cp, L"[st]", 4) == 0)
-        {
-          flush_greek(outfile);
-          fputwc(0x3db, outfile);
-          cp += 4;
-        }
-        else if (wcsncmp(cp, L"[ST]", 4) == 0)
-        {
-          flush_greek(outfile);
-          fputwc(0x3da, outfile);
-          cp += 4;
-        }
-        else if (e = find_entity(cp, &len))
-        {
-          if (use_html_entities && e->html)
-            fwprintf(outfile, L"%ls", e->html);
-          else
-            fwprintf(outfile, L"&#x%04x;", e->unicode);
-          cp += len;
-        }
-        else if (wcsncmp(cp, L"[3*]", 4) == 0)
-        {
-          fwprintf(outfile, L"&#x021c;");
-          cp += 4;
-        }
-        else if (wcsncmp(cp, L"[Blank Page]", 12) == 0)
-        {
-          cp += 12;
-        }
-        else if (wcsncmp(cp, L"[Illustration]", 14) == 0)
-        {
-          cp += 14;
-          fwprintf(outfile, L"<img src=\"images/missing.jpg\" alt=\"Missing image\">\n");
-          found_illustration();
-        }
-        else if (wcsncmp(cp, L"[Illustration:", 14) == 0)
-        {
-          cp += 14;
-          while (*cp == ' ')
-            cp++;
-          fwprintf(outfile, L"<img src=\"images/missing.jpg\" alt=\"Missing image\">\n");
-          fwprintf(outfile, L"</p>\n");
-          fwprintf(outfile, L"<p class=\"caption\">\n");
-          push_tag(TAG_ILLUSTRATION);
-          found_illustration();
-        }
-        else if (wcsncmp(cp, L"[*]", 3) == 0)
-        {
-          fwprintf(outfile, L"<span class=\"fnref\">*</span>");
-          cp += 3;
-        }
-        else if (wcsncmp(cp, L"[Greek:", 7) == 0)
-        {
-          push_tag(TAG_GREEK);
-          greek_mode = 1;
-          cp += 7;
-          while (*cp == ' ')
-            cp++;
-        }
-        else if (wcsncmp(cp, L"[Symbol:", 8) == 0)
-        {
-          push_tag(TAG_SYMBOL);
-          fwprintf(outfile, L"[Symbol:");
-          cp += 8;
-        }
-        else if (wcsncmp(cp, L"[Sidenote:", 10) == 0)
-        {
-          push_tag(TAG_SIDENOTE);
-          sidenote_mode = 1;
-          cp += 10;
-          while (*cp == ' ')
-            cp++;
-          fwprintf(outfile, L"<div class=\"sidenote\"><p>");
-        } 
-        else if (wcsncmp(cp, L"[Footnote:", 10) == 0)
-        {
-          push_tag(TAG_FOOTNOTE);
-          footnote_mode = 1;
-          /* The "footnote" class is handled in gutf.c, not here,
-           * paragraphs are nested inside footnotes.
-           */
-          cp += 10;
-          while (*cp == ' ')
-            cp++;
-          footnote_counter++;
-          fwprintf(outfile,
-            L"<div id=\"footnote_%d_%d\">",
-            footnote_section,
-            footnote_counter);
-          fwprintf(outfile, L"<p>");
-        }
-        else if (wcsncmp(cp, L"[Footnote", 9) == 0)
-        {
-          push_tag(TAG_FOOTNOTE);
-          footnote_mode = 1;
-          cp += 9;
-          while (*cp == ' ')
-            cp++;
-          footnote_counter++;
-          fwprintf(outfile, L"<div id=\"footnote_%d_%d\" role=\"doc-footnote\" data-epub-type=\"footnote\" class=\"footnote\">",
-          footnote_section,
-          footnote_counter);
-          fwprintf(outfile, L"<p>");
-          fwprintf(outfile, L"<a role=\"doc-backlink\" href=\"#ref_%d_%d\">",
-            footnote_section,
-            footnote_counter);
-          while ((*cp != '\0') && (*cp != ':'))
-          {
-            fputwc(*cp, outfile);
-            cp++;
-          }
-          fwprintf(outfile, L"</a>"); 
-        }
-        else if (wcsncmp(cp, L"[**", 3) == 0)
-        {
-          push_tag(TAG_COMMENT);
-          fwprintf(outfile, L"<span class=\"comment\">[** ");
-          cp += 3;
-        }
-        else if (wcsncmp(cp, L"[HW:", 4) == 0)
-        {
-          push_tag(TAG_HANDWRITING);
-          fwprintf(outfile, L"<span class=\"handwriting\">");
-          cp += 4;
-          while (*cp == ' ')
+        token = cursor_token(ctx->tokens, cp, &len);
+        if ((token == MK_LONG_S) && !ctx->long_s_mode)
+          token = MK_NONE;
+        if ((token == MK_YOGH) && !ctx->yogh_mode)
+          token = MK_FOOTNOTE_REF;
+        /* Too many digits to be a footnote number */
+        if ((token == MK_FOOTNOTE_REF) &&
+          !is_footnote(cp, &footnote_num, &len))
+          token = MK_NONE;
+        STATS_COUNT(ctx->stats, STAT_MARKUP, token != MK_NONE);
+
+        switch (token)
+        {
+          case MK_LONG_S: /* non-standard addition: long s */
+            sink_literal(&ctx->out, "s");
+            cp += len;
+            break;
+          case MK_YOGH:
+            sink_literal(&ctx->out, "&#x021d;");
+            cp += len;
+            break;
+          case MK_FOOTNOTE_REF:
+            STATS_COUNT(ctx->stats, STAT_FOOTNOTE_REFS, 1);
+            if (footnote_num == 1)
+              ctx->s.footnote_section++;
+              ctx->s.footnote_counter = 0;
+            /* Each time the footnote numbering restarts from 1, increment
+             * footnote_section, so that each footnote gets a unique label.
+             */
+            sink_literal(&ctx->out, "<a id=\"ref_");
+            sink_int(&ctx->out, ctx->s.footnote_section);
+            sink_putc(&ctx->out, '_');
+            sink_int(&ctx->out, footnote_num);
+            sink_literal(&ctx->out, "\" role=\"doc-noteref\" data-epub-type=\"noteref\" href=\"#footnote_");
+            sink_int(&ctx->out, ctx->s.footnote_section);
+            sink_putc(&ctx->out, '_');
+            sink_int(&ctx->out, footnote_num);
+            sink_literal(&ctx->out, "\" class=\"fnref\">[");
+            sink_int(&ctx->out, footnote_num);
+            sink_literal(&ctx->out, "]</a>");
+            cp += len;
+            break;
+          case MK_LETTER_REF:
+            sink_literal(&ctx->out, "<span class=\"fnref\">[");
+            sink_putc(&ctx->out, cp[1]);
+            sink_literal(&ctx->out, "]</span>");
+            cp += len;
+            break;
+          case MK_KERAIA:
+            flush_greek(ctx);
+            sink_utf8(&ctx->out, 0x374);
+            cp += len;
+            break;
+          case MK_STIGMA:
+            flush_greek(ctx);
+            sink_utf8(&ctx->out, 0x3db);
+            cp += len;
+            break;
+          case MK_CAPITAL_STIGMA:
+            flush_greek(ctx);
+            sink_utf8(&ctx->out, 0x3da);
+            cp += len;
+            break;
+          case MK_ENTITY:
+            STATS_COUNT(ctx->stats, STAT_ENTITIES, 1);
+            STATS_START(ctx->stats, t1);
+            e = find_entity(cp, &len);
+            STATS_STOP(ctx->stats, STAT_T_ENTITY, t1);
+            if (ctx->use_html_entities && e->html)
+              sink_puts(&ctx->out, e->html);
+            else
+              sink_printf(&ctx->out, "&#x%04x;", e->unicode);
+            cp += len;
+            break;
+          case MK_CAPITAL_YOGH:
+            sink_literal(&ctx->out, "&#x021c;");
+            cp += len;
+            break;
+          case MK_BLANK_PAGE:
+            cp += len;
+            break;
+          case MK_ILLUSTRATION:
+            cp += len;
+            sink_literal(&ctx->out, "<img src=\"images/missing.jpg\" alt=\"Missing image\">\n");
+            found_illustration(ctx);
+            break;
+          case MK_CAPTION:
+            cp += len;
+            while (*cp == ' ')
+              cp++;
+            sink_literal(&ctx->out, "<img src=\"images/missing.jpg\" alt=\"Missing image\">\n");
+            sink_literal(&ctx->out, "</p>\n");
+            sink_literal(&ctx->out, "<p class=\"caption\">\n");
+            push_tag(ctx, TAG_ILLUSTRATION);
+            found_illustration(ctx);
+            break;
+          case MK_STAR_REF:
+            sink_literal(&ctx->out, "<span class=\"fnref\">*</span>");
+            cp += len;
+            break;
+          case MK_GREEK:
+            push_tag(ctx, TAG_GREEK);
+            ctx->s.greek_mode = 1;
+            PROBE3(greek_start, ctx->s.page, ctx->line, HTML_BYTES(ctx));
+            cp += len;
+            while (*cp == ' ')
+              cp++;
+            break;
+          case MK_SYMBOL:
+            push_tag(ctx, TAG_SYMBOL);
+            sink_literal(&ctx->out, "[Symbol:");
+            cp += len;
+            break;
+          case MK_SIDENOTE:
+            push_tag(ctx, TAG_SIDENOTE);
+            ctx->s.sidenote_mode = 1;
+            cp += len;
+            while (*cp == ' ')
+              cp++;
+            sink_literal(&ctx->out, "<div class=\"sidenote\"><p>");
+            break;
+          case MK_FOOTNOTE_COLON:
+            push_tag(ctx, TAG_FOOTNOTE);
+            ctx->s.footnote_mode = 1;
+            /* The "footnote" class is handled in gutf.c, not here,
+             * paragraphs are nested inside footnotes.
+             */
+            cp += len;
+            while (*cp == ' ')
+              cp++;
+            ctx->s.footnote_counter++;
+            PROBE3(footnote_start, ctx->s.page, ctx->s.footnote_counter,
+              HTML_BYTES(ctx));
+            sink_literal(&ctx->out, "<div id=\"footnote_");
+            sink_int(&ctx->out, ctx->s.footnote_section);
+            sink_putc(&ctx->out, '_');
+            sink_int(&ctx->out, ctx->s.footnote_counter);
+            sink_literal(&ctx->out, "\">");
+            sink_literal(&ctx->out, "<p>");
+            break;
+          case MK_FOOTNOTE:
+            push_tag(ctx, TAG_FOOTNOTE);
+            ctx->s.footnote_mode = 1;
+            cp += len;
+            while (*cp == ' ')
+              cp++;
+            ctx->s.footnote_counter++;
+            PROBE3(footnote_start, ctx->s.page, ctx->s.footnote_counter,
+              HTML_BYTES(ctx));
+            sink_literal(&ctx->out, "<div id=\"footnote_");
+            sink_int(&ctx->out, ctx->s.footnote_section);
+            sink_putc(&ctx->out, '_');
+            sink_int(&ctx->out, ctx->s.footnote_counter);
+            sink_literal(&ctx->out, "\" role=\"doc-footnote\" data-epub-type=\"footnote\" class=\"footnote\">");
+            sink_literal(&ctx->out, "<p>");
+            sink_literal(&ctx->out, "<a role=\"doc-backlink\" href=\"#ref_");
+            sink_int(&ctx->out, ctx->s.footnote_section);
+            sink_putc(&ctx->out, '_');
+            sink_int(&ctx->out, ctx->s.footnote_counter);
+            sink_literal(&ctx->out, "\">");
+            while ((*cp != '\0') && (*cp != ':'))
+            {
+              sink_putc(&ctx->out, *cp);
+              cp++;
+            }
+            sink_literal(&ctx->out, "</a>"); 
+            break;
+          case MK_COMMENT:
+            push_tag(ctx, TAG_COMMENT);
+            sink_literal(&ctx->out, "<span class=\"comment\">[** ");
+            cp += len;
+            break;
+          case MK_HANDWRITING:
+            push_tag(ctx, TAG_HANDWRITING);
+            sink_literal(&ctx->out, "<span class=\"handwriting\">");
+            cp += len;
+            while (*cp == ' ')
+              cp++;
+            break;
+          default:
+            sink_putc(&ctx->out, *cp);
+            push_tag(ctx, TAG_UNKNOWN);
+            if (!ctx->drama_brackets)
+              html_warning(ctx, DIAG_UNRECOGNIZED, cp,
+                "Unrecognized sequence: %s", cp);
             cp++;
-        }
-        else
-        {
-          fwprintf(outfile, L"%lc", *cp);
-          push_tag(TAG_UNKNOWN);
-          if (!drama_brackets)
-            fwprintf(stderr, L"Unrecognized sequence: %ls\n", cp);
-          cp++;
+            break;
         }
         break;
       case ']':
-        if (sup_mode)
+        if (ctx->s.sup_mode)
         {
-          fwprintf(outfile, L"</sup>");
-          sup_mode = 0;
-          pop_tag();
+          sink_literal(&ctx->out, "</sup>");
+          ctx->s.sup_mode = 0;
+          pop_tag(ctx);
         }
-        switch (pop_tag())
+        switch (pop_tag(ctx))
         {
           case TAG_ITALIC:
           case TAG_BOLD:
           case TAG_SC:
-            fwprintf(stderr, L"Tags don't match\n");
+            html_warning(ctx, DIAG_TAGS_MISMATCH, cp, "Tags don't match");
             break;
           case TAG_COMMENT:
-            fwprintf(outfile, L"]</span>");
+            sink_literal(&ctx->out, "]</span>");
             break;
           case TAG_SIDENOTE:
-            sidenote_mode = 0;
+            ctx->s.sidenote_mode = 0;
             break;
           case TAG_FOOTNOTE:
             /* The footnote class is handled in gutf.c, not here. */
-            footnote_mode = 0;
+            ctx->s.footnote_mode = 0;
+            PROBE3(footnote_end, ctx->s.page, ctx->s.footnote_counter,
+              HTML_BYTES(ctx));
             break;
           case TAG_HANDWRITING:
-            fwprintf(outfile, L"</span>");
+            sink_literal(&ctx->out, "</span>");
             break;
           case TAG_GREEK:
-            flush_greek(outfile);
-            greek_mode = 0;
+            flush_greek(ctx);
+            ctx->s.greek_mode = 0;
+            PROBE3(greek_end, ctx->s.page, ctx->line, HTML_BYTES(ctx));
             break;
           case TAG_ILLUSTRATION:
             break;
           case TAG_UNKNOWN:
           default:
-            fwprintf(outfile, L"%lc", *cp);
+            sink_putc(&ctx->out, *cp);
             break;
         }
         cp++;
         break;
       case '}':
-        if (sup_mode && (top_tag() == TAG_SUPERSCRIPT))
+        if (ctx->s.sup_mode && (top_tag(ctx) == TAG_SUPERSCRIPT))
         {
-          fwprintf(outfile, L"</sup>");
-          pop_tag();
-          sup_mode = 0;
+          sink_literal(&ctx->out, "</sup>");
+          pop_tag(ctx);
+          ctx->s.sup_mode = 0;
         }
-        else if (sub_mode && (top_tag() == TAG_SUBSCRIPT))
+        else if (ctx->s.sub_mode && (top_tag(ctx) == TAG_SUBSCRIPT))
         {
-          fwprintf(outfile, L"</sub>");
-          pop_tag();
-          sub_mode = 0;
+          sink_literal(&ctx->out, "</sub>");
+          pop_tag(ctx);
+          ctx->s.sub_mode = 0;
         }
-        else if (greek_mode)
-          write_greek_char(outfile, *cp);
+        else if (ctx->s.greek_mode)
+          write_greek_char(ctx, *cp);
         else
-          fputwc(*cp, outfile);
+          sink_putc(&ctx->out, *cp);
         cp++;
         break;
+      /*
+       * Curly quotes are valid in HTML, but can be escaped if we
+       * want the file to be ISO LATIN 1 only.
+       */
+      case 0xe2:
+        if ((quote = curly_quote(cp)) != NULL)
+        {
+          if (ctx->use_html_entities)
+            sink_puts(&ctx->out, quote);
+          else
+            sink_write(&ctx->out, cp, 3);
+          cp += 3;
+          break;
+        }
+        /* FALLTHROUGH */
       default:
         /* Punctuation or white space ends a superscript */
-        if (sup_mode && (top_tag() == TAG_SUPERSCRIPT1) &&
+        if (ctx->s.sup_mode && (top_tag(ctx) == TAG_SUPERSCRIPT1) &&
           ((*cp == ' ') || (*cp == '.') || (*cp == ',')
           || (*cp == '?') || (*cp == '!')))
         {
-          fwprintf(outfile, L"</sup>");
-          sup_mode = 0;
-          pop_tag();
+          sink_literal(&ctx->out, "</sup>");
+          ctx->s.sup_mode = 0;
+          pop_tag(ctx);
         }
 
-        if (greek_mode)
-          write_greek_char(outfile, *cp);
+        if (ctx->s.greek_mode && !ctx->s.sup_mode)
+        {
+          /* Transliterate a run of Greek in one go */
+          len = greek_run(cp);
+          STATS_COUNT(ctx->stats, STAT_GREEK_CHARS, utf8_length(cp, len));
+          STATS_START(ctx->stats, t1);
+          if ((space = sink_space(&ctx->out, TRANSLIT_SPACE(len))) != NULL)
+            ctx->out.len += transliterate_span(&ctx->s.greek_state, cp, len,
+              space, ctx);
+          STATS_STOP(ctx->stats, STAT_T_GREEK, t1);
+          cp += len;
+        }
+        else if (ctx->s.greek_mode)
+          write_greek_char(ctx, utf8_decode(&cp));
+        else if (ctx->s.sup_mode)
+        {
+          sink_putc(&ctx->out, *cp);
+          cp++;
+        }
         else
-          fwprintf(outfile, L"%lc", *cp);
-        cp++;
+        {
+          /* Copy a run of ordinary text in one go */
+          if (ctx->scan_only)
+            cp += plain_length(cp);
+          else
+            cp += copy_plain(&ctx->out, cp);
+        }
       }
   }
-  if (sup_mode)
+  if (ctx->s.sup_mode)
   {
-    fwprintf(outfile, L"</sup>");
-    if (top_tag() == TAG_SUPERSCRIPT1)
-      pop_tag();
+    sink_literal(&ctx->out, "</sup>");
+    if (top_tag(ctx) == TAG_SUPERSCRIPT1)
+      pop_tag(ctx);
     else
-      fwprintf(stderr, L"Tags don't match\n");
+      html_warning(ctx, DIAG_TAGS_MISMATCH, cp, "Tags don't match");
 
-    sup_mode = 0;
+    ctx->s.sup_mode = 0;
   }
+  STATS_STOP(ctx->stats, STAT_T_WRITE_LINE, t0);
 }
 
-void write_poetry_line(FILE *outfile, wchar_t *str)
+void write_poetry_line(struct dp_context *ctx, char *str)
 {
-  wchar_t lbuff[1024];
   int spaces;
-  int len;
   int i;
-  wchar_t *cp;
-  wchar_t *right;
-  wchar_t *left;
+  char *cp;
+  char *right;
+  char save;
 
   spaces = 0;
   cp = str;
-  while (*cp == L' ')
+  while (*cp == ' ')
   {
     spaces++;
     cp++;
   }
 
-  right = wcsstr(cp, L"      ");
+  right = strstr(cp, "      ");
+
+  for (i=0;i<spaces;i++)
+    sink_literal(&ctx->out, "&nbsp;&nbsp;");
+
+  /* Split the line in place rather than copying the left part */
   if (right)
   {
-    len = right-cp;
-    if (len >= sizeof(lbuff))
-    {
-      fwprintf(stderr, L"Left part of line too long\n");
-      len = sizeof(lbuff)-1;
-    }
-    wcsncpy(lbuff, cp, len);
-    lbuff[len] = L'\0';
-    left = lbuff;
-
-    while (*right == L' ')
+    save = *right;
+    *right = '\0';
+    write_line(ctx, cp);
+    *right = save;
+    while (*right == ' ')
       right++;
   }
   else
   {
-    left = cp;
+    write_line(ctx, cp);
   }
 
-  for (i=0;i<spaces;i++)
-    fwprintf(outfile, L"&nbsp;&nbsp;");
-  write_line(outfile, left);
-
   if (right)
   {
     /* NB: Put in a space between the end of the first part of the line
      * and the line number.
      */
-    fwprintf(outfile, L" <span class=\"rmn\">");
-    write_line(outfile, right);
-    fwprintf(outfile, L"</span>");
+    sink_literal(&ctx->out, " <span class=\"rmn\">");
+    write_line(ctx, right);
+    sink_literal(&ctx->out, "</span>");
   }
 
   /* In drama, stage directions start with an opening square bracket
    * that has no matching close bracket.
    */
-  if (drama_brackets && (top_tag() == TAG_UNKNOWN))
+  if (ctx->drama_brackets && (top_tag(ctx) == TAG_UNKNOWN))
   {
-    pop_tag();
+    pop_tag(ctx);
   }
-  fwprintf(outfile, L"<br>");
+  sink_literal(&ctx->out, "<br>");
 }
 
-void finish_drama_bracket()
+void finish_drama_bracket(struct dp_context *ctx)
 {
-  if (top_tag() == TAG_UNKNOWN)
+  if (top_tag(ctx) == TAG_UNKNOWN)
   {
-    pop_tag();
+    pop_tag(ctx);
   }
 }
@@ -0,0 +1,405 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * pipe.c - run several of the tools as one process
+ *
+ * Each stage is given its input one line at a time and hands its output
+ * lines to the next stage, instead of going through a shell pipe. Each
+ * line is given a line ending, as the stand-alone tools would read it, so
+ * the output is the same as running the tools in a pipeline.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dptools.h"
+#include "pipe.h"
+#include "trace.h"
+
+#define MAX_ARGS 32
+
+typedef void (*line_fn)(void *ctx, char *buff);
+typedef void (*end_fn)(void *ctx);
+typedef int (*option_fn)(void *ctx, int c, char *arg);
+
+struct stage_type {
+  char *name;
+  size_t size; /* Size of the context */
+  void (*init)(void *ctx);
+  char *options;
+  option_fn option;
+  line_fn line;
+  end_fn end;
+  end_fn begin;
+  void (*set_output)(void *ctx, FILE *outfile); /* NULL for line stages */
+  void (*set_errors)(void *ctx, FILE *errfile); /* NULL if it uses stderr */
+};
+
+struct stage {
+  struct stage_type *type;
+  void *ctx;
+  struct stage *next;
+  struct stage *prev;
+  char *buff; /* A copy of the line, which the stage may change */
+  size_t size;
+  int64_t ns; /* For --trace: time in this stage on this page */
+};
+
+struct pipeline {
+  FILE *outfile;
+  FILE *errfile;
+  struct stage *first;
+  struct stage *last;
+  uint64_t page_start; /* For --trace */
+};
+
+void emit_to_file(void *arg, char *line)
+{
+  fprintf((FILE *) arg, "%s\n", line);
+}
+
+void emit_to_file_crlf(void *arg, char *line)
+{
+  fprintf((FILE *) arg, "%s\r\n", line);
+}
+
+/*
+ * The HTML and text back ends write to a file, so they must be last.
+ */
+
+static void html_output(void *ctx, FILE *outfile)
+{
+  ((struct dp_context *) ctx)->outfile = outfile;
+}
+
+static void html_errors(void *ctx, FILE *errfile)
+{
+  ((struct dp_context *) ctx)->errfile = errfile;
+}
+
+static void txt_output(void *ctx, FILE *outfile)
+{
+  ((struct txt_context *) ctx)->outfile = outfile;
+}
+
+static void txt_errors(void *ctx, FILE *errfile)
+{
+  ((struct txt_context *) ctx)->errfile = errfile;
+}
+
+static void quotes_errors(void *ctx, FILE *errfile)
+{
+  ((struct quotes_context *) ctx)->errfile = errfile;
+}
+
+static struct stage_type stage_types[] = {
+  {"strip", sizeof(struct strip_context), (void (*)(void *)) strip_context_init,
+    "", NULL, (line_fn) strip_line,
+    (end_fn) strip_end, NULL, NULL, NULL},
+  {"comments", sizeof(struct comments_context),
+    (void (*)(void *)) comments_context_init,
+    "", NULL, (line_fn) comments_line, NULL, NULL, NULL, NULL},
+  {"foot", sizeof(struct foot_context), (void (*)(void *)) foot_context_init,
+    FOOT_OPTIONS, (option_fn) foot_option, (line_fn) foot_line,
+    (end_fn) foot_end, NULL, NULL, NULL},
+  {"quotes", sizeof(struct quotes_context),
+    (void (*)(void *)) quotes_context_init,
+    QUOTES_OPTIONS, (option_fn) quotes_option, (line_fn) quotes_line,
+    (end_fn) quotes_end, NULL, NULL, quotes_errors},
+  {"html", sizeof(struct dp_context), (void (*)(void *)) context_init,
+    HTML_OPTIONS, (option_fn) html_option, (line_fn) html_line,
+    (end_fn) html_end, (end_fn) html_begin, html_output, html_errors},
+  {"txt", sizeof(struct txt_context), (void (*)(void *)) txt_context_init,
+    TXT_OPTIONS, (option_fn) txt_option, (line_fn) txt_line,
+    (end_fn) txt_end, NULL, txt_output, txt_errors},
+  {NULL, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL}
+};
+
+/*
+ * Every line stage starts with emit and emit_arg, so they can be set
+ * without knowing which kind of stage it is.
+ */
+
+struct line_stage {
+  emit_fn emit;
+  void *emit_arg;
+};
+
+/*
+ * Give a line to a stage. With --trace, the time each stage takes is
+ * added up, less the time taken by the stages it passes its lines on to.
+ * The stages work a line at a time, each inside the one before, so this
+ * is reported per page rather than as spans.
+ */
+
+static void stage_call(struct stage *s, char *buff)
+{
+uint64_t start;
+int64_t ns;
+
+  if (!trace_enabled)
+  {
+    s->type->line(s->ctx, buff);
+    return;
+  }
+
+  start = trace_now();
+  s->type->line(s->ctx, buff);
+  ns = trace_now() - start;
+  s->ns += ns;
+  if (s->prev)
+    s->prev->ns -= ns;
+}
+
+/*
+ * Record how long each stage spent on the page that has just ended.
+ */
+
+static void trace_stages(struct pipeline *p)
+{
+struct stage *s;
+
+  for (s = p->first; s; s = s->next)
+  {
+    trace_counter(s->type->name, p->page_start, "us", s->ns / 1000);
+    s->ns = 0;
+  }
+  p->page_start = trace_now();
+}
+
+/*
+ * Give a line to a stage, as fgets would have read it from a file.
+ */
+
+static void stage_line(struct stage *s, char *line)
+{
+size_t len;
+
+  len = strlen(line);
+  if (buffer_reserve(&s->buff, &s->size, len+2) < 0)
+    return;
+  memcpy(s->buff, line, len);
+  s->buff[len] = '\n';
+  s->buff[len+1] = '\0';
+  stage_call(s, s->buff);
+}
+
+static void pipe_emit(void *arg, char *line)
+{
+  stage_line(arg, line);
+}
+
+struct pipeline *pipe_new(FILE *outfile)
+{
+struct pipeline *p;
+
+  p = malloc(sizeof(struct pipeline));
+  if (p == NULL)
+    return NULL;
+  p->outfile = outfile;
+  p->errfile = stderr;
+  p->first = NULL;
+  p->last = NULL;
+  p->page_start = 0;
+  return p;
+}
+
+/*
+ * Add a stage, given as the tool name followed by its options,
+ * e.g. "foot -N". Returns -1 if the stage is not known, has bad options,
+ * or comes after a stage that must be last.
+ */
+
+int pipe_add(struct pipeline *p, char *spec)
+{
+struct stage_type *type;
+struct stage *s;
+char *copy;
+char *argv[MAX_ARGS + 1];
+int argc = 0;
+char *word;
+int c;
+
+  copy = strdup(spec);
+  if (copy == NULL)
+    return -1;
+  for (word = strtok(copy, " \t"); word && (argc < MAX_ARGS);
+    word = strtok(NULL, " \t"))
+    argv[argc++] = word;
+  argv[argc] = NULL;
+
+  if (argc == 0)
+  {
+    free(copy);
+    return -1;
+  }
+
+  for (type = stage_types; type->name; type++)
+    if (strcmp(type->name, argv[0]) == 0)
+      break;
+
+  if ((type->name == NULL) || (p->last && p->last->type->set_output))
+  {
+    fprintf(stderr, "dppipe: bad stage: %s\n", spec);
+    free(copy);
+    return -1;
+  }
+
+  s = malloc(sizeof(struct stage));
+  if (s)
+    s->ctx = malloc(type->size);
+  if ((s == NULL) || (s->ctx == NULL))
+  {
+    free(s);
+    free(copy);
+    return -1;
+  }
+  s->type = type;
+  s->next = NULL;
+  s->prev = p->last;
+  s->buff = NULL;
+  s->size = 0;
+  s->ns = 0;
+  type->init(s->ctx);
+
+  optind = 0;
+  while ((c = getopt(argc, argv, type->options)) > -1)
+  {
+    if ((type->option == NULL) || (type->option(s->ctx, c, optarg) < 0))
+    {
+      fprintf(stderr, "dppipe: bad stage: %s\n", spec);
+      free(s->ctx);
+      free(s);
+      free(copy);
+      return -1;
+    }
+  }
+  free(copy);
+
+  if (p->last)
+  {
+    ((struct line_stage *) p->last->ctx)->emit = pipe_emit;
+    ((struct line_stage *) p->last->ctx)->emit_arg = s;
+    p->last->next = s;
+  }
+  else
+    p->first = s;
+  p->last = s;
+
+  return 0;
+}
+
+/*
+ * Send the warnings of the stages that have an errfile somewhere other
+ * than stderr. Must be called before pipe_begin.
+ */
+
+void pipe_errors(struct pipeline *p, FILE *errfile)
+{
+  p->errfile = errfile;
+}
+
+/*
+ * Called once all the stages have been added, before the first line.
+ */
+
+void pipe_begin(struct pipeline *p)
+{
+struct stage *s = p->last;
+
+  if (s == NULL)
+    return;
+
+  if (s->type->set_output)
+    s->type->set_output(s->ctx, p->outfile);
+  else
+    ((struct line_stage *) s->ctx)->emit_arg = p->outfile;
+
+  for (s = p->first; s; s = s->next)
+  {
+    if (s->type->set_errors)
+      s->type->set_errors(s->ctx, p->errfile);
+    if (s->type->begin)
+      s->type->begin(s->ctx);
+  }
+  TRACE_START(p->page_start);
+}
+
+void pipe_line(struct pipeline *p, char *buff)
+{
+  if (p->first == NULL)
+    return;
+  if (trace_enabled && (strncmp(buff, "-----File", 9) == 0))
+    trace_stages(p);
+  stage_call(p->first, buff);
+}
+
+/*
+ * Flush each stage in turn, so that anything a stage was holding back
+ * (e.g. footnotes) goes through the stages after it.
+ */
+
+void pipe_end(struct pipeline *p)
+{
+struct stage *s;
+uint64_t start;
+
+  for (s = p->first; s; s = s->next)
+  {
+    if (s->type->end)
+    {
+      TRACE_START(start);
+      s->type->end(s->ctx);
+      if (start)
+        s->ns += trace_now() - start;
+    }
+  }
+
+  /* The last page, then zero, so the counters stop at the end */
+  if (trace_enabled)
+  {
+    trace_stages(p);
+    trace_stages(p);
+  }
+}
+
+void pipe_free(struct pipeline *p)
+{
+struct stage *s;
+struct stage *next;
+
+  for (s = p->first; s; s = next)
+  {
+    next = s->next;
+    free(s->buff);
+    free(s->ctx);
+    free(s);
+  }
+  free(p);
+}
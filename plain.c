@@ -0,0 +1,323 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * plain.c - copy runs of ordinary text into HTML
+ *
+ * Most of a DP line is letters and spaces that write_line copies as they
+ * are. copy_plain finds where the next piece of markup starts and copies
+ * everything up to it in one go, escaping '"', '&' and '>' as it goes.
+ * On x86-64 this is done 16 or 32 bytes at a time, using AVX2 if the CPU
+ * has it and SSE2 if not.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "sink.h"
+#include "plain.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PLAIN_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * A run ends at markup, a dash or the first byte of a curly quote, which
+ * write_line has to look at itself.
+ */
+
+#define PLAIN 0
+#define ESCAPE 1
+#define STOP 2
+
+static const unsigned char plain_class[256] = {
+  [0] = STOP,
+  ['"'] = ESCAPE, ['&'] = ESCAPE, ['>'] = ESCAPE,
+  ['^'] = STOP, ['_'] = STOP, ['<'] = STOP, ['-'] = STOP,
+  ['['] = STOP, [']'] = STOP, ['}'] = STOP, [0xe2] = STOP
+};
+
+static void write_escape(struct sink *s, int c)
+{
+  switch (c)
+  {
+    case '"':
+      sink_literal(s, "&quot;");
+      break;
+    case '&':
+      sink_literal(s, "&amp;");
+      break;
+    case '<':
+      sink_literal(s, "&lt;");
+      break;
+    case '>':
+      sink_literal(s, "&gt;");
+      break;
+    default:
+      sink_putc(s, c);
+      break;
+  }
+}
+
+static int copy_plain_scalar(struct sink *s, char *str)
+{
+unsigned char *cp = (unsigned char *) str + 1;
+unsigned char *run = cp;
+
+  while (1)
+  {
+    switch (plain_class[*cp])
+    {
+      case ESCAPE:
+        sink_write(s, (char *) run, cp - run);
+        write_escape(s, *cp);
+        cp++;
+        run = cp;
+        break;
+      case STOP:
+        sink_write(s, (char *) run, cp - run);
+        return (char *) cp - str;
+      default:
+        cp++;
+        break;
+    }
+  }
+}
+
+#ifdef PLAIN_SIMD
+
+/*
+ * The vector versions read whole aligned blocks, which can run past the
+ * terminating null but never onto another page. AddressSanitizer would
+ * still object, as would ThreadSanitizer when another thread is working
+ * on the next line, so they aren't instrumented.
+ */
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define NO_ASAN __attribute__((no_sanitize_address))
+#endif
+#endif
+#if !defined(NO_ASAN) && defined(__SANITIZE_ADDRESS__)
+#define NO_ASAN __attribute__((no_sanitize_address))
+#endif
+#ifndef NO_ASAN
+#define NO_ASAN
+#endif
+
+#if defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define NO_TSAN __attribute__((no_sanitize("thread")))
+#endif
+#endif
+#if !defined(NO_TSAN) && defined(__SANITIZE_THREAD__)
+#define NO_TSAN __attribute__((no_sanitize_thread))
+#endif
+#ifndef NO_TSAN
+#define NO_TSAN
+#endif
+
+/*
+ * Process the bits of a block's masks in order. Returns the number of
+ * bytes consumed if a stop was found, or 0 to go on to the next block.
+ */
+
+static int finish_block(struct sink *s, char *str, unsigned char **runp,
+  unsigned char *block, uint32_t stop, uint32_t esc)
+{
+unsigned char *cp;
+int bit;
+
+  while (stop | esc)
+  {
+    bit = __builtin_ctz(stop | esc);
+    cp = block + bit;
+    sink_write(s, (char *) *runp, cp - *runp);
+    if (stop & (1u << bit))
+      return (char *) cp - str;
+    write_escape(s, *cp);
+    *runp = cp + 1;
+    esc &= esc - 1;
+  }
+  return 0;
+}
+
+static NO_ASAN NO_TSAN int copy_plain_sse2(struct sink *s, char *str)
+{
+unsigned char *run = (unsigned char *) str + 1;
+unsigned char *block;
+__m128i v;
+__m128i stop;
+__m128i esc;
+uint32_t stop_mask;
+uint32_t esc_mask;
+int skip;
+int n;
+
+  block = (unsigned char *) ((uintptr_t) run & ~(uintptr_t) 15);
+  skip = run - block;
+  while (1)
+  {
+    v = _mm_load_si128((__m128i *) block);
+    stop = _mm_or_si128(
+      _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_setzero_si128()),
+          _mm_cmpeq_epi8(v, _mm_set1_epi8('^'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+          _mm_cmpeq_epi8(v, _mm_set1_epi8('<')))),
+      _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')),
+          _mm_cmpeq_epi8(v, _mm_set1_epi8('['))),
+        _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(']')),
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('}'))),
+          _mm_cmpeq_epi8(v, _mm_set1_epi8((char) 0xe2)))));
+    esc = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('&')),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('>'))));
+    stop_mask = (_mm_movemask_epi8(stop) >> skip) << skip;
+    esc_mask = (_mm_movemask_epi8(esc) >> skip) << skip;
+    skip = 0;
+    if ((stop_mask | esc_mask) &&
+      ((n = finish_block(s, str, &run, block, stop_mask, esc_mask)) > 0))
+      return n;
+    block += 16;
+  }
+}
+
+__attribute__((target("avx2")))
+static NO_ASAN NO_TSAN int copy_plain_avx2(struct sink *s, char *str)
+{
+unsigned char *run = (unsigned char *) str + 1;
+unsigned char *block;
+__m256i v;
+__m256i stop;
+__m256i esc;
+uint32_t stop_mask;
+uint32_t esc_mask;
+int skip;
+int n;
+
+  block = (unsigned char *) ((uintptr_t) run & ~(uintptr_t) 31);
+  skip = run - block;
+  while (1)
+  {
+    v = _mm256_load_si256((__m256i *) block);
+    stop = _mm256_or_si256(
+      _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()),
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('^'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')),
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')))),
+      _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')),
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('['))),
+        _mm256_or_si256(
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(']')),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}'))),
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char) 0xe2)))));
+    esc = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>'))));
+    stop_mask = ((uint32_t) _mm256_movemask_epi8(stop) >> skip) << skip;
+    esc_mask = ((uint32_t) _mm256_movemask_epi8(esc) >> skip) << skip;
+    skip = 0;
+    if ((stop_mask | esc_mask) &&
+      ((n = finish_block(s, str, &run, block, stop_mask, esc_mask)) > 0))
+      return n;
+    block += 32;
+  }
+}
+
+#endif
+
+static int copy_plain_resolve(struct sink *s, char *str);
+
+static int (*copy_plain_fn)(struct sink *s, char *str) = copy_plain_resolve;
+
+/*
+ * Chosen on the first call. Threads that get here together all choose
+ * the same one, so it doesn't matter which of them stores it.
+ */
+
+static int copy_plain_resolve(struct sink *s, char *str)
+{
+int (*fn)(struct sink *s, char *str);
+
+  fn = copy_plain_scalar;
+#ifdef PLAIN_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    fn = copy_plain_avx2;
+  else
+    fn = copy_plain_sse2;
+#endif
+  __atomic_store_n(&copy_plain_fn, fn, __ATOMIC_RELAXED);
+  return fn(s, str);
+}
+
+/*
+ * Copy str[0] and the ordinary text after it to s, up to the next STOP
+ * byte or the end of the string. Returns the number of bytes of str used.
+ */
+
+int copy_plain(struct sink *s, char *str)
+{
+  write_escape(s, (unsigned char) str[0]);
+  return __atomic_load_n(&copy_plain_fn, __ATOMIC_RELAXED)(s, str);
+}
+
+/*
+ * How much copy_plain would use of str, without copying any of it, for
+ * following the state of a book without making its HTML. The set is the
+ * STOP bytes of plain_class; dpcheck makes sure the two agree.
+ */
+
+int plain_length(char *str)
+{
+  return strcspn(str + 1, "^_<-[]}\xe2") + 1;
+}
+
+int plain_versions(struct plain_version *v)
+{
+int n = 0;
+
+  v[n].name = "scalar";
+  v[n++].copy = copy_plain_scalar;
+#ifdef PLAIN_SIMD
+  v[n].name = "sse2";
+  v[n++].copy = copy_plain_sse2;
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    v[n].name = "avx2";
+    v[n++].copy = copy_plain_avx2;
+  }
+#endif
+  return n;
+}
@@ -0,0 +1,71 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * probes.h - static probes for bpftrace, perf and SystemTap
+ *
+ * With <sys/sdt.h>, each probe is a nop in the code and a note in the ELF
+ * file, so it costs nothing unless a tracer is attached to it. Without
+ * it, or with DP_PROBES set to 0, the probes compile away. For example:
+ *
+ *   bpftrace -e 'usdt:./dphtml:dptools:html_page { @[arg0] = nsecs; }'
+ *
+ * The tools are linked with libdptools.a, so the probes are in each tool.
+ *
+ * The probes, all in the dptools provider, and their arguments:
+ *
+ *   html_page                  page, line, bytes of output so far
+ *   txt_page                   page, line, bytes of output so far
+ *   foot_page                  page, footnotes so far, bytes of notes queued
+ *   paragraph_start, _end      page, line, bytes of output so far
+ *   footnote_start             page, footnote number, bytes of output
+ *   footnote_end               page, footnote number, bytes of output
+ *   greek_start, greek_end     page, line, bytes of output so far
+ *   flush_footnotes            page, footnotes so far, bytes of notes queued
+ *
+ * The HTML byte counts start again at each chunk with -j.
+ */
+
+#ifndef DP_PROBES
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define DP_PROBES 1
+#endif
+#endif
+#endif
+
+#ifndef DP_PROBES
+#define DP_PROBES 0
+#endif
+
+#if DP_PROBES
+#include <sys/sdt.h>
+#define PROBE2(name, a, b) DTRACE_PROBE2(dptools, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(dptools, name, a, b, c)
+#else
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#endif
@@ -0,0 +1,181 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * quotes.c - Turn straight double quotes into directional quotes
+ *
+ * Project Gutenberg Distributed Proofreaders proofreads quotation marks
+ * as straight quotes and then (optionally) they are converted into
+ * directional quotation marks during post-processing.
+ *
+ * This filter converts straight quote marks into directional quote marks,
+ * issuing a warning message (based on surrounding white space) if the
+ * conversion seems incorrect. The warnings should be checked manually and
+ * fixed up if necessary.
+ *
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "dptools.h"
+#include "diag.h"
+#include "utf8.h"
+
+void quotes_context_init(struct quotes_context *ctx)
+{
+  memset(ctx, 0, sizeof(struct quotes_context));
+  ctx->emit = emit_to_file;
+  ctx->emit_arg = stdout;
+  ctx->errfile = stderr;
+  ctx->diag_max = DIAG_MAX;
+}
+
+static void quotes_warning(struct quotes_context *ctx, int code, char *buff,
+  char *cp, char *msg)
+{
+  if (ctx->diag == NULL)
+    ctx->diag = diag_new(ctx->errfile, ctx->diag_format, ctx->diag_max);
+  diag_report(ctx->diag, code, ctx->page, ctx->line, cp - buff + 1, buff,
+    "%s", msg);
+}
+
+/*
+ * Handle one of the QUOTES_OPTIONS. Returns -1 if c is not one of them.
+ */
+
+int quotes_option(struct quotes_context *ctx, int c, char *arg)
+{
+  switch (c)
+  {
+    case 'p':
+      ctx->old_style = 1;
+      break;
+    default:
+      return -1;
+  }
+  return 0;
+}
+
+/*
+ * Process one line of input, as read by reader_line.
+ */
+
+void quotes_line(struct quotes_context *ctx, char *buff)
+{
+char *out;
+char *ptr;
+char *out_ptr;
+int len;
+
+  len = strlen(buff);
+
+  /*
+   * Strip <CR><LF> from the end of the line.
+   * Note that the file may have DOS, not UNIX, <CR><LF> convention.
+   */
+
+  if ((len > 0) && (buff[len-1] == '\n'))
+  {
+    buff[len-1] = '\0';
+    len--;
+  }
+  if ((len > 0) && (buff[len-1] == '\r'))
+  {
+    buff[len-1] = '\0';
+    len--;
+  }
+
+  /* Strip trailing spaces */
+
+  while ((len > 0) && (buff[len-1] == ' '))
+  {
+    buff[len-1] = '\0';
+    len--;
+  }
+
+  ctx->line++;
+  if (len == 0)
+    ctx->inside_quotes = 0;
+  else if (strncmp(buff, "-----File", 9) == 0)
+    ctx->page++;
+
+  /* Each quote becomes three bytes */
+  if (buffer_reserve(&ctx->out, &ctx->out_size, 3*len+1) < 0)
+    return;
+  out = ctx->out;
+  ptr = buff;
+  out_ptr = out;
+
+  while (*ptr)
+  {
+    if (*ptr == '"')
+    {
+      if (ctx->inside_quotes)
+      {
+        out_ptr += utf8_encode(out_ptr, 0x201d);
+        ctx->inside_quotes = 0;
+        if ((ptr == buff) || (ptr[-1] == ' '))
+        {
+          quotes_warning(ctx, DIAG_CLOSE_QUOTE, buff, ptr,
+            "Smart quotes puts close quote after a space");
+        }
+      }
+      else
+      {
+        out_ptr += utf8_encode(out_ptr, 0x201c);
+        ctx->inside_quotes = 1;
+        if ((ptr[1] == '\0') || (ptr[1] == ' '))
+        {
+          quotes_warning(ctx, DIAG_OPEN_QUOTE, buff, ptr,
+            "Smart quotes puts open quote before a space");
+        }
+      } 
+    }
+    else
+    {
+      *out_ptr++ = *ptr;
+    }
+
+    ptr++;
+  }
+  *out_ptr = 0;
+  ctx->emit(ctx->emit_arg, out);
+
+  if (ctx->old_style)
+    ctx->inside_quotes = 0;
+}
+
+void quotes_end(struct quotes_context *ctx)
+{
+  diag_end(ctx->diag);
+  ctx->diag = NULL;
+  free(ctx->out);
+  ctx->out = NULL;
+  ctx->out_size = 0;
+}
@@ -0,0 +1,237 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * reader.c - read lines of any length
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "arena.h"
+#include "mapfile.h"
+#include "reader.h"
+#include "trace.h"
+
+static int reader_open(struct reader *r, FILE *infile, int copy)
+{
+  r->infile = infile;
+  arena_init(&r->arena);
+  r->buff = malloc(READER_BUFF);
+  r->pos = 0;
+  r->end = 0;
+  r->partial = NULL;
+  r->partial_len = 0;
+  r->partial_size = 0;
+  r->next = 0;
+  r->unterminated = 0;
+  r->error = 0;
+  if (copy)
+  {
+    r->mapped = (copy_file(&r->map, infile) == 0);
+    if (!r->mapped && errno)
+      r->error = errno;
+  }
+  else
+    r->mapped = (map_file(&r->map, infile) == 0);
+  if ((r->buff == NULL) && !r->mapped)
+    r->error = ENOMEM;
+  return (r->buff == NULL) ? -1 : 0;
+}
+
+int reader_init(struct reader *r, FILE *infile)
+{
+  return reader_open(r, infile, 0);
+}
+
+/*
+ * As reader_init, but a regular file is read into memory rather than
+ * mapped, for one that may be rewritten while it is being read.
+ */
+
+int reader_copy(struct reader *r, FILE *infile)
+{
+  return reader_open(r, infile, 1);
+}
+
+/*
+ * Keep the start of a line that runs past the end of buff.
+ */
+
+static int save_partial(struct reader *r, char *str, size_t len)
+{
+size_t size;
+char *p;
+
+  if (r->partial_len + len > r->partial_size)
+  {
+    size = r->partial_size ? r->partial_size : READER_BUFF;
+    while (size < r->partial_len + len)
+      size *= 2;
+    p = realloc(r->partial, size);
+    if (p == NULL)
+    {
+      r->error = ENOMEM;
+      return -1;
+    }
+    r->partial = p;
+    r->partial_size = size;
+  }
+  memcpy(r->partial + r->partial_len, str, len);
+  r->partial_len += len;
+  return 0;
+}
+
+/*
+ * Read the next line into buff, or partial if it runs past the end of
+ * buff. Returns where it starts, or NULL at the end of the file.
+ */
+
+static char *read_line(struct reader *r, size_t *lenp)
+{
+char *start;
+char *nl;
+size_t len;
+uint64_t t;
+
+  if (r->buff == NULL)
+    return NULL;
+
+  r->partial_len = 0;
+  while (1)
+  {
+    if (r->pos == r->end)
+    {
+      r->pos = 0;
+      TRACE_START(t);
+      r->end = fread(r->buff, 1, READER_BUFF, r->infile);
+      TRACE_END(t, "io", "read", "bytes", r->end);
+      if ((r->end == 0) && ferror(r->infile))
+      {
+        r->error = errno ? errno : EIO;
+        return NULL;
+      }
+      if (r->end == 0)
+      {
+        /* The last line might not have a line ending */
+        if (r->partial_len == 0)
+          return NULL;
+        *lenp = r->partial_len;
+        return r->partial;
+      }
+    }
+
+    start = r->buff + r->pos;
+    nl = memchr(start, '\n', r->end - r->pos);
+    if (nl)
+    {
+      len = nl + 1 - start;
+      r->pos += len;
+      if (r->partial_len > 0)
+      {
+        if (save_partial(r, start, len) < 0)
+          return NULL;
+        start = r->partial;
+        len = r->partial_len;
+      }
+      *lenp = len;
+      return start;
+    }
+
+    if (save_partial(r, start, r->end - r->pos) < 0)
+      return NULL;
+    r->pos = r->end;
+  }
+}
+
+/*
+ * Returns the next line, or NULL at the end of the file. If lenp is not
+ * NULL, the length of the line is stored there.
+ */
+
+char *reader_line(struct reader *r, size_t *lenp)
+{
+char *start;
+char *line;
+size_t len;
+
+  if (r->mapped)
+  {
+    r->unterminated = (r->next + 1 == r->map.nlines) && (r->map.tail != NULL);
+    start = mapped_span(&r->map, r->next++, &len);
+  }
+  else
+  {
+    start = read_line(r, &len);
+    r->unterminated = start && (start[len-1] != '\n');
+  }
+  if (start == NULL)
+    return NULL;
+
+  /* A new page: the lines of the previous page are no longer needed */
+  if ((len >= 9) && (strncmp(start, "-----File", 9) == 0))
+    arena_reset(&r->arena);
+
+  line = arena_alloc(&r->arena, len+1);
+  if (line == NULL)
+  {
+    r->error = ENOMEM;
+    return NULL;
+  }
+  memcpy(line, start, len);
+  line[len] = '\0';
+
+  if (lenp)
+    *lenp = len;
+  return line;
+}
+
+/*
+ * Call once reader_line has returned NULL. Returns 0 if that was the end
+ * of the file, or -1, having said why on stderr, if reading failed.
+ */
+
+int reader_check(struct reader *r)
+{
+  if (r->error == 0)
+    return 0;
+  fprintf(stderr, "Can't read the input: %s\n", strerror(r->error));
+  return -1;
+}
+
+void reader_free(struct reader *r)
+{
+  if (r->mapped)
+    unmap_file(&r->map);
+  r->mapped = 0;
+  arena_free(&r->arena);
+  free(r->buff);
+  free(r->partial);
+  r->buff = NULL;
+  r->partial = NULL;
+}
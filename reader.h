@@ -0,0 +1,66 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * reader.h - read lines of any length
+ *
+ * Each line is copied into an arena, with its line ending and a
+ * terminating null, just as fgets would have left it. The arena is reset
+ * when a "-----File" page separator is read, so a line stays valid until
+ * the end of its page.
+ *
+ * If the input is a regular file it is mapped instead (or with
+ * reader_copy, read into memory), and lines are copied from the mapping,
+ * without the '\n'.
+ */
+
+#define READER_BUFF 65536
+
+struct reader {
+  FILE *infile;
+  struct arena arena;
+  char *buff;
+  size_t pos;
+  size_t end;
+  char *partial; /* A line that didn't fit in buff */
+  size_t partial_len;
+  size_t partial_size;
+  int mapped;
+  struct mapped_file map;
+  size_t next; /* Line number of the next mapped line */
+  int unterminated; /* Set if the line just returned had no '\n' */
+  int error; /* Why reading stopped early (an errno value), or 0 */
+};
+
+int reader_init(struct reader *r, FILE *infile);
+
+int reader_copy(struct reader *r, FILE *infile);
+
+char *reader_line(struct reader *r, size_t *lenp);
+
+int reader_check(struct reader *r);
+
+void reader_free(struct reader *r);
@@ -0,0 +1,329 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * scan.c - find the markup in a whole book once, for several back ends
+ *
+ * dphtml and dptxt each look for markup as they go. When both outputs
+ * are made from one book, the book is scanned for markup once, and each
+ * back end looks its tokens up in the stream instead of running the
+ * automaton again. The two back ends then run on separate threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "dptools.h"
+#include "markup.h"
+#include "scan.h"
+#include "trace.h"
+
+/*
+ * The next '<' or '[' from cp on, or NULL. memchr is much quicker than
+ * looking at each byte here, as markup is sparse.
+ */
+
+static char *next_markup(char **ltp, char **brp, char *end)
+{
+char *cp;
+
+  if (*ltp && (!*brp || (*ltp < *brp)))
+  {
+    cp = *ltp;
+    *ltp = memchr(cp + 1, '<', end - cp - 1);
+  }
+  else if (*brp)
+  {
+    cp = *brp;
+    *brp = memchr(cp + 1, '[', end - cp - 1);
+  }
+  else
+    cp = NULL;
+  return cp;
+}
+
+/*
+ * Returns -1 if the book is too big for 32-bit offsets, or there isn't
+ * enough memory.
+ */
+
+int scan_book(struct token_stream *ts, struct mapped_file *m)
+{
+char *data = m->data;
+char *end = data + m->size;
+char *lt;
+char *br;
+char *cp;
+size_t max = 0;
+size_t off;
+size_t n = 0;
+size_t p = 0;
+int token;
+int len;
+uint64_t start;
+
+  TRACE_START(start);
+  memset(ts, 0, sizeof(struct token_stream));
+  arena_init(&ts->arena);
+  ts->m = m;
+  if ((m->size > UINT32_MAX) || (m->nlines >= UINT32_MAX))
+    return -1;
+
+  /* Every token starts with '<' or '[', so count those to size the arrays */
+  lt = memchr(data, '<', m->size);
+  br = memchr(data, '[', m->size);
+  while (next_markup(&lt, &br, end))
+    max++;
+
+  ts->kind = arena_alloc(&ts->arena, max + 1);
+  ts->offset = arena_alloc(&ts->arena, (max + 1)*sizeof(uint32_t));
+  ts->length = arena_alloc(&ts->arena, (max + 1)*sizeof(uint32_t));
+  ts->page = arena_alloc(&ts->arena, (max + 1)*sizeof(uint32_t));
+  ts->first = arena_alloc(&ts->arena, (m->nlines + 1)*sizeof(uint32_t));
+  if ((ts->kind == NULL) || (ts->offset == NULL) || (ts->length == NULL) ||
+    (ts->page == NULL) || (ts->first == NULL))
+  {
+    scan_free(ts);
+    return -1;
+  }
+
+  ts->first[0] = 0;
+  if ((m->npages > 0) && (m->pages[0] == 0))
+    p++;
+  lt = memchr(data, '<', m->size);
+  br = memchr(data, '[', m->size);
+  while ((cp = next_markup(&lt, &br, end)) != NULL)
+  {
+    /* Catch up with the line (and page) that cp is on */
+    off = cp - data;
+    while (m->lines[n+1] <= off)
+    {
+      n++;
+      ts->first[n] = ts->ntokens;
+      if ((p < m->npages) && (m->pages[p] == n))
+        p++;
+    }
+
+    /*
+     * The last line may have no '\n' to stop the automaton, so it uses
+     * the copy that has a null.
+     */
+    if ((n + 1 == m->nlines) && m->tail)
+      cp = m->tail + (off - m->lines[n]);
+
+    token = markup_token(cp, &len);
+    if (token == MK_NONE)
+      continue;
+    ts->kind[ts->ntokens] = token;
+    ts->offset[ts->ntokens] = off;
+    ts->length[ts->ntokens] = len;
+    ts->page[ts->ntokens] = p;
+    ts->ntokens++;
+  }
+  while (n < m->nlines)
+    ts->first[++n] = ts->ntokens;
+  TRACE_END(start, "scan", "scan book", "tokens", ts->ntokens);
+  return 0;
+}
+
+void scan_free(struct token_stream *ts)
+{
+  arena_free(&ts->arena);
+  ts->ntokens = 0;
+}
+
+void cursor_line(struct token_cursor *c, size_t n, char *line, size_t len)
+{
+  c->n = n;
+  c->line = line;
+  c->len = len;
+  c->next = c->ts->first[n];
+}
+
+/*
+ * The token at cp, as markup_token would find it. Without a cursor, or
+ * if cp isn't in the cursor's line, the automaton is run after all.
+ */
+
+int cursor_token(struct token_cursor *c, char *cp, int *lenp)
+{
+struct token_stream *ts;
+size_t off;
+size_t i;
+size_t end;
+
+  if ((c == NULL) || (cp < c->line) || (cp >= c->line + c->len))
+    return markup_token(cp, lenp);
+
+  ts = c->ts;
+  off = ts->m->lines[c->n] + (cp - c->line);
+  end = ts->first[c->n + 1];
+
+  /* Lookups usually go forward through the line */
+  i = c->next;
+  if ((i < end) && (ts->offset[i] > off))
+    i = ts->first[c->n];
+  while ((i < end) && (ts->offset[i] < off))
+    i++;
+  c->next = i;
+
+  if ((i == end) || (ts->offset[i] != off))
+    return MK_NONE;
+
+  /* The back end has cut the line short inside the token */
+  if (memchr(cp, '\0', ts->length[i]))
+    return markup_token(cp, lenp);
+
+  *lenp = ts->length[i];
+  return ts->kind[i];
+}
+
+/*
+ * One back end's pass over the book, with its own copy of each line.
+ */
+
+struct back_end {
+  char *name; /* For --trace */
+  struct token_stream *ts;
+  struct token_cursor cursor;
+  void (*line)(void *ctx, char *buff);
+  void (*done)(void *ctx); /* Called on the same thread, after the lines */
+  void *ctx;
+  char *buff;
+  size_t size;
+};
+
+static void *run_back_end(void *arg)
+{
+struct back_end *b = arg;
+struct mapped_file *m = b->ts->m;
+uint64_t start;
+size_t len;
+size_t n;
+
+  TRACE_START(start);
+  for (n = 0; n < m->nlines; n++)
+  {
+    len = m->lines[n+1] - m->lines[n];
+    if (buffer_reserve(&b->buff, &b->size, len + 1) < 0)
+      break;
+    memcpy(b->buff, m->data + m->lines[n], len);
+    b->buff[len] = '\0';
+    cursor_line(&b->cursor, n, b->buff, len);
+    b->line(b->ctx, b->buff);
+  }
+  if (b->done)
+    b->done(b->ctx);
+  TRACE_END(start, "scan", b->name, NULL, 0);
+  return NULL;
+}
+
+static void *back_end_thread(void *arg)
+{
+  trace_thread_name(((struct back_end *) arg)->name);
+  return run_back_end(arg);
+}
+
+static void back_end_init(struct back_end *b, char *name,
+  struct token_stream *ts, void (*line)(void *ctx, char *buff), void *ctx)
+{
+  memset(b, 0, sizeof(struct back_end));
+  b->name = name;
+  b->ts = ts;
+  b->cursor.ts = ts;
+  b->line = line;
+  b->ctx = ctx;
+}
+
+/*
+ * Convert a book to HTML and to plain text at the same time. If it can't
+ * be mapped, each line is read once and given to both back ends in turn.
+ * Returns -1 if the book couldn't all be read.
+ */
+
+int convert_both(struct dp_context *html, struct txt_context *txt,
+  FILE *infile)
+{
+struct token_stream ts;
+struct back_end hb;
+struct back_end tb;
+struct reader r;
+pthread_t thread;
+char *copy = NULL;
+size_t copy_size = 0;
+char *line;
+size_t len;
+int status;
+
+  reader_init(&r, infile);
+  html_begin(html);
+
+  if (r.mapped && (scan_book(&ts, &r.map) == 0))
+  {
+    back_end_init(&hb, "html", &ts, (void (*)(void *, char *)) html_line, html);
+    back_end_init(&tb, "txt", &ts, (void (*)(void *, char *)) txt_line, txt);
+    html->tokens = &hb.cursor;
+    txt->tokens = &tb.cursor;
+    hb.done = (void (*)(void *)) html_trace_end;
+    tb.done = (void (*)(void *)) txt_trace_end;
+
+    if (pthread_create(&thread, NULL, back_end_thread, &hb) == 0)
+    {
+      run_back_end(&tb);
+      pthread_join(thread, NULL);
+    }
+    else
+    {
+      run_back_end(&hb);
+      run_back_end(&tb);
+    }
+
+    html->tokens = NULL;
+    txt->tokens = NULL;
+    free(hb.buff);
+    free(tb.buff);
+    scan_free(&ts);
+  }
+  else
+  {
+    while ((line = reader_line(&r, &len)) != NULL)
+    {
+      if (buffer_reserve(&copy, &copy_size, len + 1) < 0)
+        break;
+      memcpy(copy, line, len + 1);
+      html_line(html, line);
+      txt_line(txt, copy);
+    }
+    free(copy);
+  }
+
+  status = reader_check(&r);
+  html_end(html);
+  txt_end(txt);
+  reader_free(&r);
+  return status;
+}
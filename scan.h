@@ -0,0 +1,72 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * scan.h - find the markup in a whole book once, for several back ends
+ *
+ * The tokens are kept as a structure of arrays, in an arena: token i is
+ * a markup_token of kind[i], starting offset[i] bytes into the book, that
+ * is length[i] bytes long and on page[i]. The tokens of line n are
+ * first[n] up to first[n+1]. Anywhere a '<' or '[' has no token, it
+ * isn't markup.
+ */
+
+#include <stdint.h>
+
+struct token_stream {
+  struct arena arena;
+  struct mapped_file *m;
+  unsigned char *kind;
+  uint32_t *offset;
+  uint32_t *length;
+  uint32_t *page;
+  uint32_t *first;
+  size_t ntokens;
+};
+
+int scan_book(struct token_stream *ts, struct mapped_file *m);
+
+void scan_free(struct token_stream *ts);
+
+/*
+ * Where a back end has got to in the stream. The back end works on its
+ * own copy of each line, so the offset of a token in the copy is the
+ * same as in the book.
+ */
+
+struct token_cursor {
+  struct token_stream *ts;
+  size_t n; /* The line number */
+  char *line;
+  size_t len;
+  size_t next; /* The token after the last one looked up */
+};
+
+void cursor_line(struct token_cursor *c, size_t n, char *line, size_t len);
+
+int cursor_token(struct token_cursor *c, char *cp, int *lenp);
+
+int convert_both(struct dp_context *html, struct txt_context *txt,
+  FILE *infile);
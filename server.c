@@ -0,0 +1,410 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * server.c - convert documents sent over a Unix domain socket
+ *
+ * This saves starting a new process for every document, e.g. when an
+ * editor converts a few pages each time they are saved. A fixed pool of
+ * worker threads accepts connections on the socket, and each connection
+ * can send any number of requests, one after another.
+ *
+ * A request is zero or more stage lines, in the form dppipe's -s option
+ * takes, followed by the length of the document and then the document:
+ *
+ *   stage foot -N
+ *   stage html -n
+ *   text 12345
+ *   <12345 bytes>
+ *
+ * With no stage lines, the document is converted by "html". The reply is
+ * the output, in frames sent as it is produced, then the warnings (if
+ * there are any), then how long the request took in microseconds:
+ *
+ *   out 4096
+ *   <4096 bytes>
+ *   err 57
+ *   <57 bytes>
+ *   done 1234
+ *
+ * A request that can't be carried out, or has a document of more than
+ * MAX_TEXT bytes, gets "error <message>" instead of the reply, and the
+ * connection is closed. The warnings of the html,
+ * quotes and txt stages are sent back; foot writes its own to the
+ * server's stderr, along with a line for each request.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "dptools.h"
+#include "pipe.h"
+#include "batch.h"
+#include "server.h"
+
+#define MAX_STAGES 16
+
+/* The longest document a request may send */
+#define MAX_TEXT (256*1024*1024)
+
+struct request {
+  int fd;
+  size_t out_bytes;
+  int error; /* Set if the client went away */
+};
+
+/* The stages parse their options with getopt, which isn't thread safe */
+static pthread_mutex_t getopt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now()
+{
+struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static int write_all(int fd, const char *buff, size_t len)
+{
+ssize_t n;
+
+  while (len > 0)
+  {
+    n = write(fd, buff, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buff += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int send_frame(int fd, char *type, const char *buff, size_t len)
+{
+char header[32];
+
+  snprintf(header, sizeof(header), "%s %zu\n", type, len);
+  if (write_all(fd, header, strlen(header)) < 0)
+    return -1;
+  return write_all(fd, buff, len);
+}
+
+static void send_error(int fd, char *msg)
+{
+char line[128];
+
+  snprintf(line, sizeof(line), "error %s\n", msg);
+  write_all(fd, line, strlen(line));
+}
+
+/*
+ * The output FILE of a request: everything written to it is sent on as
+ * an "out" frame.
+ */
+
+static ssize_t out_write(void *cookie, const char *buff, size_t len)
+{
+struct request *rq = cookie;
+
+  if (rq->error || (send_frame(rq->fd, "out", buff, len) < 0))
+  {
+    rq->error = 1;
+    return -1;
+  }
+  rq->out_bytes += len;
+  return len;
+}
+
+static cookie_io_functions_t out_functions = {NULL, out_write, NULL, NULL};
+
+/*
+ * Give the document to the pipeline a line at a time, as reader_line
+ * would, with its line ending.
+ */
+
+static void feed_lines(struct pipeline *p, char *text, size_t len)
+{
+char *line = NULL;
+size_t line_size = 0;
+char *end;
+size_t n;
+
+  while (len > 0)
+  {
+    end = memchr(text, '\n', len);
+    n = end ? (size_t) (end - text + 1) : len;
+    if (buffer_reserve(&line, &line_size, n+1) < 0)
+      break;
+    memcpy(line, text, n);
+    line[n] = '\0';
+    pipe_line(p, line);
+    text += n;
+    len -= n;
+  }
+  free(line);
+}
+
+/*
+ * Read one request and send its reply. Returns -1 when the connection
+ * should be closed.
+ */
+
+static int serve_request(FILE *in, int fd)
+{
+struct request rq;
+struct pipeline *p;
+char *stages[MAX_STAGES];
+int nstages = 0;
+char *line = NULL;
+size_t line_size = 0;
+ssize_t n;
+char *text = NULL;
+size_t text_len = 0;
+char *errors = NULL;
+size_t errors_len = 0;
+FILE *out;
+FILE *errfile;
+char summary[256];
+char done[32];
+double start;
+int status = -1;
+int i;
+
+  while ((n = getline(&line, &line_size, in)) > 0)
+  {
+    while ((n > 0) && ((line[n-1] == '\n') || (line[n-1] == '\r')))
+      line[--n] = '\0';
+    if ((strncmp(line, "stage ", 6) == 0) && (nstages < MAX_STAGES))
+      stages[nstages++] = strdup(line + 6);
+    else if (sscanf(line, "text %zu", &text_len) == 1)
+      break;
+    else
+    {
+      send_error(fd, "bad request");
+      goto out;
+    }
+  }
+  if (n <= 0)
+    goto out;
+
+  if (text_len > MAX_TEXT)
+  {
+    send_error(fd, "request too large");
+    goto out;
+  }
+  text = malloc(text_len + 1);
+  if (text == NULL)
+  {
+    send_error(fd, "out of memory");
+    goto out;
+  }
+  if (fread(text, 1, text_len, in) != text_len)
+    goto out;
+
+  start = now();
+
+  rq.fd = fd;
+  rq.out_bytes = 0;
+  rq.error = 0;
+  out = fopencookie(&rq, "w", out_functions);
+  errfile = open_memstream(&errors, &errors_len);
+  p = pipe_new(out);
+  if ((out == NULL) || (errfile == NULL) || (p == NULL))
+  {
+    send_error(fd, "out of memory");
+    if (p)
+      pipe_free(p);
+    if (out)
+      fclose(out);
+    if (errfile)
+      fclose(errfile);
+    free(errors);
+    goto out;
+  }
+  setvbuf(out, NULL, _IOFBF, SINK_SIZE);
+
+  pthread_mutex_lock(&getopt_lock);
+  if (nstages == 0)
+    status = pipe_add(p, "html");
+  else
+    for (i=0, status=0;(i<nstages) && (status == 0);i++)
+      status = pipe_add(p, stages[i]);
+  pthread_mutex_unlock(&getopt_lock);
+
+  if (status < 0)
+  {
+    send_error(fd, "bad stage");
+    pipe_free(p);
+    fclose(out);
+    fclose(errfile);
+    free(errors);
+    goto out;
+  }
+
+  pipe_errors(p, errfile);
+  pipe_begin(p);
+  feed_lines(p, text, text_len);
+  pipe_end(p);
+  pipe_free(p);
+
+  fclose(out);
+  fclose(errfile);
+  if (errors_len > 0)
+    send_frame(fd, "err", errors, errors_len);
+  free(errors);
+
+  snprintf(done, sizeof(done), "done %.0f\n", (now() - start)*1e6);
+  if (rq.error || (write_all(fd, done, strlen(done)) < 0))
+    status = -1;
+
+  summary[0] = '\0';
+  for (i=0;i<nstages;i++)
+    snprintf(summary + strlen(summary), sizeof(summary) - strlen(summary),
+      "%s%s", i ? " | " : "", stages[i]);
+  fprintf(stderr, "%-6s %8.3fms %10zu %10zu %s\n",
+    status ? "FAILED" : "ok", (now() - start)*1e3, text_len, rq.out_bytes,
+    nstages ? summary : "html");
+
+out:
+  for (i=0;i<nstages;i++)
+    free(stages[i]);
+  free(line);
+  free(text);
+  return status;
+}
+
+static void *worker_main(void *arg)
+{
+int listener = *(int *) arg;
+FILE *in;
+int fd;
+
+  for (;;)
+  {
+    fd = accept(listener, NULL, NULL);
+    if (fd < 0)
+    {
+      if ((errno == EINTR) || (errno == ECONNABORTED))
+        continue;
+      perror("accept");
+      return NULL;
+    }
+    in = fdopen(fd, "r");
+    if (in == NULL)
+    {
+      close(fd);
+      continue;
+    }
+    while (serve_request(in, fd) == 0)
+      ;
+    fclose(in);
+  }
+}
+
+/*
+ * Listen on the socket at path, serving requests on nthreads threads.
+ * Only returns if the socket can't be set up.
+ */
+
+int server_main(char *path, int nthreads)
+{
+struct sockaddr_un addr;
+struct stat st;
+pthread_t *threads;
+int listener;
+int started;
+int i;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "%s: socket name too long\n", path);
+    return 1;
+  }
+
+  /* A client that goes away shouldn't take the server with it */
+  signal(SIGPIPE, SIG_IGN);
+
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0)
+  {
+    perror("socket");
+    return 1;
+  }
+
+  /* Remove a socket left behind by an earlier server */
+  if ((lstat(path, &st) == 0) && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if ((bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    || (listen(listener, SOMAXCONN) < 0))
+  {
+    perror(path);
+    close(listener);
+    return 1;
+  }
+
+  if (nthreads < 1)
+    nthreads = batch_threads();
+  threads = calloc(nthreads, sizeof(pthread_t));
+  if (threads == NULL)
+  {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  for (started=0;started<nthreads;started++)
+    if (pthread_create(threads+started, NULL, worker_main, &listener))
+      break;
+
+  /* If no threads could be started, serve from this one */
+  if (started == 0)
+    worker_main(&listener);
+
+  for (i=0;i<started;i++)
+    pthread_join(threads[i], NULL);
+
+  free(threads);
+  close(listener);
+  return 1;
+}
@@ -0,0 +1,308 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * sink.c - buffered output
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "sink.h"
+#include "utf8.h"
+#include "trace.h"
+
+void sink_init(struct sink *s, sink_flush_fn flush, void *arg)
+{
+  s->size = SINK_SIZE;
+  s->buff = malloc(s->size);
+  if (s->buff == NULL)
+  {
+    s->size = 0;
+    s->error = 1;
+  }
+  else
+    s->error = 0;
+  s->len = 0;
+  s->written = 0;
+  s->flush = flush;
+  s->arg = arg;
+  s->fd = -1;
+}
+
+static int flush_fd(void *arg, char *buff, size_t len)
+{
+struct sink *s = arg;
+ssize_t n;
+uint64_t start;
+size_t total = len;
+
+  TRACE_START(start);
+  while (len > 0)
+  {
+    n = write(s->fd, buff, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buff += n;
+    len -= n;
+  }
+  TRACE_END(start, "io", "write", "bytes", total);
+  return 0;
+}
+
+void sink_init_fd(struct sink *s, int fd)
+{
+  sink_init(s, flush_fd, s);
+  s->fd = fd;
+}
+
+static int flush_file(void *arg, char *buff, size_t len)
+{
+uint64_t start;
+size_t n;
+
+  TRACE_START(start);
+  n = fwrite(buff, 1, len, (FILE *) arg);
+  TRACE_END(start, "io", "write", "bytes", n);
+  return (n == len) ? 0 : -1;
+}
+
+void sink_init_file(struct sink *s, FILE *f)
+{
+  sink_init(s, flush_file, f);
+}
+
+void sink_init_memory(struct sink *s)
+{
+  sink_init(s, NULL, NULL);
+}
+
+/*
+ * Write out everything in the buffer. A memory sink keeps its contents.
+ * For a FILE, the FILE is flushed as well.
+ */
+
+int sink_flush(struct sink *s)
+{
+uint64_t start;
+
+  if (s->flush == NULL)
+    return s->error ? -1 : 0;
+
+  if ((s->len > 0) && (s->flush(s->arg, s->buff, s->len) < 0))
+    s->error = 1;
+  s->written += s->len;
+  s->len = 0;
+
+  if (s->flush == flush_file)
+  {
+    TRACE_START(start);
+    if (fflush((FILE *) s->arg) != 0)
+      s->error = 1;
+    TRACE_END(start, "io", "fflush", NULL, 0);
+  }
+
+  return s->error ? -1 : 0;
+}
+
+void sink_free(struct sink *s)
+{
+  free(s->buff);
+  s->buff = NULL;
+  s->len = 0;
+  s->size = 0;
+}
+
+/*
+ * Make room for len more bytes, either by flushing or, for a memory
+ * sink, by growing the buffer.
+ */
+
+void sink_reserve(struct sink *s, size_t len)
+{
+size_t size;
+char *buff;
+
+  if (s->len + len <= s->size)
+    return;
+
+  if (s->flush)
+  {
+    if ((s->len > 0) && (s->flush(s->arg, s->buff, s->len) < 0))
+      s->error = 1;
+    s->written += s->len;
+    s->len = 0;
+    if (len <= s->size)
+      return;
+  }
+
+  size = s->size ? s->size : SINK_SIZE;
+  while (size < s->len + len)
+    size *= 2;
+  buff = realloc(s->buff, size);
+  if (buff == NULL)
+  {
+    s->error = 1;
+    return;
+  }
+  s->buff = buff;
+  s->size = size;
+}
+
+/*
+ * Room for len bytes at the end of the buffer, for a caller that writes
+ * there directly and then adds the number of bytes it used to s->len.
+ * Returns NULL if there's no memory.
+ */
+
+char *sink_space(struct sink *s, size_t len)
+{
+  sink_reserve(s, len);
+  if (s->len + len > s->size)
+    return NULL;
+  return s->buff + s->len;
+}
+
+void sink_write(struct sink *s, char *buff, size_t len)
+{
+  if (s->len + len > s->size)
+  {
+    sink_reserve(s, len);
+    if (s->len + len > s->size)
+      return;
+  }
+  memcpy(s->buff + s->len, buff, len);
+  s->len += len;
+}
+
+void sink_puts(struct sink *s, char *str)
+{
+  sink_write(s, str, strlen(str));
+}
+
+/*
+ * Append text, escaping the characters that are special in HTML.
+ */
+
+void sink_escaped(struct sink *s, char *str, size_t len)
+{
+char *end = str + len;
+char *run = str;
+
+  while (str < end)
+  {
+    switch (*str)
+    {
+      case '"':
+      case '&':
+      case '<':
+      case '>':
+        sink_write(s, run, str - run);
+        switch (*str)
+        {
+          case '"':
+            sink_literal(s, "&quot;");
+            break;
+          case '&':
+            sink_literal(s, "&amp;");
+            break;
+          case '<':
+            sink_literal(s, "&lt;");
+            break;
+          case '>':
+            sink_literal(s, "&gt;");
+            break;
+        }
+        str++;
+        run = str;
+        break;
+      default:
+        str++;
+        break;
+    }
+  }
+  sink_write(s, run, str - run);
+}
+
+void sink_int(struct sink *s, int n)
+{
+char buff[12];
+char *cp = buff + sizeof(buff);
+unsigned int u;
+
+  u = (n < 0) ? -(unsigned int) n : (unsigned int) n;
+  do
+  {
+    *--cp = '0' + (u % 10);
+    u /= 10;
+  } while (u);
+  if (n < 0)
+    *--cp = '-';
+  sink_write(s, cp, buff + sizeof(buff) - cp);
+}
+
+void sink_utf8(struct sink *s, int c)
+{
+char buff[4];
+
+  if (c < 0x80)
+    sink_putc(s, c);
+  else
+    sink_write(s, buff, utf8_encode(buff, c));
+}
+
+/*
+ * For the odd case that needs a format; the common ones have their own
+ * functions above.
+ */
+
+void sink_printf(struct sink *s, char *fmt, ...)
+{
+va_list ap;
+int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  if (len < 0)
+    return;
+
+  sink_reserve(s, len+1);
+  if (s->len + len + 1 > s->size)
+    return;
+  va_start(ap, fmt);
+  vsnprintf(s->buff + s->len, len+1, fmt, ap);
+  va_end(ap);
+  s->len += len;
+}
@@ -0,0 +1,83 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * sink.h - buffered output
+ *
+ * HTML is built up in a sink's buffer and written out in large pieces,
+ * to a file descriptor, a FILE or a callback. A sink with no flush
+ * function just grows, and the caller takes the text from buff.
+ */
+
+#define SINK_SIZE 65536
+
+typedef int (*sink_flush_fn)(void *arg, char *buff, size_t len);
+
+struct sink {
+  char *buff;
+  size_t len;
+  size_t size;
+  sink_flush_fn flush;
+  void *arg;
+  int fd;
+  int error; /* Set if a flush failed */
+  size_t written; /* Bytes flushed so far */
+};
+
+void sink_init(struct sink *s, sink_flush_fn flush, void *arg);
+
+void sink_init_fd(struct sink *s, int fd);
+
+void sink_init_file(struct sink *s, FILE *f);
+
+void sink_init_memory(struct sink *s);
+
+int sink_flush(struct sink *s);
+
+void sink_free(struct sink *s);
+
+void sink_reserve(struct sink *s, size_t len);
+
+char *sink_space(struct sink *s, size_t len);
+
+void sink_write(struct sink *s, char *buff, size_t len);
+
+void sink_puts(struct sink *s, char *str);
+
+void sink_escaped(struct sink *s, char *str, size_t len);
+
+void sink_int(struct sink *s, int n);
+
+void sink_utf8(struct sink *s, int c);
+
+void sink_printf(struct sink *s, char *fmt, ...);
+
+#define sink_putc(s, c) \
+  (((s)->len < (s)->size) ? (void) ((s)->buff[(s)->len++] = (c)) \
+    : sink_write((s), &(char){(c)}, 1))
+
+/* Append a string constant; its length is known at compile time */
+#define sink_literal(s, str) sink_write((s), (str), sizeof(str)-1)
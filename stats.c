@@ -0,0 +1,142 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * stats.c - counters and timers for --stats
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+static char *count_names[STAT_NCOUNTS] = {
+  "pages",
+  "lines",
+  "bytes_in",
+  "bytes_out",
+  "markup",
+  "entities",
+  "footnote_refs",
+  "footnotes",
+  "greek_chars",
+  "illustrations"
+};
+
+static char *timer_names[STAT_NTIMERS] = {
+  "total",
+  "write_line",
+  "greek",
+  "find_entity",
+  "flush_tags",
+  "rewrap",
+  "renumber"
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t stats_now(void)
+{
+struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Add the counts of a book or chunk (converted on some thread) to the
+ * totals.
+ */
+
+void stats_add(struct dp_stats *to, struct dp_stats *from)
+{
+int i;
+
+  pthread_mutex_lock(&stats_lock);
+  for (i = 0; i < STAT_NCOUNTS; i++)
+    to->count[i] += from->count[i];
+  for (i = 0; i < STAT_NTIMERS; i++)
+    to->ns[i] += from->ns[i];
+  pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * The format named by --stats, or -1. --stats on its own means text.
+ */
+
+int stats_format(char *name)
+{
+  if ((name == NULL) || (strcmp(name, "text") == 0))
+    return STATS_TEXT;
+  if (strcmp(name, "json") == 0)
+    return STATS_JSON;
+  return -1;
+}
+
+/*
+ * Print the counts at the end of a run that started at start, as given
+ * by stats_now.
+ */
+
+void stats_print(FILE *f, char *tool, struct dp_stats *s, uint64_t start,
+  int format)
+{
+double secs;
+int i;
+
+  if (!DP_STATS)
+  {
+    fprintf(f, "%s: built without --stats\n", tool);
+    return;
+  }
+
+  s->ns[STAT_T_TOTAL] = stats_now() - start;
+  secs = s->ns[STAT_T_TOTAL] / 1e9;
+  if (format == STATS_JSON)
+  {
+    fprintf(f, "{\"tool\":\"%s\",\"counts\":{", tool);
+    for (i = 0; i < STAT_NCOUNTS; i++)
+      fprintf(f, "%s\"%s\":%llu", i ? "," : "", count_names[i],
+        (unsigned long long) s->count[i]);
+    fprintf(f, "},\"ns\":{");
+    for (i = 0; i < STAT_NTIMERS; i++)
+      fprintf(f, "%s\"%s\":%llu", i ? "," : "", timer_names[i],
+        (unsigned long long) s->ns[i]);
+    fprintf(f, "},\"mb_per_s\":%.3f}\n",
+      (secs > 0) ? s->count[STAT_BYTES_IN] / secs / 1e6 : 0.0);
+    return;
+  }
+
+  for (i = 0; i < STAT_NCOUNTS; i++)
+    fprintf(f, "%-16s %14llu\n", count_names[i],
+      (unsigned long long) s->count[i]);
+  for (i = 0; i < STAT_NTIMERS; i++)
+    fprintf(f, "%-16s %14.3f ms\n", timer_names[i], s->ns[i] / 1e6);
+  if (secs > 0)
+    fprintf(f, "%-16s %14.3f MB/s\n", "throughput",
+      s->count[STAT_BYTES_IN] / secs / 1e6);
+}
@@ -0,0 +1,95 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * stats.h - counters and timers for --stats
+ *
+ * A context with a stats pointer counts the markup it converts and times
+ * the main steps. With no stats pointer the cost is one test of it, and
+ * with DP_STATS set to 0 the counting compiles away altogether.
+ */
+
+#include <stdint.h>
+
+#ifndef DP_STATS
+#define DP_STATS 1
+#endif
+
+enum stats_count {
+  STAT_PAGES,
+  STAT_LINES,
+  STAT_BYTES_IN,
+  STAT_BYTES_OUT,
+  STAT_MARKUP, /* Every tag or bracket sequence, including those below */
+  STAT_ENTITIES,
+  STAT_FOOTNOTE_REFS,
+  STAT_FOOTNOTES,
+  STAT_GREEK_CHARS,
+  STAT_ILLUSTRATIONS,
+  STAT_NCOUNTS
+};
+
+/* The times include the time of the steps called from them */
+enum stats_timer {
+  STAT_T_TOTAL,
+  STAT_T_WRITE_LINE,
+  STAT_T_GREEK,
+  STAT_T_ENTITY,
+  STAT_T_FLUSH_TAGS,
+  STAT_T_REWRAP,
+  STAT_T_RENUMBER,
+  STAT_NTIMERS
+};
+
+struct dp_stats {
+  uint64_t count[STAT_NCOUNTS];
+  uint64_t ns[STAT_NTIMERS]; /* Added up over all threads */
+};
+
+#define STATS_TEXT 0
+#define STATS_JSON 1
+
+#if DP_STATS
+#define STATS_COUNT(s, k, n) \
+  do { if (s) (s)->count[k] += (n); } while (0)
+#define STATS_START(s, t) \
+  do { if (s) (t) = stats_now(); } while (0)
+#define STATS_STOP(s, k, t) \
+  do { if (s) (s)->ns[k] += stats_now() - (t); } while (0)
+#else
+#define STATS_COUNT(s, k, n) do { } while (0)
+/* The timer is still used, so that it doesn't need its own #if */
+#define STATS_START(s, t) do { (void) (t); } while (0)
+#define STATS_STOP(s, k, t) do { (void) (t); } while (0)
+#endif
+
+uint64_t stats_now(void);
+
+void stats_add(struct dp_stats *to, struct dp_stats *from);
+
+int stats_format(char *name);
+
+void stats_print(FILE *f, char *tool, struct dp_stats *s, uint64_t start,
+  int format);
@@ -0,0 +1,116 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * strip.c - Pre-process files for Distributed Proofreaders
+ *
+ * Reduce multiple spaces to a single space
+ * Remove spaces before stops
+ * Make sure there is a space after a stop
+ *
+ * TO DO: no space before a dash
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dptools.h"
+
+void strip_context_init(struct strip_context *ctx)
+{
+  memset(ctx, 0, sizeof(struct strip_context));
+  ctx->emit = emit_to_file_crlf;
+  ctx->emit_arg = stdout;
+}
+
+/*
+ * Process one complete line. Spaces are only carried forward within a
+ * line, so no state is kept from one line to the next.
+ */
+
+void strip_line(struct strip_context *ctx, char *buff)
+{
+char *out;
+char *out_ptr;
+char *cp;
+char c;
+int spaces = 0;
+int stops = 0;
+
+  /* At most one space is added for every character of input */
+  if (buffer_reserve(&ctx->out, &ctx->out_size, 2*strlen(buff)+1) < 0)
+    return;
+  out = ctx->out;
+  out_ptr = out;
+
+  for (cp = buff; (c = *cp) != 0; cp++)
+  {
+    switch (c)
+    {
+      case ' ':
+        spaces++;
+        break;
+      case '\r':
+      case '\n':
+        break;
+      case '.':
+      case ',':
+      case '!':
+      case '?':
+      case ':':
+      case ';':
+      case ')':
+        stops = 1;
+        spaces = 0;
+        *out_ptr++ = c;
+        break;
+      case '"':
+        if (spaces)
+          *out_ptr++ = ' ';
+        *out_ptr++ = c;
+        spaces = 0;
+        stops = 0;
+        break;
+      default:
+        if (spaces || stops)
+          *out_ptr++ = ' ';
+        *out_ptr++ = c;
+        spaces = 0;
+        stops = 0;
+        break;
+    }
+  }
+  *out_ptr = 0;
+  ctx->emit(ctx->emit_arg, out);
+}
+
+void strip_end(struct strip_context *ctx)
+{
+  free(ctx->out);
+  ctx->out = NULL;
+  ctx->out_size = 0;
+}
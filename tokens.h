@@ -0,0 +1,79 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * tokens.h - the inline markup that dphtml, dptxt and dpcomments look for
+ *
+ * Each entry is MARKUP(token, pattern). In a pattern, %d stands for one or
+ * more digits and %A for one capital letter. mklexer turns these (and the
+ * entity names in entities.h) into a table-driven automaton, so adding a
+ * token here doesn't add a comparison anywhere.
+ *
+ * Where two patterns match the same text, the earlier one wins, and the
+ * longest match is always chosen.
+ */
+
+/* Tags */
+MARKUP(MK_ITALIC, "<i>")
+MARKUP(MK_BOLD, "<b>")
+MARKUP(MK_GESPERRT, "<g>")
+MARKUP(MK_FRAKTUR, "<f>")
+MARKUP(MK_SC, "<sc>")
+MARKUP(MK_TB, "<tb>")
+MARKUP(MK_ASC, "<asc>")
+MARKUP(MK_SIZE1, "<size 1>")
+MARKUP(MK_SIZE2, "<size 2>")
+MARKUP(MK_UNDERLINE, "<u>")
+MARKUP(MK_END_ITALIC, "</i>")
+MARKUP(MK_END_BOLD, "</b>")
+MARKUP(MK_END_SC, "</sc>")
+MARKUP(MK_END_FRAKTUR, "</f>")
+MARKUP(MK_END_GESPERRT, "</g>")
+MARKUP(MK_END_ASC, "</asc>")
+MARKUP(MK_END_SIZE, "</size>")
+MARKUP(MK_END_UNDERLINE, "</u>")
+
+/* Square brackets */
+MARKUP(MK_LONG_S, "[f]")
+MARKUP(MK_YOGH, "[3]")
+MARKUP(MK_FOOTNOTE_REF, "[%d]")
+MARKUP(MK_LETTER_REF, "[%A]")
+MARKUP(MK_KERAIA, "[']")
+MARKUP(MK_STIGMA, "[st]")
+MARKUP(MK_CAPITAL_STIGMA, "[ST]")
+MARKUP(MK_CAPITAL_YOGH, "[3*]")
+MARKUP(MK_BLANK_PAGE, "[Blank Page]")
+MARKUP(MK_ILLUSTRATION, "[Illustration]")
+MARKUP(MK_CAPTION, "[Illustration:")
+MARKUP(MK_STAR_REF, "[*]")
+MARKUP(MK_GREEK, "[Greek:")
+MARKUP(MK_SYMBOL, "[Symbol:")
+MARKUP(MK_SIDENOTE, "[Sidenote:")
+MARKUP(MK_FOOTNOTE_COLON, "[Footnote:")
+MARKUP(MK_FOOTNOTE, "[Footnote")
+MARKUP(MK_COMMENT, "[**")
+MARKUP(MK_HANDWRITING, "[HW:")
+MARKUP(MK_FORMAT, "[Format:")
@@ -0,0 +1,258 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * trace.c - a timeline of the run for --trace
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trace.h"
+
+/* Events kept per thread; once a ring is full the oldest are overwritten */
+#define TRACE_RING_SIZE (1 << 17)
+
+struct trace_event {
+  char *cat;
+  char *name;
+  char *argname; /* NULL if there's no argument */
+  uint64_t ts;
+  uint64_t dur;
+  long arg;
+  char ph; /* 'X' for a span, 'b' for an async span, 'C' for a counter */
+};
+
+struct trace_ring {
+  struct trace_ring *next;
+  int tid;
+  char *name;
+  uint64_t n; /* Events recorded, including any that were overwritten */
+  struct trace_event events[TRACE_RING_SIZE];
+};
+
+int trace_enabled = 0;
+
+static char *trace_name;
+static FILE *trace_file;
+static uint64_t trace_start;
+static struct trace_ring *rings; /* Every thread's ring */
+static int next_tid;
+static __thread struct trace_ring *ring;
+
+uint64_t trace_now(void)
+{
+struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * The calling thread's ring, made the first time it records an event.
+ * It is added to the list with a compare-and-swap, so a new thread never
+ * waits for the others.
+ */
+
+static struct trace_ring *get_ring(void)
+{
+struct trace_ring *r = ring;
+
+  if (r)
+    return r;
+
+  r = malloc(sizeof(struct trace_ring));
+  if (r == NULL)
+    return NULL;
+  r->tid = __atomic_add_fetch(&next_tid, 1, __ATOMIC_RELAXED);
+  r->name = NULL;
+  r->n = 0;
+  r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1,
+    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  ring = r;
+  return r;
+}
+
+static void record(int ph, char *cat, char *name, uint64_t ts, uint64_t dur,
+  char *argname, long arg)
+{
+struct trace_ring *r;
+struct trace_event *e;
+
+  r = get_ring();
+  if (r == NULL)
+    return;
+  e = r->events + (r->n & (TRACE_RING_SIZE - 1));
+  e->ph = ph;
+  e->cat = cat;
+  e->name = name;
+  e->ts = ts;
+  e->dur = dur;
+  e->argname = argname;
+  e->arg = arg;
+  r->n++;
+}
+
+/*
+ * Start tracing, into filename. Returns -1 if it can't be written.
+ */
+
+int trace_open(char *filename)
+{
+  trace_file = fopen(filename, "w");
+  if (trace_file == NULL)
+    return -1;
+  trace_name = filename;
+  trace_start = trace_now();
+  trace_enabled = 1;
+  trace_thread_name("main");
+  return 0;
+}
+
+/*
+ * Name the calling thread's track in the timeline.
+ */
+
+void trace_thread_name(char *name)
+{
+struct trace_ring *r;
+
+  if (!trace_enabled)
+    return;
+  r = get_ring();
+  if (r)
+    r->name = name;
+}
+
+/*
+ * Record a span from start (as given by trace_now) until now.
+ */
+
+void trace_span(char *cat, char *name, uint64_t start, char *argname,
+  long arg)
+{
+  record('X', cat, name, start, trace_now() - start, argname, arg);
+}
+
+/*
+ * The same, for a span that needn't nest inside the others on the thread,
+ * such as a paragraph that runs over a page break.
+ */
+
+void trace_async(char *cat, char *name, uint64_t start, char *argname,
+  long arg)
+{
+  record('b', cat, name, start, trace_now() - start, argname, arg);
+}
+
+/*
+ * Record the value of a counter from time ts on.
+ */
+
+void trace_counter(char *name, uint64_t ts, char *argname, long value)
+{
+  record('C', "counter", name, ts, 0, argname, value);
+}
+
+static void write_event(FILE *f, struct trace_ring *r, struct trace_event *e,
+  int ph, uint64_t ts)
+{
+  fprintf(f, "{\"ph\":\"%c\",\"cat\":\"%s\",\"name\":\"%s\",\"pid\":1,"
+    "\"tid\":%d,\"ts\":%.3f", ph, e->cat, e->name, r->tid,
+    (ts - trace_start) / 1e3);
+  if (ph == 'X')
+    fprintf(f, ",\"dur\":%.3f", e->dur / 1e3);
+  else if ((ph == 'b') || (ph == 'e'))
+    fprintf(f, ",\"id\":%d", r->tid);
+  if (e->argname && (ph != 'e'))
+    fprintf(f, ",\"args\":{\"%s\":%ld}", e->argname, e->arg);
+  fprintf(f, "}");
+}
+
+/*
+ * Write out every thread's events, once the other threads have finished.
+ */
+
+void trace_close(void)
+{
+FILE *f = trace_file;
+struct trace_ring *r;
+struct trace_ring *next;
+struct trace_event *e;
+uint64_t dropped = 0;
+uint64_t i;
+char *sep = "\n";
+
+  if (f == NULL)
+    return;
+  trace_enabled = 0;
+
+  fprintf(f, "{\"traceEvents\":[");
+  for (r = rings; r; r = r->next)
+  {
+    if (r->name)
+    {
+      fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+        "\"tid\":%d,\"args\":{\"name\":\"%s\"}}", sep, r->tid, r->name);
+      sep = ",\n";
+    }
+    i = 0;
+    if (r->n > TRACE_RING_SIZE)
+    {
+      i = r->n - TRACE_RING_SIZE;
+      dropped += i;
+    }
+    for (; i < r->n; i++)
+    {
+      e = r->events + (i & (TRACE_RING_SIZE - 1));
+      fprintf(f, "%s", sep);
+      sep = ",\n";
+      write_event(f, r, e, e->ph, e->ts);
+      if (e->ph == 'b')
+      {
+        fprintf(f, "%s", sep);
+        write_event(f, r, e, 'e', e->ts + e->dur);
+      }
+    }
+  }
+  fprintf(f, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":"
+    "{\"dropped_events\":%llu}}\n", (unsigned long long) dropped);
+
+  if (ferror(f) | fclose(f))
+    perror(trace_name);
+
+  for (r = rings; r; r = next)
+  {
+    next = r->next;
+    free(r);
+  }
+  rings = NULL;
+  ring = NULL;
+  trace_file = NULL;
+}
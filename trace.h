@@ -0,0 +1,61 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * trace.h - a timeline of the run for --trace
+ *
+ * The events are written in Chrome's trace event format, which Perfetto
+ * and chrome://tracing can show. Each thread records into a ring of its
+ * own, without locking, and trace_close writes them all out at the end.
+ * With tracing off, each trace point costs one test of trace_enabled.
+ */
+
+#include <stdint.h>
+
+extern int trace_enabled;
+
+/* Start a span: t is 0 if tracing is off */
+#define TRACE_START(t) ((t) = trace_enabled ? trace_now() : 0)
+
+/* End a span started by TRACE_START, if it was started */
+#define TRACE_END(t, cat, name, argname, arg) \
+  do { if (t) trace_span(cat, name, t, argname, arg); } while (0)
+
+int trace_open(char *filename);
+
+void trace_close(void);
+
+uint64_t trace_now(void);
+
+void trace_thread_name(char *name);
+
+void trace_span(char *cat, char *name, uint64_t start, char *argname,
+  long arg);
+
+void trace_async(char *cat, char *name, uint64_t start, char *argname,
+  long arg);
+
+void trace_counter(char *name, uint64_t ts, char *argname, long value);
@@ -33,13 +33,16 @@
 /* TO DO: nch -> gamma chi */
 
 #include <stdio.h>
-#include <wchar.h>
-#include <locale.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "dptools.h"
+#include "diag.h"
+#include "stats.h"
+#include "utf8.h"
 
-static wchar_t greek_table[256];
+static int greek_table[256];
 
 #define GREEK_STATE_NULL 0
 #define GREEK_STATE_LC_H 1
@@ -58,26 +61,43 @@ static wchar_t greek_table[256];
 #define GREEK_STATE_LC_NC 14
 #define GREEK_STATE_UC_NC 15
 
-static int greek_state = GREEK_STATE_NULL;
+#define GREEK_STATES 16
 
-void translit_init()
+/*
+ * The state machine is compiled into a table with a move for every state
+ * and every character up to U+00FF, plus one (GREEK_OTHER) for all the
+ * characters above that, which are passed through unchanged.
+ */
+
+#define GREEK_OTHER 256
+
+#define GREEK_PASS 1 /* After out, write the character itself */
+#define GREEK_REPORT 2 /* The character was unexpected after a c */
+
+struct greek_move {
+  unsigned char next;
+  unsigned char flags;
+  unsigned char len;
+  char out[6]; /* UTF-8 for up to two Greek letters */
+};
+
+static struct greek_move greek_moves[GREEK_STATES][GREEK_OTHER+1];
+
+static void init_greek_moves();
+
+/*
+ * greek_table is only written once, by translit_init, and is shared
+ * read-only by every conversion context after that.
+ */
+
+static pthread_once_t greek_table_once = PTHREAD_ONCE_INIT;
+
+static void init_greek_table()
 {
-wchar_t buff[1024];
-int len;
-int count = 0;
-int page = 1;
-int newpage = 0;
 int i;
-int italic = 0;
-wchar_t *start; 
-wchar_t *end;
-wchar_t *cp;
-
-  /* Need to set the locale before can print wide characters to stdout */
-/*  setlocale(LC_ALL, getenv("LANG")); */
 
   for (i=0;i<256;i++)
-    greek_table[i] = (wchar_t) i;
+    greek_table[i] = i;
 
   greek_table['h'] = '\'';
   greek_table['H'] = '\'';
@@ -135,491 +155,659 @@ wchar_t *cp;
   greek_table[0xdc] = 0x3ab; /* U with diaresis */
   greek_table[0xef] = 0x3ca; /* i with diaresis */
   greek_table[0xfc] = 0x3cb; /* u with diaresus */
-  
+
+  init_greek_moves();
 }
 
-void write_greek_char(FILE *outfile, wchar_t c)
+/*
+ * Characters outside Latin-1 are passed through unchanged.
+ */
+
+static int greek_char(int c)
 {
-  switch (greek_state)
+  if ((c < 0) || (c > 255))
+    return c;
+  return greek_table[c];
+}
+
+void translit_init()
+{
+  pthread_once(&greek_table_once, init_greek_table);
+}
+
+/* cp, if not NULL, is where c was in the line */
+static void report_greek_char(struct dp_context *ctx, char *cp, int c)
+{
+char buff[5];
+
+  buff[utf8_encode(buff, c)] = '\0';
+  html_warning(ctx, DIAG_GREEK_CHAR, cp,
+    "Unexpected character (%s) after c in Greek transliteration", buff);
+}
+
+/*
+ * One step of the transliteration state machine: the Greek letters to
+ * write (at most two) for character c in the given state, and the state
+ * that follows. This is only used to build greek_moves.
+ */
+
+static int greek_step(int state, int c, int *out, int *nout, int *report)
+{
+  switch (state)
   {
     case GREEK_STATE_LC_N:
       if ((c == 'g') || (c == 'G')
          || (c == 'x') || (c == 'X')
          || (c == 'k') || (c == 'K'))
       {
-        fputwc(0x3b3, outfile);
+        out[(*nout)++] = 0x3b3;
       }
       else if (c == 'c')
       {
-        greek_state = GREEK_STATE_LC_NC;
-        return;
+        state = GREEK_STATE_LC_NC;
+        return state;
       }
       else
       {
-        fputwc(0x3bd, outfile);
+        out[(*nout)++] = 0x3bd;
       }
-      greek_state = GREEK_STATE_NULL;
+      state = GREEK_STATE_NULL;
       break; 
     case GREEK_STATE_UC_N:
       if ((c == 'g') || (c == 'G')
          || (c == 'x') || (c == 'X')
          || (c == 'k') || (c == 'K'))
       {
-        fputwc(0x393, outfile);
+        out[(*nout)++] = 0x393;
       }
       else if (c == 'C')
       {
-        greek_state = GREEK_STATE_UC_NC;
-        return;
+        state = GREEK_STATE_UC_NC;
+        return state;
       }
       else
       {
-        fputwc(0x39d, outfile);
+        out[(*nout)++] = 0x39d;
       }
-      greek_state = GREEK_STATE_NULL;
+      state = GREEK_STATE_NULL;
       break; 
     case GREEK_STATE_LC_NC:
       if (c == 'h')
       {
-        fputwc(0x3b3, outfile);
+        out[(*nout)++] = 0x3b3;
       }
       else
       {
-        fputwc(0x3bd, outfile);
+        out[(*nout)++] = 0x3bd;
       }
-      greek_state = GREEK_STATE_LC_C;
+      state = GREEK_STATE_LC_C;
       break;
     case GREEK_STATE_UC_NC:
       if (c == 'H')
       {
-        fputwc(0x393, outfile);
+        out[(*nout)++] = 0x393;
       }
       else
       {
-        fputwc(0x39d, outfile);
+        out[(*nout)++] = 0x39d;
       }
-      greek_state = GREEK_STATE_UC_C; 
+      state = GREEK_STATE_UC_C; 
       break;
     case GREEK_STATE_LC_R:
       if ((c == 'h') || (c == 'H'))
       {
-        fputwc(0x1fe5, outfile);
-        greek_state = GREEK_STATE_NULL;
-        return;
+        out[(*nout)++] = 0x1fe5;
+        state = GREEK_STATE_NULL;
+        return state;
       }
       else
       {
-        fputwc(0x3c1, outfile);
-        greek_state = GREEK_STATE_NULL;
+        out[(*nout)++] = 0x3c1;
+        state = GREEK_STATE_NULL;
       }
       break;
     case GREEK_STATE_UC_R:
       if ((c == 'h') || (c == 'H'))
       {
-        fputwc(0x1fec,outfile);
-        greek_state = GREEK_STATE_NULL;
-        return;
+        out[(*nout)++] = 0x1fec;
+        state = GREEK_STATE_NULL;
+        return state;
       }
       else
       {
-        fputwc(0x3a1, outfile);
-        greek_state = GREEK_STATE_NULL;
+        out[(*nout)++] = 0x3a1;
+        state = GREEK_STATE_NULL;
       }
       break;
     case GREEK_STATE_LC_P:
       if ((c == 'h') || (c == 'H'))
       {
-        fputwc(0x03c6, outfile);
-        greek_state = GREEK_STATE_NULL;
-        return;
+        out[(*nout)++] = 0x03c6;
+        state = GREEK_STATE_NULL;
+        return state;
       }
       else if ((c == 's') || (c == 'S'))
       {
-        fputwc(0x03c8, outfile);
-        greek_state = GREEK_STATE_NULL;
-        return;
+        out[(*nout)++] = 0x03c8;
+        state = GREEK_STATE_NULL;
+        return state;
       }
       else
       {
-        fputwc(greek_table['p'], outfile);
-        greek_state = GREEK_STATE_NULL;
+        out[(*nout)++] = greek_table['p'];
+        state = GREEK_STATE_NULL;
       }
       break;
     case GREEK_STATE_UC_P:
       if ((c == 'h') || (c == 'H'))
       {
-        fputwc(0x03a6, outfile);
-        greek_state = GREEK_STATE_NULL;
-        return;
+        out[(*nout)++] = 0x03a6;
+        state = GREEK_STATE_NULL;
+        return state;
       }
       else if ((c == 's') || (c == 'S'))
       {
-        fputwc(0x03a8, outfile);
-        greek_state = GREEK_STATE_NULL;
-        return;
+        out[(*nout)++] = 0x03a8;
+        state = GREEK_STATE_NULL;
+        return state;
       }
       else
       {
-        fputwc(greek_table['P'], outfile);
-        greek_state = GREEK_STATE_NULL;
+        out[(*nout)++] = greek_table['P'];
+        state = GREEK_STATE_NULL;
       }
       break;
     case GREEK_STATE_LC_S:
       if ((c == ' ') || (c == ',') || (c == '.') ||
           (c == '?') || (c == ';'))
-        fputwc(0x3c2, outfile);
+        out[(*nout)++] = 0x3c2;
       else
-        fputwc(0x3c3, outfile);
-      greek_state = GREEK_STATE_NULL;
+        out[(*nout)++] = 0x3c3;
+      state = GREEK_STATE_NULL;
       break;
     case GREEK_STATE_LC_T:
       if ((c == 'h') || (c == 'H'))
       {
-        fputwc(0x3b8, outfile);
-        greek_state = GREEK_STATE_NULL;
-        return;
+        out[(*nout)++] = 0x3b8;
+        state = GREEK_STATE_NULL;
+        return state;
       }
       else
-        fputwc(greek_table['t'], outfile);
-      greek_state = GREEK_STATE_NULL;
+        out[(*nout)++] = greek_table['t'];
+      state = GREEK_STATE_NULL;
       break;
     case GREEK_STATE_UC_T:
       if ((c == 'h') || (c == 'H'))
       {
-        fputwc(0x398, outfile);
-        greek_state = GREEK_STATE_NULL;
-        return;
+        out[(*nout)++] = 0x398;
+        state = GREEK_STATE_NULL;
+        return state;
       }
       else
-        fputwc(greek_table['T'], outfile);
-      greek_state = GREEK_STATE_NULL;
+        out[(*nout)++] = greek_table['T'];
+      state = GREEK_STATE_NULL;
       break;
     default:
       break;
   }
 
-  switch (greek_state)
+  switch (state)
   {
     case GREEK_STATE_NULL:
       switch (c)
       {
         case 'c':
-          greek_state = GREEK_STATE_LC_C;
+          state = GREEK_STATE_LC_C;
           break;
         case 'C':
-          greek_state = GREEK_STATE_UC_C;
+          state = GREEK_STATE_UC_C;
           break;
         case 'h':
-          greek_state = GREEK_STATE_LC_H;
+          state = GREEK_STATE_LC_H;
           break;
         case 'H':
-          greek_state = GREEK_STATE_UC_H;
+          state = GREEK_STATE_UC_H;
           break;
         case 'n':
-          greek_state = GREEK_STATE_LC_N;
+          state = GREEK_STATE_LC_N;
           break;
         case 'N':
-          greek_state = GREEK_STATE_UC_N;
+          state = GREEK_STATE_UC_N;
           break;
         case 'p':
-          greek_state = GREEK_STATE_LC_P;
+          state = GREEK_STATE_LC_P;
           break;
         case 'P':
-          greek_state = GREEK_STATE_UC_P;
+          state = GREEK_STATE_UC_P;
           break;
         case 'r':
-          greek_state = GREEK_STATE_LC_R;
+          state = GREEK_STATE_LC_R;
           break;
         case 'R':
-          greek_state = GREEK_STATE_UC_R;
+          state = GREEK_STATE_UC_R;
           break;
         case 's':
-          greek_state = GREEK_STATE_LC_S;
+          state = GREEK_STATE_LC_S;
           break;
         case 't':
-          greek_state = GREEK_STATE_LC_T;
+          state = GREEK_STATE_LC_T;
           break;
         case 'T':
-          greek_state = GREEK_STATE_UC_T;
+          state = GREEK_STATE_UC_T;
           break;
         default:
-          fwprintf(outfile, L"%lc", greek_table[c]);
+          out[(*nout)++] = greek_char(c);
           break;
       }
       break;
     case GREEK_STATE_LC_C:
       if ((c == 'h') || (c == 'H'))
-        fwprintf(outfile, L"%lc", 0x3c7);
+        out[(*nout)++] = 0x3c7;
       else
-        fwprintf(stderr, L"Unexpected character (%lc) after c in Greek transliteration.\n", c);
-      greek_state = GREEK_STATE_NULL;
+        *report = 1;
+      state = GREEK_STATE_NULL;
       break;
     case GREEK_STATE_UC_C:
       if ((c == 'h') || (c == 'H'))
-        fwprintf(outfile, L"%lc", 0x3a7);
+        out[(*nout)++] = 0x3a7;
       else
-        fwprintf(stderr, L"Unexpected character (%lc) after c in Greek transliteration.\n", c);
-      greek_state = GREEK_STATE_NULL;
+        *report = 1;
+      state = GREEK_STATE_NULL;
       break;
     case GREEK_STATE_LC_H:
       switch (c)
       {
         case 'a':
         case 'A':
-          fwprintf(outfile, L"%lc", 0x1f01);
+          out[(*nout)++] = 0x1f01;
           break;
         case 'e':
         case 'E':
-          fwprintf(outfile, L"%lc", 0x1f11);
+          out[(*nout)++] = 0x1f11;
           break;
         case 0xea:
         case 0xca:
-          fwprintf(outfile, L"%lc", 0x1f21);
+          out[(*nout)++] = 0x1f21;
           break;
         case 'i':
         case 'I':
-          fwprintf(outfile, L"%lc", 0x1f31);
+          out[(*nout)++] = 0x1f31;
           break;
         case 'o':
         case 'O':
-          fwprintf(outfile, L"%lc", 0x1f41);
+          out[(*nout)++] = 0x1f41;
           break;
         case 'u':
         case 'U':
         case 'y':
         case 'Y':
-          fwprintf(outfile, L"%lc", 0x1f51);
+          out[(*nout)++] = 0x1f51;
           break;
         case 0xf4:
         case 0xd4:
-          fwprintf(outfile, L"%lc", 0x1f61);
+          out[(*nout)++] = 0x1f61;
           break;
         default:
-          fwprintf(outfile, L"%lc", c);
+          out[(*nout)++] = c;
           break;
       }
-      greek_state = GREEK_STATE_NULL;
+      state = GREEK_STATE_NULL;
       break;
     case GREEK_STATE_UC_H:
       switch (c)
       {
         case 'a':
         case 'A':
-          fwprintf(outfile, L"%lc", 0x1f09);
+          out[(*nout)++] = 0x1f09;
           break;
         case 'e':
         case 'E':
-          fwprintf(outfile, L"%lc", 0x1f19);
+          out[(*nout)++] = 0x1f19;
           break;
         case 0xea:
         case 0xca:
-          fwprintf(outfile, L"%lc", 0x1f29);
+          out[(*nout)++] = 0x1f29;
           break;
         case 'i':
         case 'I':
-          fwprintf(outfile, L"%lc", 0x1f39);
+          out[(*nout)++] = 0x1f39;
           break;
         case 'o':
         case 'O':
-          fwprintf(outfile, L"%lc", 0x1f49);
+          out[(*nout)++] = 0x1f49;
           break;
         case 'u':
         case 'U':
         case 'y':
         case 'Y':
-          fwprintf(outfile, L"%lc", 0x1f59);
+          out[(*nout)++] = 0x1f59;
           break;
         case 0xf4:
         case 0xd4:
-          fwprintf(outfile, L"%lc", 0x1f69);
+          out[(*nout)++] = 0x1f69;
           break;
         default:
-          fwprintf(outfile, L"%lc", c);
+          out[(*nout)++] = c;
           break;
       }
-      greek_state = GREEK_STATE_NULL;
+      state = GREEK_STATE_NULL;
       break;
     case GREEK_STATE_LC_P:
       if ((c == 'h') || (c == 'H'))
-        fwprintf(outfile, L"%lc", 0x03c6);
+        out[(*nout)++] = 0x03c6;
       else if ((c == 's') || (c == 'S'))
-        fwprintf(outfile, L"%lc", 0x03c8);
+        out[(*nout)++] = 0x03c8;
       else
-        fwprintf(outfile, L"%lc%lc", greek_table['p'], greek_table[c]);
-      greek_state = GREEK_STATE_NULL;
+      {
+        out[(*nout)++] = greek_table['p'];
+        out[(*nout)++] = greek_char(c);
+      }
+      state = GREEK_STATE_NULL;
       break;
     case GREEK_STATE_UC_P:
       if ((c == 'h') || (c == 'H'))
-        fwprintf(outfile, L"%lc", 0x03a6);
+        out[(*nout)++] = 0x03a6;
       else if ((c == 's') || (c == 'S'))
-        fwprintf(outfile, L"%lc", 0x03a8);
+        out[(*nout)++] = 0x03a8;
       else
-        fwprintf(outfile, L"%lc%lc", greek_table['P'], greek_table[c]);
-      greek_state = GREEK_STATE_NULL;
+      {
+        out[(*nout)++] = greek_table['P'];
+        out[(*nout)++] = greek_char(c);
+      }
+      state = GREEK_STATE_NULL;
       break;
     case GREEK_STATE_LC_T:
       if ((c == 'h') || (c == 'H'))
-        fwprintf(outfile, L"%lc",  0x3b8);
+        out[(*nout)++] = 0x3b8;
       else
-        fwprintf(outfile, L"%lc%lc", greek_table['t'], greek_table[c]);
-      greek_state = GREEK_STATE_NULL;
+      {
+        out[(*nout)++] = greek_table['t'];
+        out[(*nout)++] = greek_char(c);
+      }
+      state = GREEK_STATE_NULL;
       break; 
     case GREEK_STATE_UC_T:
       if ((c == 'h') || (c == 'H'))
-        fwprintf(outfile, L"%lc",  0x398);
+        out[(*nout)++] = 0x398;
       else
-        fwprintf(outfile, L"%lc%lc", greek_table['T'], greek_table[c]);
-      greek_state = GREEK_STATE_NULL;
+      {
+        out[(*nout)++] = greek_table['T'];
+        out[(*nout)++] = greek_char(c);
+      }
+      state = GREEK_STATE_NULL;
       break;
 
     default:
-      fwprintf(stderr, L"Unexpected greek transliteration state.\n");
+      fprintf(stderr, "Unexpected greek transliteration state.\n");
+      break;
+  }
+  return state;
+}
+
+/*
+ * Build greek_moves by running greek_step for every state and character.
+ * For GREEK_OTHER, a character that can't be in the input stands for
+ * whichever one it is, and greek_step only ever writes it last.
+ */
+
+static void init_greek_moves()
+{
+int state;
+int col;
+int c;
+int out[2];
+int nout;
+int report;
+int i;
+struct greek_move *m;
+
+  for (state = 0; state < GREEK_STATES; state++)
+  {
+    for (col = 0; col <= GREEK_OTHER; col++)
+    {
+      c = (col == GREEK_OTHER) ? 0x110000 : col;
+      nout = 0;
+      report = 0;
+      m = &greek_moves[state][col];
+      m->next = greek_step(state, c, out, &nout, &report);
+      m->flags = report ? GREEK_REPORT : 0;
+      m->len = 0;
+      for (i = 0; i < nout; i++)
+      {
+        if (out[i] == 0x110000)
+          m->flags |= GREEK_PASS;
+        else
+          m->len += utf8_encode(m->out + m->len, out[i]);
+      }
+    }
+  }
+}
+
+static struct greek_move *greek_move(int state, int c)
+{
+  if ((c < 0) || (c > 255))
+    c = GREEK_OTHER;
+  return &greek_moves[state][c];
+}
+
+void write_greek_char(struct dp_context *ctx, int c)
+{
+struct greek_move *m;
+uint64_t t0 = 0;
+
+  STATS_COUNT(ctx->stats, STAT_GREEK_CHARS, 1);
+  STATS_START(ctx->stats, t0);
+  m = greek_move(ctx->s.greek_state, c);
+  sink_write(&ctx->out, m->out, m->len);
+  if (m->flags & GREEK_PASS)
+    sink_utf8(&ctx->out, c);
+  if (m->flags & GREEK_REPORT)
+    report_greek_char(ctx, NULL, c);
+  ctx->s.greek_state = m->next;
+  STATS_STOP(ctx->stats, STAT_T_GREEK, t0);
+}
+
+/*
+ * Transliterate len bytes of UTF-8 into out, which must have room for
+ * TRANSLIT_SPACE(len) bytes, carrying the state machine on from *statep.
+ * This gives the same result as calling write_greek_char for each
+ * character, with any warnings going to ctx. Returns the number of
+ * bytes written.
+ */
+
+size_t transliterate_span(int *statep, char *in, size_t len, char *out,
+  struct dp_context *ctx)
+{
+char *end = in + len;
+char *start;
+char *op = out;
+int state = *statep;
+struct greek_move *m;
+int c;
+
+  while (in < end)
+  {
+    /*
+     * Most letters map straight to one Greek letter; only the first
+     * letter of a digraph, s and h change the state.
+     */
+    while ((state == GREEK_STATE_NULL) && (in < end) &&
+      ((unsigned char) *in < 0x80))
+    {
+      m = &greek_moves[GREEK_STATE_NULL][(unsigned char) *in];
+      if (m->next != GREEK_STATE_NULL)
+        break;
+      memcpy(op, m->out, m->len);
+      op += m->len;
+      in++;
+    }
+    if (in == end)
       break;
+
+    start = in;
+    if ((unsigned char) *in < 0x80)
+      c = *in++;
+    else
+      c = utf8_decode(&in);
+    m = greek_move(state, c);
+    memcpy(op, m->out, m->len);
+    op += m->len;
+    if (m->flags & GREEK_PASS)
+      op += utf8_encode(op, c);
+    if (m->flags & GREEK_REPORT)
+      report_greek_char(ctx, start, c);
+    state = m->next;
   }
+
+  *statep = state;
+  return op - out;
 }
 
-void flush_greek(FILE *outfile)
+void flush_greek(struct dp_context *ctx)
 {
-  switch (greek_state)
+struct sink *out = &ctx->out;
+
+  switch (ctx->s.greek_state)
   {
     case GREEK_STATE_LC_N:
-      fputwc(greek_table['n'], outfile);
+      sink_utf8(out, greek_table['n']);
       break;
     case GREEK_STATE_UC_N:
-      fputwc(greek_table['N'], outfile);
+      sink_utf8(out, greek_table['N']);
       break;
     case GREEK_STATE_LC_P:
-      fputwc(greek_table['p'], outfile);
+      sink_utf8(out, greek_table['p']);
       break;
     case GREEK_STATE_UC_P:
-      fputwc(greek_table['P'], outfile);
+      sink_utf8(out, greek_table['P']);
       break;
     case GREEK_STATE_LC_R:
-      fputwc(greek_table['r'],outfile);
+      sink_utf8(out, greek_table['r']);
       break;
     case GREEK_STATE_UC_R:
-      fputwc(greek_table['R'],outfile);
+      sink_utf8(out, greek_table['R']);
       break;
     case GREEK_STATE_LC_S:
-      fputwc(0x3c2, outfile);
+      sink_utf8(out, 0x3c2);
       break;
     case GREEK_STATE_LC_T:
-      fputwc(greek_table['t'],outfile);
+      sink_utf8(out, greek_table['t']);
       break;
     case GREEK_STATE_UC_T:
-      fputwc(greek_table['T'],outfile);
+      sink_utf8(out, greek_table['T']);
       break;
     case GREEK_STATE_NULL:
       break;
     default:
-      fwprintf(stderr, L"Unexpected state at end of [Greek:] mode.\n");
+      html_warning(ctx, DIAG_GREEK_STATE, NULL,
+        "Unexpected state at end of [Greek:] mode");
       break;
   }
-  greek_state = GREEK_STATE_NULL;
+  ctx->s.greek_state = GREEK_STATE_NULL;
 }
 
-void write_greek(FILE *outfile, wchar_t *str)
+void write_greek(struct dp_context *ctx, char *str)
 {
-   wchar_t *cp;
+   struct sink *out = &ctx->out;
+   char *cp;
 
    cp = str;
 
-   while (*cp != L'\0')
+   while (*cp != '\0')
    {
      switch (*cp)
      {
        case 's': /* lower-case sigma at end of a word */
-         if ((cp[1] == L' ') || (cp[1] == L'\0'))
-           fwprintf(outfile, L"%lc", 0x03c2);
+         if ((cp[1] == ' ') || (cp[1] == '\0'))
+           sink_utf8(out, 0x03c2);
          else
-           fwprintf(outfile, L"%lc", 0x03c3);
+           sink_utf8(out, 0x03c3);
          cp++;
          break;
        case 'C': /* "CH" for chi */
-         if ((cp[1] == L'h') || (cp[1]== L'H'))
+         if ((cp[1] == 'h') || (cp[1]== 'H'))
          {
-           fwprintf(outfile, L"%lc", 0x3a7);
+           sink_utf8(out, 0x3a7);
            cp += 2;
          }
          else
          {
-           fwprintf(outfile, L"%lc", greek_table[*cp]);
+           sink_utf8(out, greek_table[(unsigned char) *cp]);
            cp++;
          }
          break;
        case 'c':
-         if (cp[1] == L'h')
+         if (cp[1] == 'h')
          {
-           fwprintf(outfile, L"%lc", 0x3c7);
+           sink_utf8(out, 0x3c7);
            cp += 2;
          }
          else
          {
-           fwprintf(outfile, L"%lc", greek_table[*cp]);
+           sink_utf8(out, greek_table[(unsigned char) *cp]);
            cp++;
          }
          break;
        case 'T': /* TH for theta */
-         if ((cp[1] == L'h') || (cp[1] == L'H'))
+         if ((cp[1] == 'h') || (cp[1] == 'H'))
          {
-           fwprintf(outfile, L"%lc", 0x398);
+           sink_utf8(out, 0x398);
            cp += 2;
          }
          else
          {
-           fwprintf(outfile, L"%lc", greek_table[*cp]);
+           sink_utf8(out, greek_table[(unsigned char) *cp]);
            cp++;
          }
          break;
        case 't':
-         if (cp[1] == L'h')
+         if (cp[1] == 'h')
          {
-           fwprintf(outfile, L"%lc", 0x3b8);
+           sink_utf8(out, 0x3b8);
            cp += 2;
          }
          else
          {
-           fwprintf(outfile, L"%lc", greek_table[*cp]);
+           sink_utf8(out, greek_table[(unsigned char) *cp]);
            cp++;
          }
          break;
        case 'P': /* PH for phi, PS for psi */
-         if ((cp[1] == L'H') || (cp[1] == L'h'))
+         if ((cp[1] == 'H') || (cp[1] == 'h'))
          {
-           fwprintf(outfile, L"%lc", 0x03a6);
+           sink_utf8(out, 0x03a6);
            cp += 2;
          }
-         else if ((cp[1] == L'S') || (cp[1] == L's'))
+         else if ((cp[1] == 'S') || (cp[1] == 's'))
          {
-           fwprintf(outfile, L"%lc", 0x03a8);
+           sink_utf8(out, 0x03a8);
            cp += 2;
          }
          else
          {
-           fwprintf(outfile, L"%lc", greek_table[*cp]);
+           sink_utf8(out, greek_table[(unsigned char) *cp]);
            cp++;
          }
          break;
        case 'p': 
-         if (cp[1] == L'h')
+         if (cp[1] == 'h')
          {
-           fwprintf(outfile, L"%lc", 0x03c6);
+           sink_utf8(out, 0x03c6);
            cp += 2;
          }
-         else if ((cp[1] == L'S') || (cp[1] == L's'))
+         else if ((cp[1] == 'S') || (cp[1] == 's'))
          {
-           fwprintf(outfile, L"%lc", 0x03c8);
+           sink_utf8(out, 0x03c8);
            cp += 2;
          }
          else
          {
-           fwprintf(outfile, L"%lc", greek_table[*cp]);
+           sink_utf8(out, greek_table[(unsigned char) *cp]);
            cp++;
          }
          break;
        default:
-         fwprintf(outfile, L"%lc", greek_table[*cp]);
-         cp++;
+         sink_utf8(out, greek_char(utf8_decode(&cp)));
          break;
       }
    }
@@ -0,0 +1,606 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * txt.c - format Distributed Proofreaders markup as a plain text file
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "dptools.h"
+#include "diag.h"
+#include "entity.h"
+#include "markup.h"
+#include "scan.h"
+#include "probes.h"
+#include "stats.h"
+#include "trace.h"
+#include "utf8.h"
+
+/*
+ * TO DO:
+ *
+ * Skip comments [** ]
+ */
+
+static char *hrule = "     *     *     *     *     *";
+
+void txt_context_init(struct txt_context *ctx)
+{
+  memset(ctx, 0, sizeof(struct txt_context));
+  ctx->outfile = stdout;
+  ctx->errfile = stderr;
+  ctx->diag_max = DIAG_MAX;
+  ctx->quote_indent = 4;
+  ctx->poetry_indent = 2;
+  ctx->poetry_indent2 = 6;
+  ctx->poetry_limit = 70;
+}
+
+/* Count the bytes of a line just written, for --stats and the probes */
+static void wrote(struct txt_context *ctx, size_t n)
+{
+  ctx->written += n;
+  STATS_COUNT(ctx->stats, STAT_BYTES_OUT, n);
+}
+
+/*
+ * Give a warning about the current line. cp, if not NULL, points to where
+ * in the line the problem was found.
+ */
+
+static void txt_warning(struct txt_context *ctx, int code, char *cp,
+  char *fmt, ...)
+{
+va_list ap;
+int column = 0;
+
+  if (ctx->diag == NULL)
+  {
+    ctx->diag = diag_new(ctx->errfile, ctx->diag_format, ctx->diag_max);
+    if (ctx->diag)
+      ctx->diag->name = ctx->input_name;
+  }
+  if (cp && ctx->line_text && (cp >= ctx->line_text) &&
+    (cp <= ctx->line_text + strlen(ctx->line_text)))
+    column = cp - ctx->line_text + 1;
+  va_start(ap, fmt);
+  diag_vreport(ctx->diag, code, ctx->page, ctx->lineno, column,
+    cp ? ctx->line_text : NULL, fmt, ap);
+  va_end(ap);
+}
+
+/*
+ * Add a line of a paragraph to rbuff, and print as many full lines as
+ * there now are. Printed text isn't removed straight away; rstart just
+ * moves past it, and the few characters left over are moved to the front
+ * when the next line is added. So each character is only copied once or
+ * twice, however long the paragraph.
+ */
+
+static void rewrap(ctx, indent, line)
+struct txt_context *ctx;
+int indent;
+char *line;
+{
+char *start;
+int len;
+int i;
+int n;
+int todo;
+int end;
+uint64_t t0 = 0;
+
+  STATS_START(ctx->stats, t0);
+  ctx->last_indent = indent;
+
+  if (ctx->rstart > 0)
+  {
+    i = ctx->rptr - ctx->rbuff - ctx->rstart;
+    memmove(ctx->rbuff, ctx->rbuff + ctx->rstart, i + 1);
+    ctx->rptr = ctx->rbuff + i;
+    ctx->rstart = 0;
+  }
+
+  /* inbuff counts characters, but the buffer holds UTF-8 bytes */
+  len = strlen(line);
+/*  fprintf(ctx->outfile, "[%s]\n", line); */
+  i = ctx->rptr - ctx->rbuff;
+  if (buffer_reserve(&ctx->rbuff, &ctx->rsize, i+len+2) < 0)
+  {
+    STATS_STOP(ctx->stats, STAT_T_REWRAP, t0);
+    return;
+  }
+  ctx->rptr = ctx->rbuff + i;
+  if (ctx->rptr != ctx->rbuff)
+  {
+    *ctx->rptr = ' ';
+    ctx->rptr++;
+    ctx->inbuff++;
+  }
+  strcpy(ctx->rptr, line);
+  ctx->rptr += len;
+  ctx->inbuff += utf8_length(line, len);
+
+  start = ctx->rbuff;
+  while (ctx->inbuff >= 70-indent)
+  {
+    end = utf8_offset(start, 70-indent);
+    todo = end;
+    while ((todo > 0) && (start[todo-1] != ' '))
+      todo--;
+    if (todo == 0)
+      todo = end;
+    /* Leave out the space that the line was broken at */
+    n = (start[todo-1] == ' ') ? todo-1 : todo;
+    fprintf(ctx->outfile, "%*s%.*s\n", indent, "", n, start);
+    wrote(ctx, indent + n + 1);
+    ctx->inbuff -= utf8_length(start, todo);
+    start += todo;
+  }
+  ctx->rstart = start - ctx->rbuff;
+  STATS_STOP(ctx->stats, STAT_T_REWRAP, t0);
+} 
+
+static void rflush(ctx)
+struct txt_context *ctx;
+{
+  if (ctx->inbuff > 70-ctx->last_indent)
+    txt_warning(ctx, DIAG_WRAP, NULL,
+      "More than 70-indent characters in buffer");
+
+  if (ctx->inbuff != 0)
+  {
+    fprintf(ctx->outfile, "%*s%s\n", ctx->last_indent, "",
+      ctx->rbuff + ctx->rstart);
+    wrote(ctx,
+      ctx->last_indent + strlen(ctx->rbuff + ctx->rstart) + 1);
+  }
+
+  ctx->inbuff = 0;
+  ctx->rptr = ctx->rbuff;
+  ctx->rstart = 0;
+  if (ctx->rbuff)
+    ctx->rbuff[0] = 0;
+  fprintf(ctx->outfile, "\n");
+  wrote(ctx, 1);
+}
+
+/*
+ * The number of bytes to print on the next line of a poem, breaking at a
+ * space if possible.
+ */
+
+static int poem_break(line, width)
+char *line;
+int width;
+{
+int todo;
+int end;
+
+  end = utf8_offset(line, width);
+  todo = end;
+  while ((todo > 0) && (line[todo-1] != ' '))
+    todo--;
+  if (todo == 0)
+    todo = end;
+  return todo;
+}
+
+static void rewrap_poem(ctx, indent, line)
+struct txt_context *ctx;
+int indent;
+char *line;
+{
+int len;
+int todo;
+char *ptr;
+uint64_t t0 = 0;
+
+  STATS_START(ctx->stats, t0);
+  len = strlen(line);
+  if (utf8_length(line, len)+indent <= ctx->poetry_limit)
+  {
+    fprintf(ctx->outfile, "%*s%s\n", indent, "", line);
+    wrote(ctx, indent + len + 1);
+  }
+  else
+  {
+    todo = poem_break(line, 70-indent);
+    fprintf(ctx->outfile, "%*s%.*s\n", indent, "", todo, line);
+    wrote(ctx, indent + todo + 1);
+
+    ptr = line+todo;
+    len -= todo;
+
+    while (len)
+    {
+      if (utf8_offset(ptr, 70-ctx->poetry_indent2) >= len)
+        todo = len;
+      else
+        todo = poem_break(ptr, 70-ctx->poetry_indent2);
+
+      fprintf(ctx->outfile, "%*s%.*s\n", ctx->poetry_indent2, "", todo, ptr);
+      wrote(ctx, ctx->poetry_indent2 + todo + 1);
+      ptr += todo;
+      len -= todo;
+    }
+  }
+  STATS_STOP(ctx->stats, STAT_T_REWRAP, t0);
+}
+
+static void format_command(ctx, cpp)
+struct txt_context *ctx;
+char **cpp;
+{
+char *ptr;
+
+  ptr = *cpp;
+  while ((*ptr != 0) && (*ptr != ']'))
+  {
+    ptr++;
+  }
+  if (*ptr == 0)
+  {
+    txt_warning(ctx, DIAG_FORMAT, *cpp, "Malformed [Format: command");
+    *cpp = ptr;
+  }
+  else
+  {
+    ctx->poetry_indent2 = 20; /* HACK */
+    *cpp = ptr+1;
+  }
+}
+
+/*
+ * Handle one of the TXT_OPTIONS. Returns -1 if c is not one of them.
+ */
+
+int txt_option(struct txt_context *ctx, int c, char *arg)
+{
+  switch (c)
+  {
+    case 'e':
+      ctx->expand_entities = 1;
+      break;
+    case 'l':
+      ctx->poetry_limit = atoi(arg);
+      break;
+    case 'p':
+      ctx->poetry_indent = atoi(arg);
+      break;
+    case 'q':
+      ctx->quote_indent = atoi(arg);
+      break;
+    case 'r':
+      ctx->poetry_indent2 = atoi(arg);
+      break;
+    default:
+      return -1;
+  }
+  return 0;
+}
+
+/*
+ * Process one line of input, as read by fgets.
+ */
+
+void txt_line(struct txt_context *ctx, char *buff)
+{
+char *line;
+char *cp1;
+char *cp2;
+int len;
+int l;
+int token;
+struct entity *e;
+uint64_t t0 = 0;
+
+  len = strlen(buff);
+  STATS_COUNT(ctx->stats, STAT_LINES, 1);
+
+  if ((len > 0) && (buff[len-1] == '\n'))
+  {
+    buff[len-1] = '\0';
+    len--;
+  }
+  if ((len > 0) && (buff[len-1] == '\r'))
+  {
+    buff[len-1] = '\0';
+    len--;
+  }
+
+  ctx->lineno++;
+  ctx->line_text = buff;
+
+  if (strcmp(buff, "/*") == 0) 
+  {
+    ctx->poetry_mode = 1;
+  }
+  else if (strcmp(buff, "*/") == 0)
+  {
+    ctx->poetry_mode = 0;
+  }
+  else if (strcmp(buff, "/#") == 0)
+  {
+    ctx->quote_mode = 1;
+  }
+  else if (strcmp(buff, "#/") == 0)
+  {
+    ctx->quote_mode = 0;
+  }
+  else if (strncmp(buff, "-----File", 9) == 0)
+  {
+    STATS_COUNT(ctx->stats, STAT_PAGES, 1);
+    TRACE_END(ctx->trace_page, "txt", "page", "page", ctx->page);
+    TRACE_START(ctx->trace_page);
+    ctx->page++;
+    PROBE3(txt_page, ctx->page, ctx->lineno, ctx->written);
+  }
+  else if (strcmp(buff, "[Blank Page]") == 0)
+  {
+  }
+  else if (buff[0] == 0)
+  {
+    if (ctx->poetry_mode == 0)
+      rflush(ctx);
+    else
+    {
+      fprintf(ctx->outfile, "\n");
+      wrote(ctx, 1);
+    }
+  }
+  else
+  {
+    /*
+     * <tb> turns 4 bytes into 30, and nothing else grows by as much,
+     * so 8 bytes out for every byte in is always enough.
+     */
+    if (buffer_reserve(&ctx->line, &ctx->line_size, 8*len+1) < 0)
+      return;
+    line = ctx->line;
+    cp1 = buff;
+    cp2 = line;
+    while (*cp1)
+    {
+      switch (*cp1)
+      {
+        case '\r':
+        case '\n':
+          cp1++;
+          break;
+        case '<':
+          token = cursor_token(ctx->tokens, cp1, &l);
+          STATS_COUNT(ctx->stats, STAT_MARKUP, token != MK_NONE);
+          switch (token)
+          {
+            case MK_ITALIC:
+            case MK_END_ITALIC:
+            case MK_UNDERLINE:
+            case MK_END_UNDERLINE:
+              *cp2 = '_';
+              cp2++;
+              cp1 += l;
+              break;
+            case MK_BOLD:
+            case MK_END_BOLD:
+            case MK_FRAKTUR:
+            case MK_END_FRAKTUR:
+              *cp2 = '*';
+              cp2++;
+              cp1 += l;
+              break;
+            case MK_SC:
+              cp1 += l;
+              ctx->caps_mode = 1;
+              break;
+            case MK_END_SC:
+              cp1 += l;
+              ctx->caps_mode = 0;
+              break;
+            case MK_TB:
+              strcpy(cp2, hrule);
+              cp2 += strlen(hrule);
+              cp1 += l;
+              break;
+            default:
+              txt_warning(ctx, DIAG_MARKUP, cp1, "Unexpected markup: %.*s",
+                (int) strcspn(cp1, ">") + 1, cp1);
+              *cp2 = *cp1;
+              cp1++;
+              cp2++;
+              break;
+          }
+          break;
+        case '[':
+          token = cursor_token(ctx->tokens, cp1, &l);
+          STATS_COUNT(ctx->stats, STAT_MARKUP, token != MK_NONE);
+          switch (token)
+          {
+            case MK_FORMAT:
+              format_command(ctx, &cp1);
+              break;
+            case MK_KERAIA:
+            case MK_STIGMA:
+            case MK_CAPITAL_STIGMA:
+            case MK_ENTITY:
+              STATS_COUNT(ctx->stats, STAT_ENTITIES, 1);
+              STATS_START(ctx->stats, t0);
+              e = find_entity(cp1, &l);
+              STATS_STOP(ctx->stats, STAT_T_ENTITY, t0);
+              cp1 += l;
+              if (ctx->expand_entities)
+              {
+                cp2 += utf8_encode(cp2, e->unicode);
+              }
+              else if (e->latin1)
+              {
+                strcpy(cp2, e->latin1);
+                cp2 += strlen(e->latin1);
+              }
+              else
+              {
+                strcpy(cp2, e->name);
+                cp2 += strlen(e->name);
+              }
+              break;
+            default:
+              *cp2 = *cp1;
+              cp1++;
+              cp2++; 
+              break;
+          }
+          break; 
+        default:
+          if (ctx->caps_mode)
+          {
+            cp2 += utf8_encode(cp2, utf8_toupper(utf8_decode(&cp1)));
+          }
+          else
+          {
+            *cp2 = *cp1;
+            cp1++;
+            cp2++;
+          }
+          break; 
+      }
+    }
+    *cp2 = 0;
+    if (ctx->poetry_mode)
+    {
+      if (ctx->quote_mode)
+        rewrap_poem(ctx, ctx->poetry_indent+ctx->quote_indent, line);
+      else
+        rewrap_poem(ctx, ctx->poetry_indent, line);
+    }
+    else if (ctx->quote_mode)
+    {
+      rewrap(ctx, ctx->quote_indent, line);
+    }
+    else
+    {
+      rewrap(ctx, 0, line);
+    }
+  }
+}
+
+/*
+ * End the page's span on the thread that started it, for a caller that
+ * calls txt_end on another.
+ */
+
+void txt_trace_end(struct txt_context *ctx)
+{
+  TRACE_END(ctx->trace_page, "txt", "page", "page", ctx->page);
+  ctx->trace_page = 0;
+}
+
+void txt_end(struct txt_context *ctx)
+{
+  ctx->line_text = NULL;
+  rflush(ctx);
+  txt_trace_end(ctx);
+  diag_end(ctx->diag);
+  ctx->diag = NULL;
+  free(ctx->rbuff);
+  free(ctx->line);
+  ctx->rbuff = NULL;
+  ctx->rptr = NULL;
+  ctx->rsize = 0;
+  ctx->rstart = 0;
+  ctx->line = NULL;
+  ctx->line_size = 0;
+}
+
+/*
+ * Convert a whole book. Returns -1 if it couldn't all be read.
+ */
+
+int txt_convert(struct txt_context *ctx, FILE *infile)
+{
+struct reader r;
+char *line;
+size_t len;
+int status;
+
+  reader_init(&r, infile);
+  if (r.mapped)
+    STATS_COUNT(ctx->stats, STAT_BYTES_IN, r.map.size);
+
+  while ((line = reader_line(&r, &len)) != NULL)
+  {
+    STATS_COUNT(ctx->stats, STAT_BYTES_IN, r.mapped ? 0 : len);
+    txt_line(ctx, line);
+  }
+
+  status = reader_check(&r);
+  txt_end(ctx);
+  reader_free(&r);
+  return status;
+}
+
+/*
+ * Convert one book of a batch. arg is a context holding the options.
+ */
+
+int txt_batch(void *arg, char *name, FILE *infile, FILE *outfile)
+{
+struct txt_context *ctx;
+struct txt_context *opts = arg;
+int status;
+
+  ctx = malloc(sizeof(struct txt_context));
+  if (ctx == NULL)
+    return -1;
+  txt_context_init(ctx);
+  ctx->outfile = outfile;
+  ctx->input_name = name;
+  ctx->expand_entities = opts->expand_entities;
+  ctx->quote_indent = opts->quote_indent;
+  ctx->poetry_indent = opts->poetry_indent;
+  ctx->poetry_indent2 = opts->poetry_indent2;
+  ctx->poetry_limit = opts->poetry_limit;
+  ctx->diag_format = opts->diag_format;
+  ctx->diag_max = opts->diag_max;
+  if (opts->stats)
+    ctx->stats = calloc(1, sizeof(struct dp_stats));
+
+  status = txt_convert(ctx, infile);
+
+  if (ctx->stats)
+  {
+    stats_add(opts->stats, ctx->stats);
+    free(ctx->stats);
+  }
+
+  if (ferror(outfile))
+    status = -1;
+  free(ctx);
+  return status;
+}
@@ -0,0 +1,240 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * utf8.c - UTF-8 encoding and decoding
+ *
+ * This doesn't depend on the locale, so the tools behave the same
+ * whatever LANG is set to.
+ */
+
+#include <stdio.h>
+
+#include "utf8.h"
+
+/*
+ * Decode one character and advance *sp past it. A byte that doesn't start
+ * a valid sequence is decoded as U+FFFD and skipped on its own.
+ */
+
+int utf8_decode(char **sp)
+{
+unsigned char *s = (unsigned char *) *sp;
+int c;
+int n;
+int i;
+
+  if (s[0] < 0x80)
+  {
+    *sp += 1;
+    return s[0];
+  }
+  else if ((s[0] & 0xe0) == 0xc0)
+  {
+    c = s[0] & 0x1f;
+    n = 1;
+  }
+  else if ((s[0] & 0xf0) == 0xe0)
+  {
+    c = s[0] & 0x0f;
+    n = 2;
+  }
+  else if ((s[0] & 0xf8) == 0xf0)
+  {
+    c = s[0] & 0x07;
+    n = 3;
+  }
+  else
+  {
+    *sp += 1;
+    return UTF8_REPLACEMENT;
+  }
+
+  for (i=1;i<=n;i++)
+  {
+    if ((s[i] & 0xc0) != 0x80)
+    {
+      *sp += 1;
+      return UTF8_REPLACEMENT;
+    }
+    c = (c << 6) | (s[i] & 0x3f);
+  }
+
+  /* Overlong forms are not valid */
+  if (((n == 1) && (c < 0x80)) || ((n == 2) && (c < 0x800))
+    || ((n == 3) && ((c < 0x10000) || (c > 0x10ffff))))
+  {
+    *sp += 1;
+    return UTF8_REPLACEMENT;
+  }
+
+  *sp += n+1;
+  return c;
+}
+
+/*
+ * Encode c into buff, which must have room for 4 bytes.
+ * Returns the number of bytes used.
+ */
+
+int utf8_encode(char *buff, int c)
+{
+  if (c < 0x80)
+  {
+    buff[0] = c;
+    return 1;
+  }
+  else if (c < 0x800)
+  {
+    buff[0] = 0xc0 | (c >> 6);
+    buff[1] = 0x80 | (c & 0x3f);
+    return 2;
+  }
+  else if (c < 0x10000)
+  {
+    buff[0] = 0xe0 | (c >> 12);
+    buff[1] = 0x80 | ((c >> 6) & 0x3f);
+    buff[2] = 0x80 | (c & 0x3f);
+    return 3;
+  }
+  else
+  {
+    buff[0] = 0xf0 | (c >> 18);
+    buff[1] = 0x80 | ((c >> 12) & 0x3f);
+    buff[2] = 0x80 | ((c >> 6) & 0x3f);
+    buff[3] = 0x80 | (c & 0x3f);
+    return 4;
+  }
+}
+
+void utf8_putc(int c, FILE *outfile)
+{
+char buff[4];
+int len;
+
+  if (c < 0x80)
+  {
+    putc(c, outfile);
+    return;
+  }
+  len = utf8_encode(buff, c);
+  fwrite(buff, 1, len, outfile);
+}
+
+/*
+ * The number of characters in the first nbytes bytes of str.
+ * Continuation bytes are the only ones that don't start a character.
+ */
+
+int utf8_length(const char *str, int nbytes)
+{
+int n = 0;
+int i;
+
+  for (i=0;i<nbytes;i++)
+    if ((str[i] & 0xc0) != 0x80)
+      n++;
+  return n;
+}
+
+/*
+ * The byte offset of character number nchars in str, or of the
+ * terminating null if str is shorter than that.
+ */
+
+int utf8_offset(const char *str, int nchars)
+{
+int i = 0;
+
+  while (str[i])
+  {
+    if ((str[i] & 0xc0) != 0x80)
+    {
+      if (nchars == 0)
+        break;
+      nchars--;
+    }
+    i++;
+  }
+  return i;
+}
+
+/*
+ * Upper case, for the alphabets that turn up in Distributed Proofreaders
+ * books. The ranges are in order. In each range, step is 1 if every character has an upper case
+ * form, or 2 if lower and upper case alternate.
+ */
+
+struct case_range {
+  int first;
+  int last;
+  int step;
+  int delta;
+};
+
+static struct case_range upper_table[] = {
+  {'a', 'z', 1, -0x20},
+  {0xb5, 0xb5, 1, 0x39c - 0xb5},
+  {0xe0, 0xf6, 1, -0x20},
+  {0xf8, 0xfe, 1, -0x20},
+  {0xff, 0xff, 1, 0x178 - 0xff},
+  {0x101, 0x12f, 2, -1},
+  {0x131, 0x131, 1, 'I' - 0x131},
+  {0x133, 0x137, 2, -1},
+  {0x13a, 0x148, 2, -1},
+  {0x14b, 0x177, 2, -1},
+  {0x17a, 0x17e, 2, -1},
+  {0x17f, 0x17f, 1, 'S' - 0x17f},
+  {0x3ac, 0x3ac, 1, 0x386 - 0x3ac},
+  {0x3ad, 0x3af, 1, 0x388 - 0x3ad},
+  {0x3b1, 0x3c1, 1, -0x20},
+  {0x3c2, 0x3c2, 1, 0x3a3 - 0x3c2},
+  {0x3c3, 0x3cb, 1, -0x20},
+  {0x3cc, 0x3cc, 1, 0x38c - 0x3cc},
+  {0x3cd, 0x3ce, 1, 0x38e - 0x3cd},
+  {0x430, 0x44f, 1, -0x20},
+  {0x450, 0x45f, 1, -0x50},
+  {0x1e01, 0x1e95, 2, -1},
+  {0x1ea1, 0x1eff, 2, -1},
+  {0, 0, 0, 0}
+};
+
+int utf8_toupper(int c)
+{
+struct case_range *r;
+
+  if (c < 'a')
+    return c;
+
+  for (r = upper_table; r->step; r++)
+  {
+    if (c < r->first)
+      break;
+    if ((c <= r->last) && (((c - r->first) % r->step) == 0))
+      return c + r->delta;
+  }
+  return c;
+}
@@ -0,0 +1,213 @@
+/*-
+ * Copyright (c) 2020 Michael Roe
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/*
+ * watch.c - convert a book again whenever it changes
+ *
+ * dphtml --watch keeps the pages of the last conversion in memory, keyed
+ * as they are for --cache. After an edit, only the pages that changed
+ * are rendered again, along with any after them that now start in a
+ * different state. The input's directory is watched rather than the file
+ * itself, as many editors save by renaming a new file over the old one.
+ * Others rewrite the file in place, so it is read into memory rather than
+ * mapped: a mapping of a file that is truncated under it gives SIGBUS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/inotify.h>
+
+#include "dptools.h"
+#include "cache.h"
+
+static double now()
+{
+struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/*
+ * Convert into a temporary file and rename it over the output, so that
+ * anything reading the output never sees half of it.
+ */
+
+static int convert_once(struct dp_context *ctx, char *inname, char *outname,
+  char *tmpname)
+{
+struct dp_context run;
+FILE *in;
+FILE *out;
+double start;
+int status = 0;
+
+  start = now();
+
+  /* It may be in the middle of being replaced; the next event will do */
+  in = fopen(inname, "r");
+  if (in == NULL)
+  {
+    perror(inname);
+    return -1;
+  }
+  out = fopen(tmpname, "w");
+  if (out == NULL)
+  {
+    perror(tmpname);
+    fclose(in);
+    return -1;
+  }
+
+  run = *ctx;
+  run.outfile = out;
+  run.pages_rendered = 0;
+  if (html_convert(&run, in) < 0)
+    status = -1;
+  fclose(in);
+
+  if (run.out.error || ferror(out))
+    status = -1;
+  if (fclose(out) != 0)
+    status = -1;
+  if ((status == 0) && (rename(tmpname, outname) < 0))
+  {
+    perror(outname);
+    status = -1;
+  }
+  if (status < 0)
+    unlink(tmpname);
+
+  cache_table_sweep(ctx->memo);
+
+  fprintf(stderr, "%s: %d pages rendered in %.3f s\n", outname,
+    run.pages_rendered, now() - start);
+  return status;
+}
+
+/*
+ * Convert inname to outname, then again each time inname is written.
+ * Only returns if something goes wrong.
+ */
+
+int html_watch(struct dp_context *ctx, char *inname, char *outname)
+{
+struct cache_table memo;
+char buff[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+struct inotify_event *ev;
+char *dir;
+char *base;
+char *tmpname;
+ssize_t len;
+char *cp;
+int changed;
+int fd;
+
+  if (outname == NULL)
+  {
+    fprintf(stderr, "--watch needs an output file (-o)\n");
+    return 1;
+  }
+  if (*inname == '\0')
+  {
+    fprintf(stderr, "--watch needs an input file\n");
+    return 1;
+  }
+  if (strcmp(inname, outname) == 0)
+  {
+    fprintf(stderr, "%s: output would overwrite input\n", inname);
+    return 1;
+  }
+
+  /* With room for "." in place of the name */
+  dir = malloc(strlen(inname) + 2);
+  tmpname = malloc(strlen(outname) + 32);
+  if ((dir == NULL) || (tmpname == NULL))
+  {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  strcpy(dir, inname);
+  sprintf(tmpname, "%s.%ld.tmp", outname, (long) getpid());
+  base = strrchr(dir, '/');
+  if (base)
+  {
+    *base++ = '\0';
+    if (*dir == '\0')
+      strcpy(dir, "/");
+  }
+  else
+  {
+    base = inname;
+    strcpy(dir, ".");
+  }
+
+  fd = inotify_init();
+  if ((fd < 0) ||
+    (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0))
+  {
+    perror(dir);
+    return 1;
+  }
+
+  cache_table_init(&memo);
+  ctx->memo = &memo;
+  ctx->copy_input = 1;
+
+  convert_once(ctx, inname, outname, tmpname);
+
+  for (;;)
+  {
+    len = read(fd, buff, sizeof(buff));
+    if (len < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("inotify");
+      break;
+    }
+
+    changed = 0;
+    for (cp = buff; cp < buff + len; cp += sizeof(*ev) + ev->len)
+    {
+      ev = (struct inotify_event *) cp;
+      if (ev->len && (strcmp(ev->name, base) == 0))
+        changed = 1;
+    }
+    if (changed)
+      convert_once(ctx, inname, outname, tmpname);
+  }
+
+  close(fd);
+  ctx->memo = NULL;
+  cache_table_free(&memo);
+  free(tmpname);
+  free(dir);
+  return 1;
+}